@@ -0,0 +1,1020 @@
+#include "Mock_server.hpp"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <deque>
+#include <limits>
+#include <string_view>
+#include <thread>
+
+namespace speedtest::bench {
+struct Mock_server::Worker {
+    static constexpr const std::size_t request_sz = 8 * 1024;
+    static constexpr const std::size_t scratch_sz = 256 * 1024;
+
+    struct Segment {
+        std::uint64_t arrival_ns;
+        std::uint64_t len;
+    };
+
+    struct Connection {
+        int fd;
+        /**
+         * Index in Worker::connections.
+         */
+        std::size_t index;
+        std::uint32_t events = EPOLLIN;
+
+        /**
+         * Bytes received but not yet parsed.
+         */
+        char request[request_sz];
+        std::size_t request_len = 0;
+
+        /**
+         * Bytes of the request body of upload.php not yet received.
+         */
+        std::uint64_t upload_left = 0;
+        std::uint64_t upload_len = 0;
+
+        /**
+         * True if a response is being sent, in which case nothing is read.
+         */
+        bool writing = false;
+        bool close_after = false;
+
+        char head[256];
+        std::size_t head_len = 0;
+        /**
+         * nullptr if the body is cut from Mock_server::payload.
+         */
+        const char *body = nullptr;
+        std::uint64_t body_len = 0;
+        /**
+         * Bytes of head and body sent.
+         */
+        std::uint64_t sent = 0;
+
+        char upload_reply[32];
+
+        /**
+         * Only used if the link is shaped, times are of Shaped_link::now_ns().
+         */
+        struct Shaping {
+            /**
+             * The last byte of the request arrives, no byte of the response
+             * is sent onto the link before it.
+             */
+            std::uint64_t ready_ns = 0;
+
+            /**
+             * The last segment sent onto each direction leaves the link, 
+             * the next one is not sent before it.
+             */
+            std::uint64_t up_departure_ns = 0;
+            std::uint64_t down_departure_ns = 0;
+            /**
+             * The last segment sent onto each direction arrives, so that
+             * jitter does not reorder segments.
+             */
+            std::uint64_t up_arrival_ns = 0;
+            std::uint64_t down_arrival_ns = 0;
+
+            /**
+             * Bytes of head and body sent onto the link, and bytes of them
+             * arrived at the client, which can be written to fd.
+             */
+            std::uint64_t scheduled = 0;
+            std::uint64_t arrived = 0;
+            /**
+             * Segments of the response on the link, in the order they arrive.
+             */
+            std::deque<Segment> in_flight;
+
+            /**
+             * If not 0, nothing can be done on this connection until then.
+             */
+            std::uint64_t wake_ns = 0;
+        } shaping;
+    };
+
+    enum class Progress {
+        /**
+         * Nothing more can be done until the socket is ready.
+         */
+        blocked,
+        more,
+        /**
+         * Nothing more can be done until Connection::shaping.wake_ns.
+         */
+        waiting,
+        failed,
+    };
+
+    Mock_server &server;
+
+    int listen_fd = -1;
+    int epoll_fd = -1;
+    /**
+     * Wakes up connections waiting for the shaped link, -1 if the link is not shaped.
+     */
+    int timer_fd = -1;
+    std::thread thread;
+
+    std::vector<std::unique_ptr<Connection>> connections;
+    std::unique_ptr<char[]> scratch;
+
+    Shaped_link::Rng rng;
+
+    std::atomic<std::uint64_t> bytes_sent{0};
+    std::atomic<std::uint64_t> bytes_received{0};
+
+    /**
+     * @param index of this worker, seeds rng.
+     */
+    Worker(Mock_server &server, unsigned index) noexcept:
+        server{server},
+        scratch{std::make_unique<char[]>(scratch_sz)},
+        rng{0x9e3779b97f4a7c15 * (index + 1)}
+    {}
+
+    ~Worker()
+    {
+        for (auto &conn: connections)
+            close(conn->fd);
+        if (listen_fd != -1)
+            close(listen_fd);
+        if (epoll_fd != -1)
+            close(epoll_fd);
+        if (timer_fd != -1)
+            close(timer_fd);
+    }
+
+    /**
+     * @return false on failure, errno is set.
+     */
+    bool listen(const struct sockaddr *addr, socklen_t addrlen) noexcept
+    {
+        listen_fd = socket(addr->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listen_fd == -1)
+            return false;
+
+        int enable = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+        // Let the kernel spread connections across workers.
+        if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) == -1)
+            return false;
+
+        if (server.uplink) {
+            /**
+             * Inherited by accepted sockets.
+             *
+             * Keep the receive buffer small, since the client counts bytes 
+             * of upload once they are buffered here, before they go through 
+             * the uplink.
+             * <br>Advertise the MSS of ethernet instead of that of loopback,
+             * so that the client sizes its send buffer as it does on a real link.
+             */
+            int rcvbuf = std::max<std::size_t>(2 * server.uplink->get_segment_sz(), 4096);
+            int mss = 1448;
+            setsockopt(listen_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+            setsockopt(listen_fd, IPPROTO_TCP, TCP_MAXSEG, &mss, sizeof(mss));
+        }
+
+        if (bind(listen_fd, addr, addrlen) == -1 || ::listen(listen_fd, 1024) == -1)
+            return false;
+
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd == -1)
+            return false;
+
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.ptr = nullptr;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) == -1)
+            return false;
+
+        event.data.ptr = this;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server.stop_fd, &event) == -1)
+            return false;
+
+        if (!server.downlink)
+            return true;
+
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timer_fd == -1)
+            return false;
+
+        event.data.ptr = &timer_fd;
+        return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &event) != -1;
+    }
+
+    void run() noexcept
+    {
+        struct epoll_event events[64];
+
+        for (;;) {
+            int n = epoll_wait(epoll_fd, events, 64, -1);
+            if (n == -1) {
+                if (errno == EINTR)
+                    continue;
+                return;
+            }
+
+            for (int i = 0; i != n; ++i) {
+                auto *ptr = events[i].data.ptr;
+
+                if (ptr == this)
+                    return;
+                else if (ptr == nullptr)
+                    accept_all();
+                else if (ptr == &timer_fd) {
+                    std::uint64_t expirations;
+                    read(timer_fd, &expirations, sizeof(expirations));
+                } else {
+                    auto &conn = *static_cast<Connection*>(ptr);
+                    if ((events[i].events & (EPOLLERR | EPOLLHUP)) || !serve(conn))
+                        close_connection(conn);
+                }
+            }
+
+            if (timer_fd != -1)
+                wake_connections();
+        }
+    }
+
+    /**
+     * Serve connections whose shaping.wake_ns has passed, then arm timer_fd 
+     * for the earliest of the rest.
+     */
+    void wake_connections() noexcept
+    {
+        auto now = Shaped_link::now_ns();
+        auto earliest = std::numeric_limits<std::uint64_t>::max();
+
+        // Backwards, since close_connection moves the last connection into the closed one.
+        for (auto i = connections.size(); i-- != 0; ) {
+            auto &conn = *connections[i];
+
+            if (conn.shaping.wake_ns == 0)
+                continue;
+            if (conn.shaping.wake_ns <= now && !serve(conn)) {
+                close_connection(conn);
+                continue;
+            }
+            if (conn.shaping.wake_ns != 0)
+                earliest = std::min(earliest, conn.shaping.wake_ns);
+        }
+
+        // All zero disarms the timer.
+        struct itimerspec spec = {};
+        if (earliest != std::numeric_limits<std::uint64_t>::max()) {
+            spec.it_value.tv_sec = earliest / (1000 * 1000 * 1000);
+            spec.it_value.tv_nsec = earliest % (1000 * 1000 * 1000);
+        }
+        timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+    }
+
+    void accept_all() noexcept
+    {
+        for (;;) {
+            int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd == -1) {
+                if (errno == EINTR)
+                    continue;
+                return;
+            }
+
+            int enable = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+            auto &conn = *connections.emplace_back(std::make_unique<Connection>());
+            conn.fd = fd;
+            conn.index = connections.size() - 1;
+
+            struct epoll_event event = {};
+            event.events = conn.events;
+            event.data.ptr = &conn;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+                close_connection(conn);
+        }
+    }
+
+    void close_connection(Connection &conn) noexcept
+    {
+        close(conn.fd);
+
+        auto index = conn.index;
+        if (index != connections.size() - 1) {
+            connections[index] = std::move(connections.back());
+            connections[index]->index = index;
+        }
+        connections.pop_back();
+    }
+
+    bool set_events(Connection &conn, std::uint32_t events) noexcept
+    {
+        if (conn.events == events)
+            return true;
+
+        struct epoll_event event = {};
+        event.events = events;
+        event.data.ptr = &conn;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn.fd, &event) == -1)
+            return false;
+
+        conn.events = events;
+        return true;
+    }
+
+    /**
+     * Read and write as much as possible.
+     *
+     * @return false if conn should be closed.
+     */
+    bool serve(Connection &conn) noexcept
+    {
+        conn.shaping.wake_ns = 0;
+
+        for (;;) {
+            auto progress = conn.writing ? write_some(conn) : read_some(conn);
+
+            if (progress == Progress::failed)
+                return false;
+            if (progress == Progress::blocked)
+                return set_events(conn, conn.writing ? EPOLLOUT : EPOLLIN);
+            if (progress == Progress::waiting)
+                return set_events(conn, 0);
+        }
+    }
+
+    /**
+     * Send len bytes of request received at now onto the uplink.
+     */
+    void transmit_up(Connection &conn, std::uint64_t len, std::uint64_t now) noexcept
+    {
+        auto &shaping = conn.shaping;
+
+        auto transmission = server.uplink->transmit(len, now, rng);
+        shaping.up_departure_ns = transmission.departure_ns;
+        shaping.up_arrival_ns = std::max(shaping.up_arrival_ns, transmission.arrival_ns);
+        shaping.ready_ns = shaping.up_arrival_ns;
+    }
+
+    /**
+     * Move segments of the response that have arrived by now out of 
+     * in_flight, and send the next one onto the downlink if it is its turn.
+     *
+     * @return false if nothing is sent onto the downlink.
+     */
+    bool transmit_down(Connection &conn, std::uint64_t now) noexcept
+    {
+        auto &shaping = conn.shaping;
+
+        while (!shaping.in_flight.empty() && shaping.in_flight.front().arrival_ns <= now) {
+            shaping.arrived += shaping.in_flight.front().len;
+            shaping.in_flight.pop_front();
+        }
+
+        auto total = conn.head_len + conn.body_len;
+        if (shaping.scheduled == total || now < std::max(shaping.ready_ns, shaping.down_departure_ns))
+            return false;
+
+        auto len = std::min<std::uint64_t>(server.downlink->get_segment_sz(), total - shaping.scheduled);
+        auto transmission = server.downlink->transmit(len, now, rng);
+
+        shaping.down_departure_ns = transmission.departure_ns;
+        shaping.down_arrival_ns = std::max(shaping.down_arrival_ns, transmission.arrival_ns);
+        shaping.in_flight.push_back({shaping.down_arrival_ns, len});
+        shaping.scheduled += len;
+
+        return true;
+    }
+
+    auto read_some(Connection &conn) noexcept -> Progress
+    {
+        ssize_t ret;
+
+        if (conn.upload_left != 0) {
+            auto len = std::min<std::uint64_t>(scratch_sz, conn.upload_left);
+
+            // Read no faster than the uplink, so that the client is throttled by flow control.
+            std::uint64_t now = 0;
+            if (server.uplink) {
+                now = Shaped_link::now_ns();
+                if (now < conn.shaping.up_departure_ns) {
+                    conn.shaping.wake_ns = conn.shaping.up_departure_ns;
+                    return Progress::waiting;
+                }
+                len = std::min<std::uint64_t>(len, server.uplink->get_segment_sz());
+            }
+
+            ret = recv(conn.fd, scratch.get(), len, 0);
+            if (ret > 0) {
+                if (server.uplink)
+                    transmit_up(conn, ret, now);
+
+                bytes_received.fetch_add(ret, std::memory_order_relaxed);
+                conn.upload_left -= ret;
+                if (conn.upload_left == 0)
+                    respond_upload(conn);
+                return Progress::more;
+            }
+        } else {
+            if (parse_request(conn))
+                return Progress::more;
+            if (conn.request_len == request_sz)
+                return Progress::failed;
+
+            ret = recv(conn.fd, conn.request + conn.request_len, request_sz - conn.request_len, 0);
+            if (ret > 0) {
+                conn.request_len += ret;
+                return Progress::more;
+            }
+        }
+
+        if (ret == 0)
+            return Progress::failed;
+        if (errno == EINTR)
+            return Progress::more;
+        return errno == EAGAIN || errno == EWOULDBLOCK ? Progress::blocked : Progress::failed;
+    }
+
+    auto write_some(Connection &conn) noexcept -> Progress
+    {
+        if (conn.sent == conn.head_len + conn.body_len) {
+            if (conn.close_after)
+                return Progress::failed;
+
+            conn.writing = false;
+            return Progress::more;
+        }
+
+        // Bytes of head and body that can be written.
+        auto end = conn.head_len + conn.body_len;
+
+        if (server.downlink) {
+            auto &shaping = conn.shaping;
+            auto now = Shaped_link::now_ns();
+
+            if (transmit_down(conn, now))
+                return Progress::more;
+
+            if (conn.sent == shaping.arrived) {
+                auto wake_ns = std::numeric_limits<std::uint64_t>::max();
+                if (!shaping.in_flight.empty())
+                    wake_ns = shaping.in_flight.front().arrival_ns;
+                if (shaping.scheduled != end)
+                    wake_ns = std::min(wake_ns, std::max(shaping.ready_ns, shaping.down_departure_ns));
+
+                shaping.wake_ns = wake_ns;
+                return Progress::waiting;
+            }
+
+            end = shaping.arrived;
+        }
+
+        struct iovec iov[2];
+        int iovcnt = 0;
+
+        if (conn.sent < conn.head_len)
+            iov[iovcnt++] = {conn.head + conn.sent, std::min<std::uint64_t>(conn.head_len, end) - conn.sent};
+
+        auto body_sent = conn.sent > conn.head_len ? conn.sent - conn.head_len : 0;
+        if (end > conn.head_len && body_sent != end - conn.head_len) {
+            auto left = end - conn.head_len - body_sent;
+
+            if (conn.body)
+                iov[iovcnt++] = {const_cast<char*>(conn.body + body_sent), left};
+            else {
+                auto offset = body_sent % payload_sz;
+                iov[iovcnt++] = {server.payload.get() + offset, std::min<std::uint64_t>(payload_sz - offset, left)};
+            }
+        }
+
+        struct msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+
+        auto ret = sendmsg(conn.fd, &msg, MSG_NOSIGNAL);
+        if (ret == -1) {
+            if (errno == EINTR)
+                return Progress::more;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? Progress::blocked : Progress::failed;
+        }
+
+        auto head_sent = conn.sent < conn.head_len ? std::min<std::uint64_t>(ret, conn.head_len - conn.sent) : 0;
+        bytes_sent.fetch_add(ret - head_sent, std::memory_order_relaxed);
+        conn.sent += ret;
+
+        return Progress::more;
+    }
+
+    void consume_request(Connection &conn, std::size_t len) noexcept
+    {
+        std::memmove(conn.request, conn.request + len, conn.request_len - len);
+        conn.request_len -= len;
+    }
+
+    void respond(Connection &conn, const char *status, const char *content_type,
+                 const char *body, std::uint64_t len, bool is_head = false) noexcept
+    {
+        conn.head_len = std::snprintf(conn.head, sizeof(conn.head),
+                                      "HTTP/1.1 %s\r\n"
+                                      "Content-Type: %s\r\n"
+                                      "Content-Length: %" PRIu64 "\r\n"
+                                      "%s\r\n",
+                                      status, content_type, len, conn.close_after ? "Connection: close\r\n" : "");
+        conn.body = body;
+        conn.body_len = is_head ? 0 : len;
+        conn.sent = 0;
+        conn.writing = true;
+
+        conn.shaping.scheduled = 0;
+        conn.shaping.arrived = 0;
+    }
+
+    void respond_error(Connection &conn, const char *status) noexcept
+    {
+        conn.close_after = true;
+        respond(conn, status, "text/plain", "", 0);
+    }
+
+    void respond_upload(Connection &conn) noexcept
+    {
+        auto len = std::snprintf(conn.upload_reply, sizeof(conn.upload_reply), "size=%" PRIu64, conn.upload_len);
+        respond(conn, "200 OK", "text/plain", conn.upload_reply, len);
+    }
+
+    /**
+     * @return false if the header of the request is not complete yet,
+     *         otherwise the request is consumed and either a response is
+     *         started or the request body is to be received.
+     */
+    bool parse_request(Connection &conn) noexcept
+    {
+        using namespace std::literals;
+
+        std::string_view buffered{conn.request, conn.request_len};
+
+        auto header_end = buffered.find("\r\n\r\n");
+        if (header_end == std::string_view::npos)
+            return false;
+
+        auto header = buffered.substr(0, header_end + 2);
+        auto request_line = header.substr(0, header.find("\r\n"));
+        header.remove_prefix(request_line.size() + 2);
+
+        auto first_space = request_line.find(' ');
+        auto last_space = request_line.rfind(' ');
+        if (first_space == std::string_view::npos || first_space == last_space) {
+            respond_error(conn, "400 Bad Request");
+            return true;
+        }
+
+        auto method = request_line.substr(0, first_space);
+        auto path = request_line.substr(first_space + 1, last_space - first_space - 1);
+        auto version = request_line.substr(last_space + 1);
+
+        path = path.substr(0, path.find('?'));
+        // Absolute form, e.g. http://host/path
+        if (auto scheme_end = path.find("://"); scheme_end != std::string_view::npos) {
+            path.remove_prefix(scheme_end + 3);
+            path.remove_prefix(std::min(path.find('/'), path.size()));
+        }
+
+        auto connection = get_header(header, "connection");
+        conn.close_after = version == "HTTP/1.0" ? !iequals(connection, "keep-alive") : iequals(connection, "close");
+
+        bool is_head = method == "HEAD";
+        bool is_upload = method == "POST" && has_suffix(path, "upload.php");
+        bool expect_continue = false;
+
+        // method, path and header are views of request, so everything needed from 
+        // them is decided before the request is consumed.
+        const char *error_status = nullptr;
+        Static_response response{};
+        std::uint64_t len = 0;
+
+        if (is_upload) {
+            std::string_view content_length = get_header(header, "content-length");
+            auto *end = content_length.data() + content_length.size();
+
+            if (!get_header(header, "transfer-encoding").empty())
+                error_status = "411 Length Required";
+            else if (std::from_chars(content_length.data(), end, len).ptr != end)
+                error_status = "400 Bad Request";
+
+            expect_continue = iequals(get_header(header, "expect"), "100-continue");
+        } else if (method != "GET" && !is_head)
+            error_status = "405 Method Not Allowed";
+        else
+            response = route(path);
+
+        consume_request(conn, header_end + 4);
+
+        std::uint64_t now = 0;
+        if (server.uplink) {
+            now = Shaped_link::now_ns();
+            transmit_up(conn, header_end + 4, now);
+        }
+
+        if (error_status) {
+            respond_error(conn, error_status);
+            return true;
+        }
+
+        if (!is_upload) {
+            respond(conn, response.status, response.content_type, response.body, response.len, is_head);
+            return true;
+        }
+
+        // Part of the body may have arrived along with the header.
+        auto buffered_len = std::min<std::uint64_t>(len, conn.request_len);
+        consume_request(conn, buffered_len);
+        bytes_received.fetch_add(buffered_len, std::memory_order_relaxed);
+        if (server.uplink && buffered_len != 0)
+            transmit_up(conn, buffered_len, now);
+
+        conn.upload_len = len;
+        conn.upload_left = len - buffered_len;
+
+        if (conn.upload_left == 0)
+            respond_upload(conn);
+        else if (expect_continue) {
+            static constexpr const auto continue_line = "HTTP/1.1 100 Continue\r\n\r\n"sv;
+            // Fits in an empty socket buffer, and the client sends the body anyway
+            // after a timeout if this is lost.
+            // Not held back by the shaped link, it carries no data.
+            send(conn.fd, continue_line.data(), continue_line.size(), MSG_NOSIGNAL);
+        }
+
+        return true;
+    }
+
+    /**
+     * Response to GET or HEAD, body is nullptr for generated images.
+     */
+    struct Static_response {
+        const char *status;
+        const char *content_type;
+        const char *body;
+        std::uint64_t len;
+    };
+
+    auto route(std::string_view path) const noexcept -> Static_response
+    {
+        using namespace std::literals;
+
+        static constexpr const auto latency_txt = "test=test\n"sv;
+        static constexpr const auto not_found = "Not Found\n"sv;
+
+        if (path == "/speedtest-config.php")
+            return {"200 OK", "text/xml", server.config_xml.data(), server.config_xml.size()};
+        else if (path == "/speedtest-servers-static.php" || path == "/speedtest-servers.php")
+            return {"200 OK", "text/xml", server.servers_xml.data(), server.servers_xml.size()};
+        else if (has_suffix(path, "/latency.txt"))
+            return {"200 OK", "text/plain", latency_txt.data(), latency_txt.size()};
+        else if (auto n = parse_image_name(path); n != 0)
+            return {"200 OK", "image/jpeg", nullptr, get_image_size(n)};
+        else
+            return {"404 Not Found", "text/plain", not_found.data(), not_found.size()};
+    }
+
+    /**
+     * @return N of .../randomNxN.jpg, 0 if path is not such a file.
+     */
+    static unsigned parse_image_name(std::string_view path) noexcept
+    {
+        auto pos = path.rfind("/random");
+        if (pos == std::string_view::npos || !has_suffix(path, ".jpg"))
+            return 0;
+
+        auto name = path.substr(pos + 7);
+        unsigned n = 0;
+        auto *end = name.data() + name.size();
+        auto *p = std::from_chars(name.data(), end, n).ptr;
+
+        return p != end && *p == 'x' ? n : 0;
+    }
+
+    static bool has_suffix(std::string_view str, std::string_view suffix) noexcept
+    {
+        return str.size() >= suffix.size() && str.substr(str.size() - suffix.size()) == suffix;
+    }
+
+    static bool iequals(std::string_view x, std::string_view y) noexcept
+    {
+        return x.size() == y.size() && std::equal(x.begin(), x.end(), y.begin(), [](char c1, char c2) noexcept
+        {
+            return (c1 | 0x20) == (c2 | 0x20);
+        });
+    }
+
+    /**
+     * @param header header fields, each ends with CRLF.
+     * @param name in lower case.
+     * @return value with surrounding whitespaces removed, empty if not found.
+     */
+    static auto get_header(std::string_view header, std::string_view name) noexcept -> std::string_view
+    {
+        while (!header.empty()) {
+            auto line = header.substr(0, header.find("\r\n"));
+            header.remove_prefix(std::min(line.size() + 2, header.size()));
+
+            auto colon = line.find(':');
+            if (colon == std::string_view::npos || !iequals(line.substr(0, colon), name))
+                continue;
+
+            auto value = line.substr(colon + 1);
+            while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+                value.remove_prefix(1);
+            while (!value.empty() && (value.back() == ' ' || value.back() == '\t'))
+                value.remove_suffix(1);
+
+            return value;
+        }
+
+        return {};
+    }
+};
+
+Mock_server::Mock_server() noexcept:
+    Mock_server{Options{}}
+{}
+Mock_server::Mock_server(const Options &options) noexcept:
+    options{options}
+{
+    if (this->options.threads == 0)
+        this->options.threads = 1;
+}
+
+Mock_server::~Mock_server()
+{
+    stop();
+}
+
+auto Mock_server::get_image_size(unsigned n) noexcept -> std::uint64_t
+{
+    // Sizes of randomNxN.jpg on the servers of speedtest.net.
+    static constexpr const std::pair<unsigned, std::uint64_t> sizes[] = {
+        {350, 245388}, {500, 505544}, {750, 1118012}, {1000, 1986284}, {1500, 4468241},
+        {2000, 7907740}, {2500, 12407926}, {3000, 17816816}, {3500, 24262167}, {4000, 31625365},
+    };
+
+    for (const auto &[size_n, size]: sizes) {
+        if (size_n == n)
+            return size;
+    }
+    return std::uint64_t{n} * n * 2;
+}
+
+void Mock_server::build_xmls(const char *host) noexcept
+{
+    // Position of the client, servers are placed around it.
+    static constexpr const double lat = 22.3;
+    static constexpr const double lon = 114.2;
+
+    char buffer[1024];
+
+    config_xml.assign("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<settings>\n");
+    std::snprintf(buffer, sizeof(buffer),
+                  "<client ip=\"%s\" lat=\"%.4f\" lon=\"%.4f\" isp=\"Loopback\" isprating=\"3.7\" rating=\"0\" "
+                  "ispdlavg=\"0\" ispulavg=\"0\" loggedin=\"0\" country=\"LO\"/>\n"
+                  "<server-config threadcount=\"4\" ignoreids=\"\" notonmap=\"\" forcepingid=\"\" "
+                  "preferredserverid=\"\"/>\n"
+                  "<download testlength=\"%u\" initialtest=\"250K\" mintestsize=\"250K\" threadsperurl=\"4\"/>\n"
+                  "<upload testlength=\"%u\" ratio=\"5\" initialtest=\"0\" mintestsize=\"32K\" threads=\"2\" "
+                  "maxchunksize=\"512K\" maxchunkcount=\"50\" threadsperurl=\"4\"/>\n"
+                  "<latency testlength=\"10\" waittime=\"50\" timeout=\"20\"/>\n",
+                  host, lat, lon, options.test_length, options.test_length);
+    config_xml.append(buffer);
+    config_xml.append("</settings>\n");
+
+    servers_xml.assign("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<settings>\n<servers>\n");
+    for (unsigned i = 0; i != options.servers_cnt; ++i) {
+        std::snprintf(buffer, sizeof(buffer),
+                      "<server url=\"http://%s/speedtest/upload.php\" lat=\"%.4f\" lon=\"%.4f\" "
+                      "name=\"Mock %u\" country=\"Loopback\" cc=\"LO\" sponsor=\"cpp-speedtest\" id=\"%u\" "
+                      "host=\"%s\"/>\n",
+                      address.c_str(), lat + 0.01 * i, lon, i, i + 1, address.c_str());
+        servers_xml.append(buffer);
+    }
+    servers_xml.append("</servers>\n</settings>\n");
+}
+
+bool Mock_server::start(const char *host, unsigned short port) noexcept
+{
+    stop();
+
+    if (!payload) {
+        payload = std::make_unique<char[]>(payload_sz);
+
+        // Incompressible, as the real images are.
+        std::uint64_t state = 0x9e3779b97f4a7c15;
+        for (std::size_t i = 0; i != payload_sz; ++i) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            payload[i] = static_cast<char>(state);
+        }
+    }
+
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV | AI_PASSIVE;
+
+    char port_str[8];
+    std::snprintf(port_str, sizeof(port_str), "%u", unsigned{port});
+
+    struct addrinfo *addrs;
+    if (int ret = getaddrinfo(host, port_str, &hints, &addrs); ret != 0) {
+        errno = ret == EAI_SYSTEM ? errno : EINVAL;
+        return false;
+    }
+
+    struct sockaddr_storage addr;
+    socklen_t addrlen = addrs->ai_addrlen;
+    std::memcpy(&addr, addrs->ai_addr, addrlen);
+    freeaddrinfo(addrs);
+
+    auto fail = [&]() noexcept
+    {
+        int saved_errno = errno;
+        stop();
+        errno = saved_errno;
+        return false;
+    };
+
+    if (options.link.is_shaped()) {
+        downlink = std::make_unique<Shaped_link>(options.link);
+        uplink = std::make_unique<Shaped_link>(options.link);
+    } else {
+        downlink.reset();
+        uplink.reset();
+    }
+
+    stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (stop_fd == -1)
+        return false;
+
+    for (unsigned i = 0; i != options.threads; ++i) {
+        auto &worker = *workers.emplace_back(std::make_unique<Worker>(*this, i));
+        if (!worker.listen(reinterpret_cast<struct sockaddr*>(&addr), addrlen))
+            return fail();
+
+        // Bind the rest of workers to the port picked for the first one.
+        if (i == 0 && getsockname(worker.listen_fd, reinterpret_cast<struct sockaddr*>(&addr), &addrlen) == -1)
+            return fail();
+    }
+
+    if (addr.ss_family == AF_INET6) {
+        port = ntohs(reinterpret_cast<struct sockaddr_in6*>(&addr)->sin6_port);
+        address.assign(1, '[').append(host).append("]:");
+    } else {
+        port = ntohs(reinterpret_cast<struct sockaddr_in*>(&addr)->sin_port);
+        address.assign(host).append(1, ':');
+    }
+    address.append(std::to_string(port));
+
+    build_xmls(host);
+
+    for (auto &worker: workers)
+        worker->thread = std::thread{&Worker::run, worker.get()};
+
+    return true;
+}
+
+void Mock_server::stop() noexcept
+{
+    if (stop_fd == -1)
+        return;
+
+    std::uint64_t value = 1;
+    while (write(stop_fd, &value, sizeof(value)) == -1 && errno == EINTR)
+        ;
+
+    for (auto &worker: workers) {
+        if (worker->thread.joinable())
+            worker->thread.join();
+    }
+    workers.clear();
+
+    close(stop_fd);
+    stop_fd = -1;
+}
+
+auto Mock_server::get_address() const noexcept -> const char*
+{
+    return address.c_str();
+}
+
+auto Mock_server::get_bytes_sent() const noexcept -> std::uint64_t
+{
+    std::uint64_t bytes = 0;
+    for (const auto &worker: workers)
+        bytes += worker->bytes_sent.load(std::memory_order_relaxed);
+    return bytes;
+}
+auto Mock_server::get_bytes_received() const noexcept -> std::uint64_t
+{
+    std::uint64_t bytes = 0;
+    for (const auto &worker: workers)
+        bytes += worker->bytes_received.load(std::memory_order_relaxed);
+    return bytes;
+}
+
+Mock_server_process::~Mock_server_process()
+{
+    stop();
+}
+
+bool Mock_server_process::start(const Mock_server::Options &options) noexcept
+{
+    stop();
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1)
+        return false;
+
+    pid = fork();
+    if (pid == -1) {
+        int saved_errno = errno;
+        close(fds[0]);
+        close(fds[1]);
+        errno = saved_errno;
+        return false;
+    }
+
+    if (pid == 0) {
+        close(fds[0]);
+
+        Mock_server server{options};
+        if (!server.start()) {
+            std::perror("Failed to start mock server");
+            _exit(1);
+        }
+
+        const char *server_address = server.get_address();
+        if (write(fds[1], server_address, std::strlen(server_address) + 1) == -1)
+            _exit(1);
+
+        char c;
+        while (read(fds[1], &c, 1) > 0)
+            ;
+
+        server.stop();
+        _exit(0);
+    }
+
+    close(fds[1]);
+    fd = fds[0];
+
+    // The address is sent with its null terminator.
+    std::size_t len = 0;
+    while (len == 0 || address[len - 1] != '\0') {
+        auto ret = read(fd, address + len, sizeof(address) - len);
+        if (ret <= 0 || (len += ret) == sizeof(address)) {
+            stop();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void Mock_server_process::stop() noexcept
+{
+    if (pid == -1)
+        return;
+
+    close(fd);
+    fd = -1;
+
+    while (waitpid(pid, nullptr, 0) == -1 && errno == EINTR)
+        ;
+    pid = -1;
+}
+
+auto Mock_server_process::get_address() const noexcept -> const char*
+{
+    return address;
+}
+} /* namespace speedtest::bench */
@@ -0,0 +1,201 @@
+/**
+ * The classes in this headers utilizes STL but has -fno-exceptions
+ * enabled, thus if STL is out of memory, it will raise SIGABRT.
+ */
+
+#ifndef  __cpp_speedest_bench_Mock_server_HPP__
+# define __cpp_speedest_bench_Mock_server_HPP__
+
+# include "Shaped_link.hpp"
+
+# include <sys/types.h>
+
+# include <cstddef>
+# include <cstdint>
+# include <memory>
+# include <string>
+# include <vector>
+
+namespace speedtest::bench {
+/**
+ * Local stand-in of speedtest.net and its servers over HTTP/1.1, so that
+ * get_config, get_servers, get_best_server, download and upload can run
+ * without network access.
+ *
+ * Serves:
+ *  - /speedtest-config.php
+ *  - /speedtest-servers-static.php and /speedtest-servers.php, which list
+ *    Options::servers_cnt servers, all of them this server;
+ *  - GET .../randomNxN.jpg, with the sizes of the real images;
+ *  - POST .../upload.php, which discards the body;
+ *  - GET .../latency.txt
+ *
+ * Every other path gets 404.
+ * <br>Paths are matched regardless of the host, so that urls of speedtest.net
+ * work as is once Speedtest::set_connect_to points them here.
+ *
+ * Each thread accepts and serves its own connections with epoll, on a socket
+ * of its own bound with SO_REUSEPORT, and sends the bodies from a buffer
+ * generated once, so that a single client can hardly saturate it.
+ *
+ * If Options::link is shaped, every byte of requests and responses goes
+ * through a Shaped_link of each direction shared by all threads, and
+ * responses are held back until they arrive at the client.
+ *
+ * This class has no cp/mv ctor/assignment.
+ */
+class Mock_server {
+public:
+    struct Options {
+        /**
+         * 0 is treated as 1.
+         */
+        unsigned threads = 1;
+        /**
+         * Number of servers in the server list.
+         */
+        unsigned servers_cnt = 10;
+        /**
+         * Test length in seconds, put in the config.
+         */
+        unsigned test_length = 10;
+        /**
+         * Link between the clients and this server, unlimited by default.
+         */
+        Link_profile link;
+    };
+
+protected:
+    struct Worker;
+
+    Options options;
+
+    std::string address;
+
+    std::string config_xml;
+    std::string servers_xml;
+
+    /**
+     * Bodies of randomNxN.jpg are cut from this.
+     */
+    std::unique_ptr<char[]> payload;
+
+    /**
+     * nullptr if options.link is not shaped.
+     */
+    std::unique_ptr<Shaped_link> downlink;
+    std::unique_ptr<Shaped_link> uplink;
+
+    /**
+     * eventfd that wakes every worker up to stop.
+     */
+    int stop_fd = -1;
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    /**
+     * Must be called after address is set.
+     */
+    void build_xmls(const char *host) noexcept;
+
+public:
+    static constexpr const std::size_t payload_sz = 1024 * 1024;
+
+    /**
+     * Use default Options.
+     */
+    Mock_server() noexcept;
+    Mock_server(const Options &options) noexcept;
+
+    Mock_server(const Mock_server&) = delete;
+    Mock_server(Mock_server&&) = delete;
+
+    Mock_server& operator = (const Mock_server&) = delete;
+    Mock_server& operator = (Mock_server&&) = delete;
+
+    /**
+     * Call stop().
+     */
+    ~Mock_server();
+
+    /**
+     * @param host numeric address to listen on.
+     * @param port 0 to pick any free port.
+     * @return false on failure, errno is set.
+     */
+    bool start(const char *host = "127.0.0.1", unsigned short port = 0) noexcept;
+    /**
+     * Close every connection and stop listening.
+     */
+    void stop() noexcept;
+
+    /**
+     * @return host:port listened on, valid after start() succeeds.
+     *         <br>Can be passed to Speedtest::set_connect_to.
+     */
+    auto get_address() const noexcept -> const char*;
+
+    /**
+     * Bytes of response bodies sent since start().
+     */
+    auto get_bytes_sent() const noexcept -> std::uint64_t;
+    /**
+     * Bytes of request bodies received since start().
+     */
+    auto get_bytes_received() const noexcept -> std::uint64_t;
+
+    /**
+     * Size of randomNxN.jpg served for N.
+     */
+    static auto get_image_size(unsigned n) noexcept -> std::uint64_t;
+};
+
+/**
+ * Mock_server run in a forked child process, so that its cpu time is not
+ * counted as the client's and its threads do not compete with the client's
+ * for the same process.
+ *
+ * This class has no cp/mv ctor/assignment.
+ */
+class Mock_server_process {
+protected:
+    pid_t pid = -1;
+    /**
+     * The child runs until the other end of this is closed.
+     */
+    int fd = -1;
+
+    char address[64];
+
+public:
+    Mock_server_process() noexcept = default;
+
+    Mock_server_process(const Mock_server_process&) = delete;
+    Mock_server_process(Mock_server_process&&) = delete;
+
+    Mock_server_process& operator = (const Mock_server_process&) = delete;
+    Mock_server_process& operator = (Mock_server_process&&) = delete;
+
+    /**
+     * Call stop().
+     */
+    ~Mock_server_process();
+
+    /**
+     * Fork and start Mock_server on 127.0.0.1 and any free port in the child.
+     *
+     * @return false on failure, errno is set if the fork fails.
+     */
+    bool start(const Mock_server::Options &options) noexcept;
+    /**
+     * Stop the server and wait for the child to exit.
+     */
+    void stop() noexcept;
+
+    /**
+     * @return same as Mock_server::get_address, valid after start() succeeds.
+     */
+    auto get_address() const noexcept -> const char*;
+};
+} /* namespace speedtest::bench */
+
+#endif
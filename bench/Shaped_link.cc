@@ -0,0 +1,98 @@
+#include "Shaped_link.hpp"
+
+#include <time.h>
+
+#include <algorithm>
+
+namespace speedtest::bench {
+bool Link_profile::is_shaped() const noexcept
+{
+    return rate != 0 || rtt.count() != 0 || jitter.count() != 0 || loss != 0;
+}
+auto Link_profile::get_goodput() const noexcept -> double
+{
+    return rate * (1 - loss);
+}
+
+Shaped_link::Rng::Rng(std::uint64_t seed) noexcept:
+    state{seed}
+{}
+auto Shaped_link::Rng::next() noexcept -> std::uint64_t
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+auto Shaped_link::Rng::uniform() noexcept -> double
+{
+    // Top 53 bits fill the mantissa of a double exactly.
+    return (next() >> 11) * 0x1.0p-53;
+}
+
+Shaped_link::Shaped_link(const Link_profile &profile) noexcept:
+    profile{profile},
+    ns_per_byte{profile.rate == 0 ? 0 : 1e9 / profile.rate}
+{
+    static constexpr const std::size_t min_segment_sz = 1448;
+    static constexpr const std::size_t max_segment_sz = 64 * 1024;
+
+    segment_sz = profile.rate == 0 ?
+        max_segment_sz : std::clamp<std::size_t>(profile.rate / 1000, min_segment_sz, max_segment_sz);
+    burst_ns = segment_sz * ns_per_byte;
+}
+
+auto Shaped_link::now_ns() noexcept -> std::uint64_t
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return std::uint64_t(ts.tv_sec) * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
+
+auto Shaped_link::reserve(std::size_t len, std::uint64_t now_ns) noexcept -> std::uint64_t
+{
+    auto cost = static_cast<std::uint64_t>(len * ns_per_byte);
+
+    auto free = free_ns.load(std::memory_order_relaxed);
+    std::uint64_t departure;
+    do {
+        // Tokens accumulated while the link is idle are capped at burst_ns.
+        auto start = std::max(free, now_ns > burst_ns ? now_ns - burst_ns : 0);
+        departure = start + cost;
+    } while (!free_ns.compare_exchange_weak(free, departure, std::memory_order_relaxed));
+
+    return departure;
+}
+
+auto Shaped_link::get_delay(Rng &rng) const noexcept -> std::uint64_t
+{
+    auto rtt_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(profile.rtt).count();
+    auto jitter_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(profile.jitter).count();
+
+    return rtt_ns / 2 + static_cast<std::uint64_t>(rng.uniform() * jitter_ns);
+}
+
+auto Shaped_link::transmit(std::size_t len, std::uint64_t now_ns, Rng &rng) noexcept -> Transmission
+{
+    auto rtt_ns = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(profile.rtt).count());
+
+    auto departure = reserve(len, now_ns);
+    auto arrival = std::max(departure, now_ns) + get_delay(rng);
+
+    while (profile.loss != 0 && rng.uniform() < profile.loss) {
+        departure = reserve(len, now_ns);
+        arrival = std::max(arrival + rtt_ns, std::max(departure, now_ns) + get_delay(rng));
+    }
+
+    return {departure, arrival};
+}
+
+auto Shaped_link::get_segment_sz() const noexcept -> std::size_t
+{
+    return segment_sz;
+}
+auto Shaped_link::get_profile() const noexcept -> const Link_profile&
+{
+    return profile;
+}
+} /* namespace speedtest::bench */
@@ -0,0 +1,139 @@
+#ifndef  __cpp_speedest_bench_Shaped_link_HPP__
+# define __cpp_speedest_bench_Shaped_link_HPP__
+
+# include <cstddef>
+# include <cstdint>
+# include <atomic>
+# include <chrono>
+
+namespace speedtest::bench {
+/**
+ * Characteristics of an emulated link, the same in both directions.
+ */
+struct Link_profile {
+    /**
+     * Bytes per second, 0 for unlimited.
+     */
+    std::uint64_t rate = 0;
+    /**
+     * Round-trip time, split evenly between both directions.
+     */
+    std::chrono::microseconds rtt{0};
+    /**
+     * Each segment is delayed by up to this much more, uniformly distributed.
+     * <br>Segments of the same connection are never reordered.
+     */
+    std::chrono::microseconds jitter{0};
+    /**
+     * Probability in [0, 1) that a segment is lost.
+     * <br>A lost segment takes the link again and arrives one rtt late,
+     * as if it is retransmitted.
+     */
+    double loss = 0;
+
+    /**
+     * @return true if any of rate, rtt, jitter or loss is set.
+     */
+    bool is_shaped() const noexcept;
+
+    /**
+     * @return bytes per second that gets through the link, 0 for unlimited.
+     */
+    auto get_goodput() const noexcept -> double;
+};
+
+/**
+ * One direction of an emulated link: a token bucket that paces bytes onto
+ * the link at Link_profile::rate, followed by a delay queue of rtt / 2 plus
+ * jitter.
+ *
+ * Only the schedule is computed here, the caller holds the bytes back until
+ * they arrive.
+ * <br>Congestion control of the real TCP connection never sees the loss,
+ * since nothing is actually dropped.
+ *
+ * transmit() is thread-safe, so that one link can be shared by all threads
+ * of a server like a real bottleneck.
+ */
+class Shaped_link {
+public:
+    /**
+     * State of xorshift64 used to draw jitter and loss, one per thread.
+     */
+    struct Rng {
+        std::uint64_t state;
+
+        /**
+         * @param seed must not be 0.
+         */
+        Rng(std::uint64_t seed) noexcept;
+
+        auto next() noexcept -> std::uint64_t;
+        /**
+         * @return uniformly distributed in [0, 1).
+         */
+        auto uniform() noexcept -> double;
+    };
+
+    struct Transmission {
+        /**
+         * Time the last byte leaves the link.
+         */
+        std::uint64_t departure_ns;
+        /**
+         * Time the last byte arrives at the other end.
+         */
+        std::uint64_t arrival_ns;
+    };
+
+protected:
+    Link_profile profile;
+
+    double ns_per_byte;
+    /**
+     * Depth of the token bucket in ns, one segment.
+     */
+    std::uint64_t burst_ns;
+    std::size_t segment_sz;
+
+    /**
+     * Time the link becomes idle, the token bucket is full once it is
+     * burst_ns in the past.
+     */
+    alignas(64) std::atomic<std::uint64_t> free_ns{0};
+
+    /**
+     * @return time the last byte leaves the link.
+     */
+    auto reserve(std::size_t len, std::uint64_t now_ns) noexcept -> std::uint64_t;
+    auto get_delay(Rng &rng) const noexcept -> std::uint64_t;
+
+public:
+    Shaped_link(const Link_profile &profile) noexcept;
+
+    Shaped_link(const Shaped_link&) = delete;
+    Shaped_link& operator = (const Shaped_link&) = delete;
+
+    /**
+     * @return CLOCK_MONOTONIC in nanoseconds, the clock used by transmit().
+     */
+    static auto now_ns() noexcept -> std::uint64_t;
+
+    /**
+     * Send len bytes onto the link at now_ns.
+     *
+     * @param len should not exceed get_segment_sz().
+     */
+    auto transmit(std::size_t len, std::uint64_t now_ns, Rng &rng) noexcept -> Transmission;
+
+    /**
+     * Granularity bytes should be passed to transmit() in: about 1 ms worth
+     * of rate, in [1448, 64K].
+     */
+    auto get_segment_sz() const noexcept -> std::size_t;
+
+    auto get_profile() const noexcept -> const Link_profile&;
+};
+} /* namespace speedtest::bench */
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef  __cpp_speedest_bench_bench_HPP__
+# define __cpp_speedest_bench_bench_HPP__
+
+# include <cstdint>
+# include <cstdio>
+# include <algorithm>
+# include <chrono>
+
+# if defined(__x86_64__) || defined(__i386__)
+#  include <x86intrin.h>
+# endif
+
+namespace speedtest::bench {
+/**
+ * @return cpu cycles if rdtsc is available, nanoseconds otherwise.
+ */
+inline std::uint64_t get_cycles() noexcept
+{
+# if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+# else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+# endif
+}
+
+/**
+ * Calibrate get_cycles() against steady_clock for about 100 ms.
+ *
+ * @return cycles per nanosecond, 1 if rdtsc is not available.
+ */
+inline double get_cycles_per_ns() noexcept
+{
+    using clock = std::chrono::steady_clock;
+
+    auto start = clock::now();
+    auto start_cycles = get_cycles();
+
+    while (clock::now() - start < std::chrono::milliseconds{100})
+        ;
+
+    auto cycles = get_cycles() - start_cycles;
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+
+    return static_cast<double>(cycles) / ns;
+}
+
+/**
+ * Prevent compiler from optimizing away computation of p.
+ */
+inline void do_not_optimize(const void *p) noexcept
+{
+    asm volatile("" : : "g"(p) : "memory");
+}
+
+/**
+ * Run f() for iterations times in each of rounds rounds.
+ *
+ * @return cycles taken per iteration in the median round, so that a round 
+ *         disturbed by interrupts or frequency scaling does not move the result.
+ */
+template <class F>
+double measure_cycles(F &&f, std::size_t iterations, unsigned rounds = 5) noexcept
+{
+    static constexpr const unsigned max_rounds = 15;
+
+    rounds = std::clamp(rounds, 1U, max_rounds);
+    double per_round[max_rounds];
+
+    // warm up cache and branch predictors
+    f();
+
+    for (unsigned round = 0; round != rounds; ++round) {
+        auto start = get_cycles();
+        for (std::size_t i = 0; i != iterations; ++i)
+            f();
+        auto end = get_cycles();
+
+        per_round[round] = static_cast<double>(end - start) / iterations;
+    }
+
+    std::nth_element(per_round, per_round + rounds / 2, per_round + rounds);
+    return per_round[rounds / 2];
+}
+
+/**
+ * Which direction of a metric is an improvement.
+ */
+enum class Better {
+    lower,
+    higher,
+    /**
+     * Neither, the metric is informational and not compared with a baseline.
+     */
+    none,
+};
+
+/**
+ * Print a result as one line of "name value unit better [threshold]", where 
+ * better is "lower", "higher" or "none", so that the output of every benchmark
+ * can be collected and compared against a baseline by bench/compare.
+ *
+ * @param name must not contain whitespace.
+ * @param threshold change in percent beyond which the result is considered
+ *                  regressed, for results too noisy for the one given to 
+ *                  bench/compare, which uses the larger of the two.
+ *                  <br>0 to use the one given to bench/compare.
+ */
+inline void report(const char *name, double value, const char *unit, Better better = Better::lower,
+                   double threshold = 0) noexcept
+{
+    static constexpr const char *betters[] = {"lower", "higher", "none"};
+
+    std::printf("%s %.4f %s %s", name, value, unit, betters[static_cast<int>(better)]);
+    if (threshold != 0)
+        std::printf(" %g", threshold);
+    std::putchar('\n');
+}
+} /* namespace speedtest::bench */
+
+#endif
@@ -0,0 +1,353 @@
+#include "bench.hpp"
+#include "../speedtest/ServerListParser.hpp"
+#include "../speedtest/ServerTable.hpp"
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <charconv>
+#include <forward_list>
+#include <memory>
+#include <new>
+#include <set>
+#include <string>
+#include <string_view>
+
+using namespace speedtest;
+
+static std::size_t allocations = 0;
+
+void* operator new(std::size_t size)
+{
+    ++allocations;
+    if (auto *p = std::malloc(size ? size : 1))
+        return p;
+    std::abort();
+}
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    ++allocations;
+    return std::malloc(size ? size : 1);
+}
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    return operator new(size, std::nothrow);
+}
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+void operator delete[](void *p) noexcept
+{
+    std::free(p);
+}
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+void operator delete[](void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+/**
+ * Candidate_servers::Server before ServerTable is introduced:
+ * one node of std::forward_list per server, with url and every name
+ * allocated on its own.
+ */
+struct Legacy_server {
+    long server_id;
+    std::unique_ptr<char[]> url;
+    std::string server_name;
+    std::string sponsor_name;
+    float lat, lon;
+    std::string country_name;
+};
+
+struct Legacy_servers {
+    std::forward_list<Legacy_server> servers;
+    std::set<long> known_servers;
+};
+
+static long to_id(std::string_view str) noexcept
+{
+    long id = 0;
+    std::from_chars(str.data(), str.data() + str.size(), id);
+    return id;
+}
+static float to_float(std::string_view str) noexcept
+{
+    char buffer[32];
+    auto len = std::min(sizeof(buffer) - 1, str.size());
+    std::memcpy(buffer, str.data(), len);
+    buffer[len] = '\0';
+    return std::strtof(buffer, nullptr);
+}
+
+static bool add_legacy(const ServerListParser::Server &server, void *arg) noexcept
+{
+    auto &legacy = *static_cast<Legacy_servers*>(arg);
+
+    auto id = to_id(server.id);
+    if (!legacy.known_servers.emplace(id).second)
+        return true;
+
+    auto url = std::unique_ptr<char[]>{new (std::nothrow) char[1 + server.url.size() + 1]};
+    if (!url)
+        return false;
+    url[0] = 1;
+    std::memcpy(url.get() + 1, server.url.data(), server.url.size());
+    url[1 + server.url.size()] = '\0';
+
+    legacy.servers.push_front({id, std::move(url), std::string{server.name}, std::string{server.sponsor},
+                               to_float(server.lat), to_float(server.lon), std::string{server.country}});
+    return true;
+}
+
+struct Table_servers {
+    ServerTable servers;
+    std::string url_buffer;
+};
+
+static bool add_table(const ServerListParser::Server &server, void *arg) noexcept
+{
+    auto &table = *static_cast<Table_servers*>(arg);
+
+    auto id = to_id(server.id);
+    if (table.servers.find(id) != ServerTable::npos)
+        return true;
+
+    table.url_buffer.assign(1, '\1');
+    table.url_buffer.append(server.url);
+
+    table.servers.add(id, table.url_buffer, server.name, server.sponsor,
+                      to_float(server.lat), to_float(server.lon), server.country);
+    return true;
+}
+
+/**
+ * Mimic speedtest-servers-static.php: sponsors and countries repeat.
+ */
+static std::string gen_server_list(std::size_t n) noexcept
+{
+    std::string xml = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<settings>\n<servers>\n";
+    char line[512];
+
+    for (std::size_t i = 0; i != n; ++i) {
+        std::snprintf(line, sizeof(line),
+                      "<server url=\"http://speedtest%zu.example-isp%zu.net:8080/speedtest/upload.php\" "
+                      "lat=\"%.4f\" lon=\"%.4f\" name=\"City %zu\" country=\"Country %zu\" cc=\"C%zu\" "
+                      "sponsor=\"Example ISP %zu Ltd\" id=\"%zu\"  host=\"speedtest%zu.example-isp%zu.net:8080\" />\n",
+                      i, i % 3000, (i * 37 % 18000) / 100.0 - 90, (i * 71 % 36000) / 100.0 - 180,
+                      i, i % 200, i % 200, i % 3000, 10000 + i, i, i % 3000);
+        xml.append(line);
+    }
+
+    xml.append("</servers>\n</settings>\n");
+    return xml;
+}
+
+template <class Servers>
+static void parse(const std::string &xml, Servers &servers, ServerListParser::callback_t callback) noexcept
+{
+    ServerListParser parser{callback, &servers};
+
+    // Fed in chunks of the size libcurl usually hands to the write callback.
+    static constexpr const std::size_t chunk_sz = 16 * 1024;
+    for (std::size_t i = 0; i < xml.size(); i += chunk_sz)
+        parser.feed(xml.data() + i, std::min(chunk_sz, xml.size() - i));
+
+    if (!parser.is_complete()) {
+        std::fputs("candidate_servers: failed to parse generated server list\n", stderr);
+        std::exit(1);
+    }
+}
+
+static bool append_id(const ServerListParser::Server &server, void *arg) noexcept
+{
+    auto &ids = *static_cast<std::string*>(arg);
+    ids.append(server.id);
+    ids += ',';
+    return true;
+}
+
+/**
+ * Feed xml to the parser chunk_sz bytes at a time.
+ *
+ * @return ids of servers parsed, separated by ',', with "!" appended if 
+ *         the parse is not complete.
+ */
+static auto parse_ids(std::string_view xml, std::size_t chunk_sz) noexcept -> std::string
+{
+    std::string ids;
+    ServerListParser parser{append_id, &ids};
+
+    for (std::size_t i = 0; i < xml.size(); i += chunk_sz) {
+        if (!parser.feed(xml.data() + i, std::min(chunk_sz, xml.size() - i)))
+            break;
+    }
+
+    if (!parser.is_complete())
+        ids += '!';
+    return ids;
+}
+
+/**
+ * Check that a list with comments containing quotes, '>' and "--" parses
+ * the same whether it is fed in one chunk or split at any byte.
+ */
+static bool check_chunked_parse() noexcept
+{
+    static constexpr const std::string_view xml = 
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<!-- it's a \"list\" -->\n"
+        "<settings>\n<servers>\n"
+        "<server url=\"http://a.example.net/upload.php\" name=\"A > B\" id=\"1\" />\n"
+        "<!-- <server url=\"http://b.example.net/upload.php\" id=\"2\" /> -->\n"
+        "<!-- a -- b > c - -> d ' --><!----><!-- --- -->\n"
+        "<server url='http://c.example.net/upload.php' name='C \"3\"' id='3'/>\n"
+        "<!--\"-->"
+        "<server url=\"http://d.example.net/upload.php\" id=\"4\" />\n"
+        "</servers>\n</settings>\n";
+    static constexpr const std::string_view expected = "1,3,4,";
+
+    auto whole = parse_ids(xml, xml.size());
+    if (whole != expected) {
+        std::fprintf(stderr, "candidate_servers: expected servers %.*s, got %s\n",
+                     static_cast<int>(expected.size()), expected.data(), whole.c_str());
+        return false;
+    }
+
+    for (std::size_t chunk_sz = 1; chunk_sz != 8; ++chunk_sz) {
+        if (auto ids = parse_ids(xml, chunk_sz); ids != whole) {
+            std::fprintf(stderr, "candidate_servers: fed %zu bytes at a time, got servers %s instead of %s\n",
+                         chunk_sz, ids.c_str(), whole.c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Build servers in a child, so that peak RSS of each variant is measured on its own.
+ *
+ * @return growth of peak RSS in KiB.
+ */
+template <class Servers>
+static long measure_peak_rss(const std::string &xml, ServerListParser::callback_t callback) noexcept
+{
+    int fds[2];
+    if (pipe(fds) == -1)
+        return -1;
+
+    auto pid = fork();
+    if (pid == 0) {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        long before = usage.ru_maxrss;
+
+        {
+            Servers servers;
+            parse(xml, servers, callback);
+            bench::do_not_optimize(&servers);
+
+            getrusage(RUSAGE_SELF, &usage);
+        }
+
+        long growth = usage.ru_maxrss - before;
+        write(fds[1], &growth, sizeof(growth));
+        _exit(0);
+    }
+
+    close(fds[1]);
+
+    long growth = -1;
+    if (pid == -1 || read(fds[0], &growth, sizeof(growth)) != sizeof(growth))
+        growth = -1;
+    close(fds[0]);
+
+    if (pid != -1)
+        waitpid(pid, nullptr, 0);
+
+    return growth;
+}
+
+int main(int argc, char* argv[])
+{
+    // Roughly the number of servers in speedtest-servers-static.php
+    static constexpr const std::size_t n = 10000;
+    static constexpr const std::size_t iterations = 20;
+
+    if (!check_chunked_parse())
+        return 1;
+
+    auto xml = gen_server_list(n);
+
+    {
+        Legacy_servers legacy;
+        parse(xml, legacy, add_legacy);
+
+        Table_servers table;
+        parse(xml, table, add_table);
+
+        std::size_t legacy_cnt = 0;
+        for (const auto &server: legacy.servers)
+            legacy_cnt += server.url != nullptr;
+
+        if (legacy_cnt != n || table.servers.size() != n) {
+            std::fprintf(stderr, "candidate_servers: expected %zu servers, got %zu and %zu\n",
+                         n, legacy_cnt, table.servers.size());
+            return 1;
+        }
+    }
+
+    auto cycles = bench::measure_cycles([&]() noexcept
+    {
+        Legacy_servers legacy;
+        parse(xml, legacy, add_legacy);
+        bench::do_not_optimize(&legacy);
+    }, iterations);
+    bench::report("candidate_servers/forward_list/parse", cycles / n, "cycles/server");
+
+    cycles = bench::measure_cycles([&]() noexcept
+    {
+        Table_servers table;
+        parse(xml, table, add_table);
+        bench::do_not_optimize(&table);
+    }, iterations);
+    bench::report("candidate_servers/table/parse", cycles / n, "cycles/server");
+
+    auto before = allocations;
+    {
+        Legacy_servers legacy;
+        parse(xml, legacy, add_legacy);
+    }
+    bench::report("candidate_servers/forward_list/allocations", double(allocations - before) / n, "allocs/server");
+
+    before = allocations;
+    {
+        Table_servers table;
+        parse(xml, table, add_table);
+    }
+    bench::report("candidate_servers/table/allocations", double(allocations - before) / n, "allocs/server");
+
+    // Flush before fork, so that the children do not print it again.
+    std::fflush(stdout);
+
+    bench::report("candidate_servers/forward_list/peak_rss",
+                  measure_peak_rss<Legacy_servers>(xml, add_legacy), "KiB");
+    bench::report("candidate_servers/table/peak_rss",
+                  measure_peak_rss<Table_servers>(xml, add_table), "KiB");
+
+    return 0;
+}
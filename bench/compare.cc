@@ -0,0 +1,121 @@
+/**
+ * Compare results of benchmarks against a baseline, both in the format
+ * printed by bench::report.
+ */
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct Result {
+    std::string name;
+    double value;
+    std::string unit;
+    std::string better;
+    /**
+     * Threshold of the result itself as a fraction, 0 if not given.
+     */
+    double threshold;
+};
+
+/**
+ * Lines that are not results are skipped.
+ *
+ * @return false on I/O error, errno is set.
+ */
+static bool read_results(const char *path, std::vector<Result> &results) noexcept
+{
+    auto *file = std::fopen(path, "r");
+    if (!file)
+        return false;
+
+    char line[1024];
+    while (std::fgets(line, sizeof(line), file)) {
+        char name[256], unit[64], better[16];
+        double value, threshold = 0;
+
+        if (std::sscanf(line, "%255s %lf %63s %15s %lf", name, &value, unit, better, &threshold) >= 4)
+            results.push_back({name, value, unit, better, threshold / 100});
+    }
+
+    bool succeeded = !std::ferror(file);
+    std::fclose(file);
+
+    return succeeded;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 3 && argc != 4) {
+        std::fprintf(stderr, "Usage: %s BASELINE RESULTS [THRESHOLD]\n\n"
+                             "Print change of every result against BASELINE, and exit with 1 if any\n"
+                             "of them gets worse by more than THRESHOLD percent, default to 10,\n"
+                             "or by more than its own threshold if it reports a larger one.\n", argv[0]);
+        return 1;
+    }
+
+    double threshold = 0.1;
+    if (argc == 4) {
+        char *end;
+        threshold = std::strtod(argv[3], &end) / 100;
+        if (*argv[3] == '\0' || *end != '\0' || threshold < 0) {
+            std::fprintf(stderr, "compare: invalid threshold %s\n", argv[3]);
+            return 1;
+        }
+    }
+
+    std::vector<Result> baseline, results;
+    if (!read_results(argv[1], baseline)) {
+        std::fprintf(stderr, "compare: failed to read %s: %s\n", argv[1], std::strerror(errno));
+        return 1;
+    }
+    if (!read_results(argv[2], results)) {
+        std::fprintf(stderr, "compare: failed to read %s: %s\n", argv[2], std::strerror(errno));
+        return 1;
+    }
+
+    std::unordered_map<std::string, const Result*> baseline_map;
+    for (const auto &result: baseline)
+        baseline_map.emplace(result.name, &result);
+
+    std::size_t regressions = 0;
+
+    for (const auto &result: results) {
+        if (result.better == "none")
+            continue;
+
+        auto it = baseline_map.find(result.name);
+        if (it == baseline_map.end() || it->second->unit != result.unit) {
+            std::printf("%-48s %14s %14.4f %-14s new\n", result.name.c_str(), "-", result.value, result.unit.c_str());
+            continue;
+        }
+
+        auto base = it->second->value;
+        auto change = base == 0 ? 0 : (result.value - base) / std::fabs(base);
+        auto worse = result.better == "higher" ? -change : change;
+        auto result_threshold = std::max(threshold, result.threshold);
+
+        const char *verdict = "";
+        if (worse > result_threshold) {
+            verdict = "REGRESSED";
+            ++regressions;
+        } else if (-worse > result_threshold)
+            verdict = "improved";
+
+        std::printf("%-48s %14.4f %14.4f %-14s %+7.2f%% %s\n", result.name.c_str(), base, result.value,
+                    result.unit.c_str(), change * 100, verdict);
+    }
+
+    if (regressions != 0) {
+        std::fprintf(stderr, "compare: %zu results regressed beyond their thresholds\n", regressions);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include "bench.hpp"
+#include "../utils/geo_distance.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <random>
+
+using namespace speedtest;
+
+/**
+ * Haversine in double precision throughout.
+ *
+ * utils::geo_distance(float, float, float, float) subtracts the coordinates in
+ * single precision, which is off by a few hundred meters near antipodes,
+ * so it cannot be used as the reference.
+ */
+static double reference(double lat1, double lon1, double lat2, double lon2) noexcept
+{
+    static const auto pi = std::acos(-1.0);
+    static constexpr const auto radius = 6371.0; // km
+
+    auto phi1 = lat1 * pi / 180;
+    auto phi2 = lat2 * pi / 180;
+    auto dlat = phi2 - phi1;
+    auto dlon = (lon2 - lon1) * pi / 180;
+
+    auto a = std::pow(std::sin(dlat / 2), 2) + std::pow(std::sin(dlon / 2), 2) * std::cos(phi1) * std::cos(phi2);
+    return 2 * radius * std::atan2(std::sqrt(a), std::sqrt(1 - a));
+}
+
+int main(int argc, char* argv[])
+{
+    // Roughly the number of servers in speedtest-servers-static.php
+    static constexpr const std::size_t n = 10000;
+    static constexpr const std::size_t iterations = 100;
+    static constexpr const double tolerance = 0.01; // km
+
+    auto lats = std::unique_ptr<float[]>{new float[n]};
+    auto lons = std::unique_ptr<float[]>{new float[n]};
+    auto out = std::unique_ptr<float[]>{new float[n]};
+
+    std::mt19937 gen{0};
+    std::uniform_real_distribution<float> lat_dist{-90, 90};
+    std::uniform_real_distribution<float> lon_dist{-180, 180};
+
+    for (std::size_t i = 0; i != n; ++i) {
+        lats[i] = lat_dist(gen);
+        lons[i] = lon_dist(gen);
+    }
+
+    const float clients[][2] = {{22.3f, 114.2f}, {51.5f, -0.1f}, {-33.9f, 151.2f}, {64.1f, -21.9f}, {0, 180}};
+
+    for (const auto &client: clients) {
+        utils::geo_distance(client[0], client[1], lats.get(), lons.get(), n, out.get());
+
+        for (std::size_t i = 0; i != n; ++i) {
+            auto expected = reference(client[0], client[1], lats[i], lons[i]);
+            if (!(std::fabs(out[i] - expected) <= tolerance)) {
+                std::fprintf(stderr, "geo_distance: (%f, %f) to (%f, %f): expected %f km, got %f km\n",
+                             client[0], client[1], lats[i], lons[i], expected, out[i]);
+                return 1;
+            }
+        }
+    }
+
+    auto cycles = bench::measure_cycles([&]() noexcept
+    {
+        for (std::size_t i = 0; i != n; ++i)
+            out[i] = utils::geo_distance(clients[0][0], clients[0][1], lats[i], lons[i]);
+        bench::do_not_optimize(out.get());
+    }, iterations);
+    bench::report("geo_distance/scalar", cycles / n, "cycles/server");
+
+    cycles = bench::measure_cycles([&]() noexcept
+    {
+        utils::geo_distance(clients[0][0], clients[0][1], lats.get(), lons.get(), n, out.get());
+        bench::do_not_optimize(out.get());
+    }, iterations);
+    bench::report("geo_distance/batch", cycles / n, "cycles/server");
+
+    return 0;
+}
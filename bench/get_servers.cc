@@ -0,0 +1,68 @@
+#include "bench.hpp"
+#include "Mock_server.hpp"
+#include "../speedtest/speedtest.hpp"
+#include "../utils/ShutdownEvent.hpp"
+
+#include <cstdio>
+
+using namespace speedtest;
+
+int main(int argc, char* argv[])
+{
+    // Makes a list of about 220 KB, the size of speedtest-servers-static.php.
+    static constexpr const unsigned servers_cnt = 1200;
+    static constexpr const std::size_t iterations = 20;
+    static constexpr const unsigned rounds = 15;
+    // The list is fetched over loopback, which adds scheduling noise.
+    static constexpr const double threshold = 25;
+
+    static constexpr const char * const urls[] = {
+        "www.speedtest.net/speedtest-servers-static.php",
+        nullptr,
+    };
+
+    bench::Mock_server::Options options;
+    options.servers_cnt = servers_cnt;
+
+    // Served from this process, loopback adds little compared to parsing.
+    bench::Mock_server server{options};
+    if (!server.start()) {
+        std::perror("get_servers: Failed to start mock server");
+        return 1;
+    }
+
+    utils::FakeShutdownEvent shutdown_event;
+    Speedtest speedtest{shutdown_event, false};
+
+    if (!speedtest.check_libcurl_support(stderr))
+        return 1;
+    if (!speedtest.set_connect_to(server.get_address()))
+        return 1;
+
+    Speedtest::Config config{speedtest};
+
+    // Position of the client is needed to sort servers by distance.
+    config.get_config().get_return_value();
+
+    auto bytes_sent = server.get_bytes_sent();
+    auto candidates = config.get_servers(nullptr, nullptr, urls).get_return_value();
+    auto list_sz = server.get_bytes_sent() - bytes_sent;
+
+    if (candidates.servers.size() != servers_cnt) {
+        std::fprintf(stderr, "get_servers: expected %u servers, got %zu\n", servers_cnt, candidates.servers.size());
+        return 1;
+    }
+
+    auto cycles = bench::measure_cycles([&]() noexcept
+    {
+        auto candidates = config.get_servers(nullptr, nullptr, urls).get_return_value();
+        bench::do_not_optimize(&candidates);
+    }, iterations, rounds);
+
+    bench::report("get_servers/list_size", list_sz / 1024.0, "KiB", bench::Better::none);
+    bench::report("get_servers/static_list", cycles, "cycles/call", bench::Better::lower, threshold);
+    bench::report("get_servers/static_list_per_server", cycles / servers_cnt, "cycles/server", 
+                  bench::Better::lower, threshold);
+
+    return 0;
+}
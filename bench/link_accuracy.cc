@@ -0,0 +1,186 @@
+#include "bench.hpp"
+#include "Mock_server.hpp"
+#include "../speedtest/speedtest.hpp"
+#include "../utils/ShutdownEvent.hpp"
+
+#include <unistd.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+
+using namespace speedtest;
+
+struct Profile {
+    const char *name;
+    double mbps;
+    unsigned rtt_ms;
+    unsigned jitter_ms;
+    /**
+     * Probability that a segment is lost.
+     */
+    double loss;
+};
+
+/**
+ * From a slow mobile link to a fast datacenter one.
+ */
+static constexpr const Profile profiles[] = {
+    {"1mbit_300ms",          1,     300, 0,  0},
+    {"10mbit_100ms_jitter",  10,    100, 20, 0},
+    {"50mbit_40ms_loss",     50,    40,  5,  0.005},
+    {"100mbit_20ms",         100,   20,  0,  0},
+    {"1gbit_5ms_loss",       1000,  5,   1,  0.001},
+    {"10gbit_1ms",           10000, 1,   0,  0},
+};
+
+static void print_usage(const char *argv0) noexcept
+{
+    std::fprintf(stderr, "Usage: %s [-t TOLERANCE] [-l LENGTH] [-p PROFILE]\n\n"
+                         "  -t TOLERANCE  Maximum relative error in percent, default to 10\n"
+                         "  -l LENGTH     Length of download and upload in seconds, default to 10\n"
+                         "  -p PROFILE    Only run profiles whose name contains PROFILE\n\n"
+                         "Run download and upload against a local server behind emulated links,\n"
+                         "and check that the measured speeds and latency match the links.\n", argv0);
+}
+
+/**
+ * Report measured against expected and check the error.
+ *
+ * @return false if the relative error exceeds tolerance.
+ */
+static bool check(const std::string &prefix, const char *unit, double measured, double expected,
+                  double tolerance) noexcept
+{
+    auto error = (measured - expected) / expected;
+
+    bench::report((prefix + "/measured").c_str(), measured, unit, bench::Better::none);
+    bench::report((prefix + "/error").c_str(), error * 100, "%");
+
+    if (std::fabs(error) <= tolerance)
+        return true;
+
+    std::fprintf(stderr, "link_accuracy: %s is %.4f %s, expected %.4f %s\n",
+                 prefix.c_str(), measured, unit, expected, unit);
+    return false;
+}
+
+/**
+ * @return false if any check fails or the test cannot be run.
+ */
+static bool run_profile(const Profile &profile, unsigned length, double tolerance) noexcept
+{
+    bench::Mock_server::Options options;
+    options.threads = std::max(1u, std::thread::hardware_concurrency() / 2);
+    options.test_length = length;
+
+    auto &link = options.link;
+    link.rate = profile.mbps * 1000 * 1000 / 8;
+    link.rtt = std::chrono::milliseconds{profile.rtt_ms};
+    link.jitter = std::chrono::milliseconds{profile.jitter_ms};
+    link.loss = profile.loss;
+
+    bench::Mock_server_process server;
+    if (!server.start(options)) {
+        std::fprintf(stderr, "link_accuracy: mock server for %s did not start\n", profile.name);
+        return false;
+    }
+
+    utils::FakeShutdownEvent shutdown_event;
+    Speedtest speedtest{shutdown_event, false};
+
+    if (!speedtest.check_libcurl_support(stderr))
+        return false;
+    // Urls of speedtest.net are served by the mock server too.
+    if (!speedtest.set_connect_to(server.get_address()))
+        return false;
+
+    Speedtest::Config config{speedtest};
+
+    config.get_config().get_return_value();
+
+    auto candidates = config.get_servers().get_return_value();
+    auto [best_server_refs, latency] = config.get_best_server(candidates).get_return_value();
+    if (best_server_refs.empty()) {
+        std::fprintf(stderr, "link_accuracy: no server found behind %s\n", profile.name);
+        return false;
+    }
+    auto *url = candidates[best_server_refs.front()].url;
+
+    // Make every test bound by length instead of running out of sizes on fast links.
+    config.counts.download = 1 << 16;
+    config.counts.upload = 1 << 16;
+
+    auto download = speedtest.download(config, url).get_return_value();
+    auto upload = speedtest.upload(config, url).get_return_value();
+
+    std::string prefix{"accuracy/"};
+    prefix.append(profile.name);
+
+    auto goodput = link.get_goodput() * 8 / 1e6;
+
+    bool passed = check(prefix + "/download", "Mbit/s", download.speed * 8 / 1e6, goodput, tolerance);
+    passed &= check(prefix + "/upload", "Mbit/s", upload.speed * 8 / 1e6, goodput, tolerance);
+
+    /**
+     * Jitter delays each direction by half of it on average.
+     * <br>The request and the response each take up to a segment on the
+     * link, so allow time to transmit 2 of them, plus 1 ms for the client.
+     */
+    auto expected_latency = profile.rtt_ms + double(profile.jitter_ms);
+    auto slack = 2 * 1448 * 1e3 / link.rate + 1;
+    passed &= check(prefix + "/latency", "ms", latency.median / 1e3, expected_latency,
+                    tolerance + slack / expected_latency);
+
+    return passed;
+}
+
+int main(int argc, char* argv[])
+{
+    double tolerance = 0.1;
+    unsigned length = 10;
+    const char *filter = "";
+
+    for (int opt; (opt = getopt(argc, argv, "t:l:p:h")) != -1; ) {
+        char *end;
+
+        switch (opt) {
+        case 't':
+            tolerance = std::strtod(optarg, &end) / 100;
+            if (*optarg == '\0' || *end != '\0' || tolerance <= 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+
+        case 'l':
+            length = std::strtoul(optarg, &end, 10);
+            if (*optarg == '\0' || *end != '\0' || length == 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+
+        case 'p':
+            filter = optarg;
+            break;
+
+        default:
+            print_usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    bool passed = true;
+    for (const auto &profile: profiles) {
+        if (std::strstr(profile.name, filter) != nullptr)
+            passed &= run_profile(profile, length, tolerance);
+    }
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,266 @@
+#include "bench.hpp"
+#include "Mock_server.hpp"
+#include "../speedtest/speedtest.hpp"
+#include "../utils/ShutdownEvent.hpp"
+#include "../utils/get_cpu_ns.hpp"
+
+#include <sys/socket.h>
+#include <netdb.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace speedtest;
+
+/**
+ * Seconds each transfer test lasts.
+ */
+static constexpr const unsigned test_length = 3;
+
+static constexpr const std::size_t raw_buffer_sz = 256 * 1024;
+
+/**
+ * Request an image and receive the response, parsing nothing but Content-Length.
+ *
+ * @param buffer of raw_buffer_sz.
+ * @param bytes bytes of body received are added to it.
+ * @return false on error or if the connection is closed.
+ */
+static bool raw_download_once(int fd, char *buffer, std::uint64_t &bytes) noexcept
+{
+    static constexpr const std::string_view request =
+        "GET /speedtest/random4000x4000.jpg HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+    if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) != ssize_t(request.size()))
+        return false;
+
+    // Responses are never pipelined, so anything after the head is body.
+    std::size_t len = 0;
+    std::size_t head_end = std::string_view::npos;
+    while (head_end == std::string_view::npos) {
+        auto ret = recv(fd, buffer + len, raw_buffer_sz - len, 0);
+        if (ret <= 0)
+            return false;
+        len += ret;
+
+        head_end = std::string_view{buffer, len}.find("\r\n\r\n");
+    }
+
+    std::string_view head{buffer, head_end};
+    auto pos = head.find("Content-Length: ");
+    if (pos == std::string_view::npos)
+        return false;
+
+    std::uint64_t left = 0;
+    std::from_chars(head.data() + pos + 16, head.data() + head.size(), left);
+
+    auto received = len - (head_end + 4);
+    left -= received;
+    bytes += received;
+
+    while (left != 0) {
+        auto ret = recv(fd, buffer, std::min<std::uint64_t>(raw_buffer_sz, left), 0);
+        if (ret <= 0)
+            return false;
+        left -= ret;
+        bytes += ret;
+    }
+
+    return true;
+}
+
+/**
+ * @param address returned by Mock_server_process::get_address.
+ * @return nullptr on failure, otherwise must be freed by freeaddrinfo.
+ */
+static auto resolve(const char *address) noexcept -> struct addrinfo*
+{
+    std::string_view addr{address};
+    auto colon = addr.rfind(':');
+
+    std::string host{addr.substr(0, colon)};
+    std::string port{addr.substr(colon + 1)};
+    if (host.size() >= 2 && host.front() == '[')
+        host = host.substr(1, host.size() - 2);
+
+    struct addrinfo hints = {};
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+
+    struct addrinfo *addrs;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addrs) != 0)
+        return nullptr;
+
+    return addrs;
+}
+
+/**
+ * Send a small upload with its body in the same segment as the header,
+ * which is how libcurl sends bodies below its Expect: 100-continue threshold.
+ *
+ * @return true if the mock server replies 200.
+ */
+static bool check_small_upload(const char *address) noexcept
+{
+    static constexpr const std::string_view request =
+        "POST /speedtest/upload.php HTTP/1.1\r\nHost: localhost\r\nContent-Length: 10\r\n\r\n0123456789";
+    static constexpr const std::string_view expected = "HTTP/1.1 200 ";
+
+    auto *addrs = resolve(address);
+    if (!addrs)
+        return false;
+
+    int fd = socket(addrs->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    bool succeeded = false;
+
+    if (fd != -1 && connect(fd, addrs->ai_addr, addrs->ai_addrlen) == 0 &&
+        send(fd, request.data(), request.size(), MSG_NOSIGNAL) == ssize_t(request.size())) 
+    {
+        char buffer[64];
+        std::size_t len = 0;
+        for (ssize_t ret; len < expected.size() && (ret = recv(fd, buffer + len, sizeof(buffer) - len, 0)) > 0; )
+            len += ret;
+
+        succeeded = std::string_view{buffer, len}.substr(0, expected.size()) == expected;
+    }
+
+    if (fd != -1)
+        close(fd);
+    freeaddrinfo(addrs);
+
+    return succeeded;
+}
+
+/**
+ * Download over plain sockets, the most a client can get out of loopback 
+ * and the mock server.
+ *
+ * @return bytes of bodies received in total.
+ */
+static auto raw_download(const char *address, unsigned connections, std::chrono::seconds length) noexcept ->
+    std::uint64_t
+{
+    auto *addrs = resolve(address);
+    if (!addrs)
+        return 0;
+
+    std::atomic<std::uint64_t> total{0};
+    auto deadline = std::chrono::steady_clock::now() + length;
+
+    auto download = [&]() noexcept
+    {
+        int fd = socket(addrs->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd == -1)
+            return;
+
+        if (connect(fd, addrs->ai_addr, addrs->ai_addrlen) == 0) {
+            auto buffer = std::make_unique<char[]>(raw_buffer_sz);
+            std::uint64_t bytes = 0;
+
+            while (std::chrono::steady_clock::now() < deadline && raw_download_once(fd, buffer.get(), bytes))
+                ;
+
+            total.fetch_add(bytes, std::memory_order_relaxed);
+        }
+
+        close(fd);
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i != connections; ++i)
+        threads.emplace_back(download);
+    for (auto &thread: threads)
+        thread.join();
+
+    freeaddrinfo(addrs);
+
+    return total.load(std::memory_order_relaxed);
+}
+
+/**
+ * @param speed in bytes per second.
+ */
+static void report_transfer(const char *name, double speed, std::uint64_t bytes, std::uint64_t cpu_ns,
+                            double cycles_per_ns) noexcept
+{
+    std::string prefix{"loopback/"};
+    prefix.append(name);
+
+    // Throughput is bound by the mock server and loopback, so it is not compared with the baseline.
+    bench::report((prefix + "/throughput").c_str(), speed * 8 / 1e9, "Gbit/s", bench::Better::none);
+    // CPU of the client is measured over one run of a few seconds, so it is noisier than other results.
+    bench::report((prefix + "/client_cpu").c_str(), bytes == 0 ? 0 : cpu_ns * cycles_per_ns / (bytes / 1e9), 
+                  "cycles/GB", bench::Better::lower, 25);
+}
+
+int main(int argc, char* argv[])
+{
+    bench::Mock_server::Options options;
+    options.threads = std::max(1u, std::thread::hardware_concurrency() / 2);
+    options.test_length = test_length;
+
+    bench::Mock_server_process server;
+    if (!server.start(options)) {
+        std::fputs("loopback_throughput: mock server did not start\n", stderr);
+        return 1;
+    }
+    const char *address = server.get_address();
+
+    // Otherwise upload results would be measured against error responses.
+    if (!check_small_upload(address)) {
+        std::fputs("loopback_throughput: mock server rejected a small upload\n", stderr);
+        return 1;
+    }
+
+    auto cycles_per_ns = bench::get_cycles_per_ns();
+
+    utils::FakeShutdownEvent shutdown_event;
+    Speedtest speedtest{shutdown_event, false};
+
+    if (!speedtest.check_libcurl_support(stderr))
+        return 1;
+    // Urls of speedtest.net are served by the mock server too.
+    if (!speedtest.set_connect_to(address))
+        return 1;
+
+    Speedtest::Config config{speedtest};
+
+    config.get_config().get_return_value();
+
+    auto candidates = config.get_servers().get_return_value();
+    auto best_server_refs = config.get_best_server(candidates).get_return_value().first;
+    if (best_server_refs.empty()) {
+        std::fputs("loopback_throughput: no server found\n", stderr);
+        return 1;
+    }
+    auto *url = candidates[best_server_refs.front()].url;
+
+    // Sizes in the config run out in a fraction of a second on loopback,
+    // repeat them so that every test lasts test_length.
+    config.counts.download = 1 << 16;
+    config.counts.upload = 1 << 16;
+
+    auto cpu_start = utils::get_cpu_ns();
+    auto bytes = raw_download(address, config.threads.download, std::chrono::seconds{test_length});
+    report_transfer("raw_download", double(bytes) / test_length, bytes, utils::get_cpu_ns() - cpu_start,
+                    cycles_per_ns);
+
+    auto download = speedtest.download(config, url).get_return_value();
+    report_transfer("download", download.raw_speed, download.bytes, download.cpu_ns, cycles_per_ns);
+
+    auto upload = speedtest.upload(config, url).get_return_value();
+    report_transfer("upload", upload.raw_speed, upload.bytes, upload.cpu_ns, cycles_per_ns);
+
+    return 0;
+}
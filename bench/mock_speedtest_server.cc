@@ -0,0 +1,122 @@
+#include "Mock_server.hpp"
+
+#include <signal.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static void print_usage(const char *argv0) noexcept
+{
+    std::fprintf(stderr, "Usage: %s [-H HOST] [-p PORT] [-t THREADS] [-n SERVERS] [-l LENGTH]\n"
+                         "       [-b MBPS] [-r RTT] [-j JITTER] [-L LOSS]\n\n"
+                         "  -H HOST     Numeric address to listen on, default to 127.0.0.1\n"
+                         "  -p PORT     Port to listen on, default to any free port\n"
+                         "  -t THREADS  Number of threads serving connections, default to 1\n"
+                         "  -n SERVERS  Number of servers in the server list, default to 10\n"
+                         "  -l LENGTH   Test length in seconds put in the config, default to 10\n"
+                         "  -b MBPS     Bandwidth of the emulated link in Mbit/s, default to unlimited\n"
+                         "  -r RTT      Round-trip time of the emulated link in ms, default to 0\n"
+                         "  -j JITTER   Jitter of the emulated link in ms, default to 0\n"
+                         "  -L LOSS     Percentage of segments lost on the emulated link, default to 0\n\n"
+                         "Run cpp-speedtest against it with urls of speedtest.net connected to HOST:PORT,\n"
+                         "see Speedtest::set_connect_to.\n", argv0);
+}
+
+int main(int argc, char* argv[])
+{
+    using speedtest::bench::Mock_server;
+
+    Mock_server::Options options;
+    const char *host = "127.0.0.1";
+    unsigned long port = 0;
+
+    auto parse_uint = [](const char *arg, unsigned long &val) noexcept
+    {
+        char *end;
+        val = std::strtoul(arg, &end, 10);
+        return *arg != '\0' && *end == '\0';
+    };
+    auto parse_double = [](const char *arg, double &val) noexcept
+    {
+        char *end;
+        val = std::strtod(arg, &end);
+        return *arg != '\0' && *end == '\0' && val >= 0;
+    };
+
+    for (int opt; (opt = getopt(argc, argv, "H:p:t:n:l:b:r:j:L:h")) != -1; ) {
+        unsigned long val;
+        double real;
+
+        switch (opt) {
+        case 'H':
+            host = optarg;
+            break;
+
+        case 'p':
+            if (!parse_uint(optarg, port) || port > 65535) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+
+        case 't':
+        case 'n':
+        case 'l':
+            if (!parse_uint(optarg, val)) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            (opt == 't' ? options.threads : opt == 'n' ? options.servers_cnt : options.test_length) = val;
+            break;
+
+        case 'b':
+        case 'r':
+        case 'j':
+        case 'L':
+            if (!parse_double(optarg, real) || (opt == 'L' && real >= 100)) {
+                print_usage(argv[0]);
+                return 1;
+            }
+
+            if (opt == 'b')
+                options.link.rate = real * 1000 * 1000 / 8;
+            else if (opt == 'L')
+                options.link.loss = real / 100;
+            else
+                (opt == 'r' ? options.link.rtt : options.link.jitter) = std::chrono::microseconds{
+                    static_cast<std::chrono::microseconds::rep>(real * 1000)
+                };
+            break;
+
+        default:
+            print_usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    // Block them before threads are started so that only sigwait gets them.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    Mock_server server{options};
+    if (!server.start(host, port)) {
+        std::fprintf(stderr, "Failed to listen on %s:%lu: %s\n", host, port, std::strerror(errno));
+        return 1;
+    }
+
+    std::printf("Listening on %s\n", server.get_address());
+    std::fflush(stdout);
+
+    int signum;
+    sigwait(&signals, &signum);
+
+    server.stop();
+
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include "bench.hpp"
+#include "../speedtest/SpeedtestResult.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+using namespace speedtest;
+
+/**
+ * Build the csv record the way a result is usually serialized before
+ * SpeedtestResult::format_csv: a fresh std::string grown by concatenation.
+ */
+static std::string concat_csv(const SpeedtestResult &result) noexcept
+{
+    std::string csv;
+
+    csv += std::to_string(result.server_id) + ",";
+    csv += result.sponsor_name + ",";
+    csv += result.server_name + ",";
+    csv += std::to_string(result.timestamp_ms) + ",";
+    csv += std::to_string(result.distance) + ",";
+    csv += std::to_string(result.latency.median / 1000.0) + ",";
+    csv += std::to_string(result.download_speed * 8) + ",";
+    csv += std::to_string(result.upload_speed * 8) + ",";
+    csv += result.share_url + ",";
+    csv += std::string{result.client.ip} + "\n";
+
+    return csv;
+}
+
+int main(int argc, char* argv[])
+{
+    static constexpr const std::size_t iterations = 100000;
+    // A record takes a few hundred cycles, so take the median of more rounds.
+    static constexpr const unsigned rounds = 15;
+
+    SpeedtestResult result{};
+    result.timestamp_ms = 1593606896789;
+    result.server_id = 13538;
+    result.sponsor_name = "Hong Kong Broadband Network Ltd";
+    result.server_name = "Hong Kong";
+    result.distance = 3.1416;
+    result.latency.median = 2345;
+    result.download_speed = 117964800;
+    result.upload_speed = 58982400;
+    std::strcpy(result.client.ip, "203.0.113.42");
+    std::strcpy(result.client.isp, "Example ISP");
+    std::strcpy(result.client.geolocation.country, "Hong Kong");
+
+    char buffer[4096];
+
+    auto len = result.format_csv(buffer, sizeof(buffer));
+    if (len > sizeof(buffer) || result.to_csv_str() != std::string_view(buffer, len)) {
+        std::fputs("result_format: to_csv_str does not match format_csv\n", stderr);
+        return 1;
+    }
+
+    auto cycles = bench::measure_cycles([&]() noexcept
+    {
+        auto csv = concat_csv(result);
+        bench::do_not_optimize(csv.data());
+    }, iterations, rounds);
+    bench::report("result_format/csv/concat", cycles, "cycles/record");
+
+    cycles = bench::measure_cycles([&]() noexcept
+    {
+        auto csv = result.to_csv_str();
+        bench::do_not_optimize(csv.data());
+    }, iterations, rounds);
+    bench::report("result_format/csv/to_csv_str", cycles, "cycles/record");
+
+    cycles = bench::measure_cycles([&]() noexcept
+    {
+        result.format_csv(buffer, sizeof(buffer));
+        bench::do_not_optimize(buffer);
+    }, iterations, rounds);
+    bench::report("result_format/csv/buffer", cycles, "cycles/record");
+
+    cycles = bench::measure_cycles([&]() noexcept
+    {
+        result.format_json(buffer, sizeof(buffer));
+        bench::do_not_optimize(buffer);
+    }, iterations, rounds);
+    bench::report("result_format/json/buffer", cycles, "cycles/record");
+
+    cycles = bench::measure_cycles([&]() noexcept
+    {
+        result.format_binary(buffer, sizeof(buffer));
+        bench::do_not_optimize(buffer);
+    }, iterations, rounds);
+    bench::report("result_format/binary/buffer", cycles, "cycles/record");
+
+    return 0;
+}
@@ -0,0 +1,54 @@
+#include "bench.hpp"
+#include "../utils/split2int.hpp"
+
+#include <cstdio>
+#include <set>
+#include <string>
+
+using namespace speedtest;
+
+int main(int argc, char* argv[])
+{
+    // Far more than ignoreids of speedtest-config.php usually holds, so that
+    // the cost per id dominates.
+    static constexpr const std::size_t n = 10000;
+    static constexpr const std::size_t iterations = 20;
+
+    // Ids in ignoreids are ascending, with gaps.
+    std::string ignoreids;
+    for (std::size_t i = 0; i != n; ++i) {
+        if (i != 0)
+            ignoreids.append(1, ',');
+        ignoreids.append(std::to_string(1000 + i * 7));
+    }
+
+    {
+        std::set<long> ids;
+        if (*utils::split2long_set(ids, ignoreids.c_str()) != '\0' || ids.size() != n) {
+            std::fprintf(stderr, "split2long_set: expected %zu ids, got %zu\n", n, ids.size());
+            return 1;
+        }
+    }
+
+    auto cycles = bench::measure_cycles([&]() noexcept
+    {
+        std::size_t cnt = 0;
+        utils::split2long_set([](long, void *arg) noexcept
+        {
+            ++*static_cast<std::size_t*>(arg);
+        }, &cnt, ignoreids.c_str());
+        bench::do_not_optimize(&cnt);
+    }, iterations);
+    bench::report("split2long_set/parse", cycles / n, "cycles/id");
+
+    // What Config::get_config does with ignoreids.
+    cycles = bench::measure_cycles([&]() noexcept
+    {
+        std::set<long> ids;
+        utils::split2long_set(ids, ignoreids.c_str());
+        bench::do_not_optimize(&ids);
+    }, iterations);
+    bench::report("split2long_set/set", cycles / n, "cycles/id");
+
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include "bench.hpp"
+#include "../speedtest/Upload_payload.hpp"
+
+#include <string_view>
+#include <memory>
+
+using namespace speedtest;
+
+/**
+ * gen_upload_data before Upload_payload is introduced:
+ * one byte at a time, with a branch and a modulo per byte.
+ */
+static void per_byte(char *buffer, std::size_t offset, std::size_t bytes) noexcept
+{
+    static constexpr const std::string_view prefix{"content1="};
+    static constexpr const std::string_view chars = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+    for (std::size_t j = 0; j != bytes; ++j) {
+        auto i = offset + j;
+        if (i < prefix.size())
+            buffer[j] = prefix[i];
+        else
+            buffer[j] = chars[(i - prefix.size()) % chars.size()];
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    // Default size of upload buffer of libcurl
+    static constexpr const std::size_t buffer_sz = 64 * 1024;
+    // The largest upload size in Speedtest::Config::Sizes::up_sizes
+    static constexpr const std::size_t body_sz = 7340032;
+    static constexpr const std::size_t iterations = 20;
+
+    auto buffer = std::unique_ptr<char[]>{new char[buffer_sz]};
+
+    auto run = [&](auto &&read) noexcept
+    {
+        return [&, read]() noexcept
+        {
+            for (std::size_t offset = 0; offset < body_sz; offset += buffer_sz) {
+                read(buffer.get(), offset, buffer_sz);
+                bench::do_not_optimize(buffer.get());
+            }
+        };
+    };
+
+    auto cycles = bench::measure_cycles(run(per_byte), iterations);
+    bench::report("upload_payload/per_byte", body_sz / cycles, "bytes/cycle", bench::Better::higher);
+
+    for (auto kind: {Upload_payload::Kind::alphabet, Upload_payload::Kind::random}) {
+        Upload_payload payload;
+        if (!payload.init(kind))
+            return 1;
+
+        cycles = bench::measure_cycles(run([&](char *buffer, std::size_t offset, std::size_t len) noexcept
+        {
+            payload.read(buffer, offset, len);
+        }), iterations);
+
+        bench::report(kind == Upload_payload::Kind::alphabet ? "upload_payload/alphabet" : "upload_payload/random",
+                      body_sz / cycles, "bytes/cycle", bench::Better::higher);
+    }
+
+    return 0;
+}
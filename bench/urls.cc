@@ -0,0 +1,105 @@
+#include "bench.hpp"
+#include "../speedtest/speedtest.hpp"
+#include "../utils/ShutdownEvent.hpp"
+
+#include <cstdio>
+#include <iterator>
+#include <string>
+#include <string_view>
+
+using namespace speedtest;
+
+using Server = Speedtest::Config::Candidate_servers::Server;
+
+/**
+ * Expose the members used to build urls.
+ */
+struct Url_speedtest: Speedtest {
+    using Speedtest::Speedtest;
+
+    using Speedtest::create_easy;
+    using Speedtest::release_easy;
+    using Speedtest::set_url;
+    using Speedtest::reserve_built_url;
+};
+
+/**
+ * Server::append_image_name before it is introduced:
+ * the name is formatted by snprintf into a temporary buffer.
+ */
+static void append_image_name_snprintf(unsigned size, std::string &url) noexcept
+{
+    char buffer[10 + 1 + 10 + 4 + 1];
+    std::snprintf(buffer, sizeof(buffer), "%ux%u.jpg", size, size);
+    url.append(buffer);
+}
+
+int main(int argc, char* argv[])
+{
+    static constexpr const std::size_t iterations = 100000;
+
+    // What download builds for a server before appending the name of each image.
+    static constexpr const std::string_view prefix = "http://speedtest.example-isp.net:8080/speedtest/random";
+    // Sizes in Speedtest::Config::Sizes::download
+    static constexpr const unsigned sizes[] = {350, 500, 750, 1000, 1500, 2000, 2500, 3000, 3500, 4000};
+
+    std::string url, expected;
+    url.reserve(prefix.size() + Server::image_name_sz);
+    expected.reserve(prefix.size() + Server::image_name_sz);
+
+    for (auto size: sizes) {
+        url.assign(prefix);
+        Server::append_image_name(size, url);
+
+        expected.assign(prefix);
+        append_image_name_snprintf(size, expected);
+
+        if (url != expected) {
+            std::fprintf(stderr, "urls: expected %s, got %s\n", expected.c_str(), url.c_str());
+            return 1;
+        }
+    }
+
+    std::size_t i = 0;
+    auto cycles = bench::measure_cycles([&]() noexcept
+    {
+        url.assign(prefix);
+        append_image_name_snprintf(sizes[i++ % std::size(sizes)], url);
+        bench::do_not_optimize(url.data());
+    }, iterations);
+    bench::report("urls/download/snprintf", cycles, "cycles/url");
+
+    cycles = bench::measure_cycles([&]() noexcept
+    {
+        url.assign(prefix);
+        Server::append_image_name(sizes[i++ % std::size(sizes)], url);
+        bench::do_not_optimize(url.data());
+    }, iterations);
+    bench::report("urls/download/to_chars", cycles, "cycles/url");
+
+    utils::FakeShutdownEvent shutdown_event;
+    Url_speedtest speedtest{shutdown_event, false};
+
+    auto easy = speedtest.create_easy();
+    if (!easy) {
+        std::fputs("urls: failed to create easy handle\n", stderr);
+        return 1;
+    }
+    auto easy_ref = curl::Easy_ref_t{easy.get()};
+
+    // What get_servers passes for each server list.
+    static constexpr const std::string_view list_url = "www.speedtest.net/speedtest-servers-static.php";
+    static constexpr const std::string_view query = "?threads=8";
+
+    speedtest.reserve_built_url(list_url.size() + query.size());
+
+    cycles = bench::measure_cycles([&]() noexcept
+    {
+        speedtest.set_url(easy_ref, {list_url, query}).get_return_value();
+    }, iterations);
+    bench::report("urls/set_url", cycles, "cycles/url");
+
+    speedtest.release_easy(std::move(easy));
+
+    return 0;
+}
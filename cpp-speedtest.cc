@@ -3,12 +3,167 @@
 
 #include "speedtest/speedtest.hpp"
 #include "speedtest/SpeedtestResult.hpp"
+#include "speedtest/Result_sink.hpp"
+#include "speedtest/Session.hpp"
+#include "speedtest/Metrics.hpp"
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <optional>
+#include <string>
+
+#include <unistd.h>
+
+static void print_usage(const char *argv0) noexcept
+{
+    std::fprintf(stderr, "Usage: %s [-a] [-s K] [-m MODE] [-c DIR] [-t TTL] [-d INTERVAL [-j JITTER]] [-o FILE [-f FORMAT]]\n"
+                         "       [-l [HOST:]PORT] [-P FILE]\n\n"
+                         "  -a           Merge server lists from all sites instead of using the first one retrieved\n"
+                         "  -s K         Test against the K servers with lowest latency at once\n"
+                         "  -m MODE      Transfer mode, one of http1 (default), http2 and h2c\n"
+                         "  -c DIR       Cache configurations and server lists in DIR\n"
+                         "  -t TTL       Seconds before configurations and server lists are refreshed, default to 3600\n"
+                         "  -d INTERVAL  Keep running and test every INTERVAL seconds, until SIGINT or SIGTERM\n"
+                         "  -j JITTER    Delay each test by up to JITTER seconds at random, default to 0\n"
+                         "  -o FILE      Append results to FILE instead of printing them\n"
+                         "  -f FORMAT    Format of FILE, one of csv (default), json and binary\n"
+                         "  -l [HOST:]PORT  Serve metrics of results at /metrics for Prometheus, requires -d\n"
+                         "  -P FILE      Write metrics of results to FILE for the textfile collector of node_exporter\n", argv0);
+}
 
 int main(int argc, char* argv[])
 {
+    using Transfer_mode = speedtest::Speedtest::Transfer_mode;
+
+    auto transfer_mode = Transfer_mode::http1;
+
+    speedtest::Session::Options options;
+
+    const char *output_path = nullptr;
+    auto output_format = speedtest::File_sink::Format::csv;
+
+    std::string metrics_host;
+    const char *metrics_port = nullptr;
+    const char *metrics_textfile = nullptr;
+
+    bool is_daemon = false;
+    speedtest::Session::Schedule schedule{};
+
+    // Parse a non-negative number of seconds.
+    auto parse_seconds = [](const char *arg, std::chrono::seconds &seconds) noexcept
+    {
+        char *end;
+        auto val = std::strtoul(arg, &end, 10);
+        if (*end != '\0' || *arg == '\0')
+            return false;
+        seconds = std::chrono::seconds{val};
+        return true;
+    };
+
+    for (int opt; (opt = getopt(argc, argv, "as:m:c:t:d:j:o:f:l:P:h")) != -1; ) {
+        switch (opt) {
+        case 'a':
+            options.server_list_mode = speedtest::Speedtest::Config::Server_list_mode::merge_all;
+            break;
+
+        case 's': {
+            char *end;
+            auto val = std::strtoul(optarg, &end, 10);
+            if (*end != '\0' || val == 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            options.servers_cnt = val;
+            break;
+        }
+
+        case 'c':
+            options.cache_dir = optarg;
+            break;
+
+        case 't':
+            if (!parse_seconds(optarg, options.ttl)) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+
+        case 'd':
+            if (!parse_seconds(optarg, schedule.interval) || schedule.interval.count() == 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            is_daemon = true;
+            break;
+
+        case 'j':
+            if (!parse_seconds(optarg, schedule.jitter)) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+
+        case 'o':
+            output_path = optarg;
+            break;
+
+        case 'f':
+            if (std::strcmp(optarg, "csv") == 0)
+                output_format = speedtest::File_sink::Format::csv;
+            else if (std::strcmp(optarg, "json") == 0)
+                output_format = speedtest::File_sink::Format::json_lines;
+            else if (std::strcmp(optarg, "binary") == 0)
+                output_format = speedtest::File_sink::Format::binary;
+            else {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+
+        case 'l': {
+            const char *colon = std::strrchr(optarg, ':');
+            if (colon) {
+                metrics_host.assign(optarg, colon - optarg);
+                // Strip brackets around IPv6 address.
+                if (metrics_host.size() >= 2 && metrics_host.front() == '[' && metrics_host.back() == ']')
+                    metrics_host = metrics_host.substr(1, metrics_host.size() - 2);
+                metrics_port = colon + 1;
+            } else
+                metrics_port = optarg;
+            break;
+        }
+
+        case 'P':
+            metrics_textfile = optarg;
+            break;
+
+        case 'm':
+            if (std::strcmp(optarg, "http1") == 0)
+                transfer_mode = Transfer_mode::http1;
+            else if (std::strcmp(optarg, "http2") == 0)
+                transfer_mode = Transfer_mode::http2;
+            else if (std::strcmp(optarg, "h2c") == 0)
+                transfer_mode = Transfer_mode::http2_prior_knowledge;
+            else {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+
+        default:
+            print_usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (metrics_port && !is_daemon) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
     // Print exception thrown by STD c++ lib,
     // as the default msg when -fno-exceptions is
     // enabled is useless.
@@ -18,49 +173,80 @@ int main(int argc, char* argv[])
         std::exit(1);
     });
 
-    speedtest::SpeedtestResult result;
-    std::unique_ptr<char[]> url;
+    // In daemon mode, SIGINT and SIGTERM stop the test in progress and then the daemon.
+    speedtest::utils::FakeShutdownEvent fake_shutdown_event;
+    std::optional<speedtest::utils::CtrlCShutdownEvent> ctrlc_shutdown_event;
+    if (is_daemon)
+        ctrlc_shutdown_event.emplace();
 
-    {
-        speedtest::utils::FakeShutdownEvent shutdown_event;
-        speedtest::Speedtest speedtest{shutdown_event, true};
+    const speedtest::utils::ShutdownEvent &shutdown_event = ctrlc_shutdown_event ? 
+        static_cast<const speedtest::utils::ShutdownEvent&>(*ctrlc_shutdown_event) : fake_shutdown_event;
 
-        if (!speedtest.check_libcurl_support(stderr))
-            return 1;
+    speedtest::Speedtest speedtest{shutdown_event, true};
 
-        speedtest::Speedtest::Config config{speedtest};
-        
-        std::puts("Retrieving configurations...");
-        config.get_config();
-        result.client = config.client;
+    if (!speedtest.check_libcurl_support(stderr))
+        return 1;
 
-        {
-            std::puts("Retrieving candidate servers...");
-            auto candidates = config.get_servers().get_return_value();
-            result.distance = candidates.shortest_distance;
+    if (!speedtest.set_transfer_mode(transfer_mode)) {
+        std::fputs("libcurl does not support HTTP/2 multiplexing\n", stderr);
+        return 1;
+    }
+
+    speedtest::Session session{speedtest, options};
+
+    speedtest::Print_sink print_sink{stdout};
+    speedtest::File_sink file_sink{output_format};
+
+    if (output_path && !file_sink.open(output_path)) {
+        std::fprintf(stderr, "Failed to open %s: %s\n", output_path, std::strerror(errno));
+        return 1;
+    }
 
-            auto server_it = [&]() noexcept
-            {
-                std::puts("Testing for best server...");
-                auto [best_server_ids, minimal_ping] = config.get_best_server(candidates).get_return_value();
+    speedtest::Result_sink &output_sink = output_path ? 
+        static_cast<speedtest::Result_sink&>(file_sink) : print_sink;
 
-                result.ping = minimal_ping;
+    std::optional<speedtest::Metrics_sink> metrics_sink;
+    std::optional<speedtest::Tee_sink> tee_sink;
+    std::optional<speedtest::Metrics_exporter> metrics_exporter;
 
-                return best_server_ids.front();
-            }();
+    if (metrics_port || metrics_textfile) {
+        metrics_sink.emplace(metrics_textfile);
+        tee_sink.emplace(output_sink, *metrics_sink);
+    }
 
-            url = std::move(server_it->url);
+    if (metrics_port) {
+        metrics_exporter.emplace(*metrics_sink);
 
-            result.server_id = server_it->server_id;
-            result.server_name = std::move(server_it->server_name);
-            result.sponsor_name = std::move(server_it->sponsor_name);
+        const char *host = metrics_host.empty() ? nullptr : metrics_host.c_str();
+        if (!metrics_exporter->start(host, metrics_port)) {
+            std::fprintf(stderr, "Failed to listen on %s:%s: %s\n", host ? host : "*", metrics_port,
+                         std::strerror(errno));
+            return 1;
         }
+    }
 
-        result.download_speed = speedtest.download(config, url.get()).get_return_value();
-        result.upload_speed = speedtest.upload(config, url.get()).get_return_value();
+    speedtest::Result_sink &sink = tee_sink ? 
+        static_cast<speedtest::Result_sink&>(*tee_sink) : output_sink;
+
+    if (is_daemon) {
+        session.run(schedule, sink, shutdown_event).get_return_value();
+        return 0;
     }
 
-    std::printf("Download speed = %zu\nUpload speed = %zu\n", result.download_speed, result.upload_speed);
+    // Why it failed is already printed.
+    if (!session.refresh().get_return_value())
+        return 1;
+
+    speedtest::SpeedtestResult result;
+    if (!session.run_once(result).get_return_value()) {
+        std::fputs("No candidate server available\n", stderr);
+        return 1;
+    }
+
+    if (!sink.write(result) || !sink.flush()) {
+        std::fprintf(stderr, "Failed to write result: %s\n", std::strerror(errno));
+        return 1;
+    }
 
     return 0;
 }
@@ -0,0 +1,222 @@
+#include "GeoIndex.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+namespace speedtest {
+static const auto pi = std::acos(-1.0);
+
+static void to_unit_vector(float lat, float lon, float (&point)[3]) noexcept
+{
+    auto phi = lat * pi / 180;
+    auto lambda = lon * pi / 180;
+
+    point[0] = std::cos(phi) * std::cos(lambda);
+    point[1] = std::cos(phi) * std::sin(lambda);
+    point[2] = std::sin(phi);
+}
+
+/**
+ * Convert squared chord length between unit vectors to great-circle distance.
+ */
+static double to_distance(double chord2) noexcept
+{
+    auto half_chord = std::min(std::sqrt(chord2) / 2, 1.0);
+    return 2 * GeoIndex::earth_radius * std::asin(half_chord);
+}
+
+/**
+ * Convert great-circle distance to squared chord length between unit vectors.
+ */
+static double to_chord2(double distance) noexcept
+{
+    auto angle = std::min(distance / GeoIndex::earth_radius, pi);
+    auto chord = 2 * std::sin(angle / 2);
+    return chord * chord;
+}
+
+void GeoIndex::build(const float *lat, const float *lon, std::size_t n) noexcept
+{
+    nodes.clear();
+    nodes.reserve(n);
+
+    for (std::size_t i = 0; i != n; ++i) {
+        float point[3];
+        to_unit_vector(lat[i], lon[i], point);
+        nodes.push_back({point[0], point[1], point[2], 0, static_cast<std::uint32_t>(i)});
+    }
+
+    build(0, n);
+}
+
+void GeoIndex::build(std::size_t begin, std::size_t end) noexcept
+{
+    if (end - begin <= 1)
+        return;
+
+    // Split on the axis with largest spread.
+    float min[3] = {2, 2, 2};
+    float max[3] = {-2, -2, -2};
+    for (auto i = begin; i != end; ++i) {
+        const float coords[3] = {nodes[i].x, nodes[i].y, nodes[i].z};
+        for (int axis = 0; axis != 3; ++axis) {
+            min[axis] = std::min(min[axis], coords[axis]);
+            max[axis] = std::max(max[axis], coords[axis]);
+        }
+    }
+
+    std::uint8_t axis = 0;
+    for (std::uint8_t i = 1; i != 3; ++i) {
+        if (max[i] - min[i] > max[axis] - min[axis])
+            axis = i;
+    }
+
+    auto get = [axis](const Node &node) noexcept
+    {
+        return axis == 0 ? node.x : (axis == 1 ? node.y : node.z);
+    };
+
+    auto mid = begin + (end - begin) / 2;
+    std::nth_element(nodes.begin() + begin, nodes.begin() + mid, nodes.begin() + end,
+                     [&](const Node &x, const Node &y) noexcept
+    {
+        return get(x) < get(y);
+    });
+    nodes[mid].axis = axis;
+
+    build(begin, mid);
+    build(mid + 1, end);
+}
+
+auto GeoIndex::size() const noexcept -> std::size_t
+{
+    return nodes.size();
+}
+
+/**
+ * @param visitor must have member bound, the squared chord length beyond
+ *                which points are not interested, and visit(node, chord2).
+ */
+template <class Visitor>
+void GeoIndex::search(std::size_t begin, std::size_t end, const float (&point)[3], Visitor &visitor)
+    const noexcept
+{
+    if (begin == end)
+        return;
+
+    auto mid = begin + (end - begin) / 2;
+    const auto &node = nodes[mid];
+
+    const float coords[3] = {node.x, node.y, node.z};
+
+    double chord2 = 0;
+    for (int axis = 0; axis != 3; ++axis) {
+        double d = coords[axis] - point[axis];
+        chord2 += d * d;
+    }
+
+    if (end - begin == 1) {
+        if (chord2 <= visitor.bound)
+            visitor.visit(node, chord2);
+        return;
+    }
+
+    double diff = point[node.axis] - coords[node.axis];
+
+    // Search the side containing point first, so that bound shrinks early.
+    auto near_begin = diff < 0 ? begin : mid + 1;
+    auto near_end = diff < 0 ? mid : end;
+    auto far_begin = diff < 0 ? mid + 1 : begin;
+    auto far_end = diff < 0 ? end : mid;
+
+    search(near_begin, near_end, point, visitor);
+
+    if (chord2 <= visitor.bound)
+        visitor.visit(node, chord2);
+
+    if (diff * diff <= visitor.bound)
+        search(far_begin, far_end, point, visitor);
+}
+
+void GeoIndex::k_nearest(float lat, float lon, std::size_t k, std::vector<Result> &out) const noexcept
+{
+    out.clear();
+    if (k == 0 || nodes.empty())
+        return;
+
+    float point[3];
+    to_unit_vector(lat, lon, point);
+
+    struct Candidate {
+        double chord2;
+        std::uint32_t index;
+
+        bool operator < (const Candidate &other) const noexcept
+        {
+            return chord2 < other.chord2;
+        }
+    };
+
+    /**
+     * Max heap of the k nearest points found so far.
+     */
+    struct Visitor {
+        std::size_t k;
+        std::vector<Candidate> heap;
+        double bound = 5; // larger than the max squared chord length 4
+
+        void visit(const Node &node, double chord2) noexcept
+        {
+            heap.push_back({chord2, node.index});
+            std::push_heap(heap.begin(), heap.end());
+
+            if (heap.size() > k) {
+                std::pop_heap(heap.begin(), heap.end());
+                heap.pop_back();
+            }
+            if (heap.size() == k)
+                bound = heap.front().chord2;
+        }
+    } visitor{k, {}};
+
+    visitor.heap.reserve(k + 1);
+
+    search(0, nodes.size(), point, visitor);
+
+    std::sort_heap(visitor.heap.begin(), visitor.heap.end());
+
+    out.reserve(visitor.heap.size());
+    for (const auto &candidate: visitor.heap)
+        out.push_back({candidate.index, to_distance(candidate.chord2)});
+}
+
+void GeoIndex::within(float lat, float lon, double radius, std::vector<Result> &out) const noexcept
+{
+    out.clear();
+    if (nodes.empty() || radius < 0)
+        return;
+
+    float point[3];
+    to_unit_vector(lat, lon, point);
+
+    struct Visitor {
+        std::vector<Result> &out;
+        double bound;
+
+        void visit(const Node &node, double chord2) noexcept
+        {
+            // Store chord2 for now, to avoid asin on points that are sorted out.
+            out.push_back({node.index, chord2});
+        }
+    } visitor{out, to_chord2(radius)};
+
+    search(0, nodes.size(), point, visitor);
+
+    std::sort(out.begin(), out.end(), [](const Result &x, const Result &y) noexcept
+    {
+        return x.distance < y.distance;
+    });
+    for (auto &result: out)
+        result.distance = to_distance(result.distance);
+}
+} /* namespace speedtest */
@@ -0,0 +1,88 @@
+/**
+ * The classes in this headers utilizes STL but has -fno-exceptions
+ * enabled, thus if STL is out of memory, it will raise SIGABRT.
+ */
+
+#ifndef  __cpp_speedest_speedtest_GeoIndex_HPP__
+# define __cpp_speedest_speedtest_GeoIndex_HPP__
+
+# include <cstddef>
+# include <cstdint>
+# include <vector>
+
+namespace speedtest {
+/**
+ * Spatial index of points on earth, answering k-nearest and radius queries
+ * in O(log n) on average instead of scanning every point.
+ *
+ * Points are converted to unit vectors and stored in a 3-d k-d tree,
+ * since chord length between unit vectors is monotonic to great-circle
+ * distance and does not wrap around at the antimeridian.
+ *
+ * @warning all functions is this class is not thread-safe.
+ */
+class GeoIndex {
+public:
+    static constexpr const double earth_radius = 6371.0; // km, same as utils::geo_distance
+
+    struct Result {
+        /**
+         * Index of the point passed to build().
+         */
+        std::size_t index;
+        /**
+         * Great-circle distance in km.
+         */
+        double distance;
+    };
+
+protected:
+    struct Node {
+        float x;
+        float y;
+        float z;
+        /**
+         * Split axis of the subtree rooted at this node.
+         */
+        std::uint8_t axis;
+        std::uint32_t index;
+    };
+
+    /**
+     * Implicit balanced tree: the root of nodes[begin, end) is nodes[(begin + end) / 2],
+     * the left subtree is nodes[begin, mid) and the right subtree is nodes[mid + 1, end).
+     */
+    std::vector<Node> nodes;
+
+    void build(std::size_t begin, std::size_t end) noexcept;
+
+    template <class Visitor>
+    void search(std::size_t begin, std::size_t end, const float (&point)[3], Visitor &visitor) const noexcept;
+
+public:
+    /**
+     * Discard the old index and build a new one.
+     *
+     * @param lat in degrees
+     * @param lon in degrees
+     * @param n number of points, must be less than 2^32.
+     */
+    void build(const float *lat, const float *lon, std::size_t n) noexcept;
+
+    auto size() const noexcept -> std::size_t;
+
+    /**
+     * @param out is cleared, then filled with at most k nearest points
+     *            sorted by distance.
+     */
+    void k_nearest(float lat, float lon, std::size_t k, std::vector<Result> &out) const noexcept;
+
+    /**
+     * @param out is cleared, then filled with every point within radius km
+     *            sorted by distance.
+     */
+    void within(float lat, float lon, double radius, std::vector<Result> &out) const noexcept;
+};
+} /* namespace speedtest */
+
+#endif
@@ -0,0 +1,79 @@
+#include "LatencySampler.hpp"
+
+#include <algorithm>
+
+namespace speedtest {
+bool LatencySampler::Stats::operator < (const Stats &other) const noexcept
+{
+    if (failed != other.failed)
+        return failed < other.failed;
+    return median < other.median;
+}
+bool LatencySampler::Stats::operator == (const Stats &other) const noexcept
+{
+    return !(*this < other) && !(other < *this);
+}
+
+void LatencySampler::clear(std::size_t expected_probes) noexcept
+{
+    samples.clear();
+    samples.reserve(expected_probes);
+    failed = 0;
+}
+
+void LatencySampler::add(std::uint64_t us) noexcept
+{
+    samples.push_back(us);
+}
+void LatencySampler::add_failure() noexcept
+{
+    ++failed;
+}
+
+auto LatencySampler::get_samples() const noexcept -> const std::vector<std::uint64_t>&
+{
+    return samples;
+}
+
+auto LatencySampler::get_stats() const noexcept -> Stats
+{
+    Stats stats{};
+
+    auto n = samples.size();
+
+    stats.failed = failed;
+    stats.probes = n + failed;
+    if (stats.probes != 0)
+        stats.failure_ratio = static_cast<double>(failed) / static_cast<double>(stats.probes);
+
+    if (n == 0)
+        return stats;
+
+    std::uint64_t jitter_sum = 0;
+    for (std::size_t i = 1; i < n; ++i) {
+        auto x = samples[i - 1];
+        auto y = samples[i];
+        jitter_sum += x > y ? x - y : y - x;
+    }
+    if (n > 1)
+        stats.jitter = jitter_sum / (n - 1);
+
+    auto sorted = samples;
+    std::sort(sorted.begin(), sorted.end());
+
+    // Nearest-rank percentile
+    auto get_percentile = [&](unsigned percent) noexcept
+    {
+        auto rank = (n * percent + 99) / 100;
+        return sorted[rank == 0 ? 0 : rank - 1];
+    };
+
+    stats.min = sorted.front();
+    stats.median = get_percentile(50);
+    stats.p90 = get_percentile(90);
+    if (n >= p99_min_samples)
+        stats.p99 = get_percentile(99);
+
+    return stats;
+}
+} /* namespace speedtest */
@@ -0,0 +1,84 @@
+/**
+ * The classes in this headers utilizes STL but has -fno-exceptions
+ * enabled, thus if STL is out of memory, it will raise SIGABRT.
+ */
+
+#ifndef  __cpp_speedest_speedtest_LatencySampler_HPP__
+# define __cpp_speedest_speedtest_LatencySampler_HPP__
+
+# include <cstddef>
+# include <cstdint>
+# include <vector>
+
+namespace speedtest {
+/**
+ * Record latency of probes in microseconds, in the order they are taken,
+ * and summarize them into percentiles.
+ *
+ * @warning all functions is this class is not thread-safe.
+ */
+class LatencySampler {
+public:
+    /**
+     * Minimum number of successful probes for Stats::p99 to be reported.
+     */
+    static constexpr const std::size_t p99_min_samples = 100;
+
+    struct Stats {
+        /**
+         * Number of probes taken, including failed ones.
+         */
+        std::size_t probes;
+        std::size_t failed;
+        /**
+         * failed / probes, 0 if no probe is taken.
+         */
+        double failure_ratio;
+
+        /**
+         * In microseconds, calculated from successful probes only.
+         * <br>All of them are 0 if there's no successful probe.
+         */
+        std::uint64_t min;
+        std::uint64_t median;
+        std::uint64_t p90;
+        /**
+         * 0 if there are fewer than p99_min_samples successful probes,
+         * since nearest-rank p99 of fewer probes is just the maximum.
+         */
+        std::uint64_t p99;
+        /**
+         * Mean absolute difference between consecutive successful probes.
+         */
+        std::uint64_t jitter;
+
+        /**
+         * Order used to rank servers: fewer failed probes first, 
+         * then lower median.
+         */
+        bool operator < (const Stats &other) const noexcept;
+        bool operator == (const Stats &other) const noexcept;
+    };
+
+protected:
+    std::vector<std::uint64_t> samples;
+    std::size_t failed = 0;
+
+public:
+    /**
+     * Discard all probes.
+     *
+     * @param expected_probes used to reserve space for samples.
+     */
+    void clear(std::size_t expected_probes = 0) noexcept;
+
+    void add(std::uint64_t us) noexcept;
+    void add_failure() noexcept;
+
+    auto get_samples() const noexcept -> const std::vector<std::uint64_t>&;
+
+    auto get_stats() const noexcept -> Stats;
+};
+} /* namespace speedtest */
+
+#endif
@@ -0,0 +1,466 @@
+#include "Metrics.hpp"
+#include "../utils/Output_buffer.hpp"
+#include "../utils/write_file_atomic.hpp"
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+namespace speedtest {
+using utils::Output_buffer;
+
+/**
+ * 1 Mbps to 10 Gbps, in bytes per second.
+ */
+static constexpr const std::uint64_t speed_bounds[] = {
+    125'000, 625'000, 1'250'000, 3'125'000, 6'250'000, 12'500'000, 31'250'000, 62'500'000,
+    125'000'000, 312'500'000, 1'250'000'000,
+};
+/**
+ * In us.
+ */
+static constexpr const std::uint64_t latency_bounds[] = {
+    1'000, 2'500, 5'000, 10'000, 25'000, 50'000, 100'000, 250'000, 500'000, 1'000'000,
+};
+/**
+ * In ms.
+ */
+static constexpr const std::uint64_t duration_bounds[] = {
+    5'000, 10'000, 15'000, 20'000, 30'000, 45'000, 60'000, 90'000, 120'000,
+};
+
+void Metrics_sink::Histogram::observe(std::uint64_t value) noexcept
+{
+    std::size_t i = 0;
+    while (i != bounds_cnt && value > bounds[i])
+        ++i;
+
+    ++counts[i];
+    ++count;
+    sum += value;
+}
+
+Metrics_sink::Metrics_sink(const char *textfile_path) noexcept:
+    buffer{std::make_unique<char[]>(4 * snapshot_sz)},
+    textfile_path{textfile_path},
+    download_speed{speed_bounds},
+    upload_speed{speed_bounds},
+    latency{latency_bounds},
+    duration{duration_bounds}
+{
+    publish(render(nullptr, buffer.get() + back * snapshot_sz, snapshot_sz, true));
+}
+
+static void append_family(Output_buffer &out, std::string_view name, std::string_view type,
+                          std::string_view help) noexcept
+{
+    out.append("# HELP ");
+    out.append(name);
+    out.append(' ');
+    out.append(help);
+    out.append("\n# TYPE ");
+    out.append(name);
+    out.append(' ');
+    out.append(type);
+    out.append('\n');
+}
+
+/**
+ * Append a line of sample, with value / 10^scale as its value.
+ *
+ * @param labels either empty or enclosed in braces.
+ */
+static void append_sample(Output_buffer &out, std::string_view name, std::string_view labels,
+                          std::uint64_t value, unsigned scale = 0) noexcept
+{
+    out.append(name);
+    out.append(labels);
+    out.append(' ');
+    out.append_fixed(value, scale);
+    out.append('\n');
+}
+
+static void append_gauge(Output_buffer &out, std::string_view name, std::string_view help,
+                         std::uint64_t value, unsigned scale = 0) noexcept
+{
+    append_family(out, name, "gauge", help);
+    append_sample(out, name, {}, value, scale);
+}
+
+static void append_label_value(Output_buffer &out, std::string_view value) noexcept
+{
+    out.append('"');
+    for (auto c: value) {
+        if (c == '\\' || c == '"')
+            out.append('\\');
+        else if (c == '\n') {
+            out.append("\\n");
+            continue;
+        }
+        out.append(c);
+    }
+    out.append('"');
+}
+
+/**
+ * @param scale of both bounds and observations of histogram.
+ */
+static void append_histogram(Output_buffer &out, std::string_view name, std::string_view help,
+                             const Metrics_sink::Histogram &histogram, unsigned scale) noexcept
+{
+    append_family(out, name, "histogram", help);
+
+    std::uint64_t cumulative = 0;
+    for (std::size_t i = 0; i != histogram.bounds_cnt; ++i) {
+        cumulative += histogram.counts[i];
+
+        out.append(name);
+        out.append("_bucket{le=\"");
+        out.append_fixed(histogram.bounds[i], scale);
+        // Bounds are floats, rendered the same in every scrape.
+        if (scale == 0)
+            out.append(".0");
+        out.append("\"} ");
+        out.append_int(cumulative);
+        out.append('\n');
+    }
+
+    out.append(name);
+    out.append("_bucket{le=\"+Inf\"} ");
+    out.append_int(histogram.count);
+    out.append('\n');
+
+    out.append(name);
+    out.append("_count ");
+    out.append_int(histogram.count);
+    out.append('\n');
+
+    out.append(name);
+    out.append("_sum ");
+    out.append_fixed(histogram.sum, scale);
+    out.append('\n');
+}
+
+auto Metrics_sink::render(const SpeedtestResult *result, char *p, std::size_t size, bool openmetrics) const noexcept ->
+    std::size_t
+{
+    Output_buffer out{p, size};
+
+    // Text format 0.0.4 names the family of counter after its sample and has no info type.
+    append_family(out, openmetrics ? "speedtest_runs" : "speedtest_runs_total", "counter",
+                  "Number of tests completed.");
+    append_sample(out, "speedtest_runs_total", {}, runs);
+
+    if (result) {
+        append_gauge(out, "speedtest_last_run_timestamp_seconds", "Unix time when the latest test started.",
+                     result->timestamp_ms, 3);
+        append_gauge(out, "speedtest_duration_seconds", "Time taken by the latest test.",
+                     result->duration_ms, 3);
+
+        append_gauge(out, "speedtest_download_bytes_per_second", "Download speed, with warm-up excluded.",
+                     result->download_speed);
+        append_gauge(out, "speedtest_upload_bytes_per_second", "Upload speed, with warm-up excluded.",
+                     result->upload_speed);
+        append_gauge(out, "speedtest_download_raw_bytes_per_second", "Download speed, with warm-up included.",
+                     result->raw_download_speed);
+        append_gauge(out, "speedtest_upload_raw_bytes_per_second", "Upload speed, with warm-up included.",
+                     result->raw_upload_speed);
+
+        const std::pair<const char*, const LatencySampler::Stats*> phases[] = {
+            {"idle", &result->latency},
+            {"download", &result->download_latency},
+            {"upload", &result->upload_latency},
+        };
+
+        append_family(out, "speedtest_latency_seconds", "gauge",
+                      "Latency of the server, while idle or download/upload is running.");
+        for (const auto &[phase, stats]: phases) {
+            const std::pair<const char*, std::uint64_t> values[] = {
+                {"min", stats->min},
+                {"median", stats->median},
+                {"p90", stats->p90},
+                {"p99", stats->p99},
+                {"jitter", stats->jitter},
+            };
+
+            for (const auto &[stat, value]: values) {
+                // p99 is not reported with too few probes.
+                if (value == 0 && std::strcmp(stat, "p99") == 0)
+                    continue;
+
+                out.append("speedtest_latency_seconds{phase=\"");
+                out.append(phase);
+                out.append("\",stat=\"");
+                out.append(stat);
+                out.append("\"} ");
+                out.append_fixed(value, 6);
+                out.append('\n');
+            }
+        }
+
+        append_family(out, "speedtest_latency_failure_ratio", "gauge",
+                      "Ratio of latency probes failed, while idle or download/upload is running.");
+        for (const auto &[phase, stats]: phases) {
+            out.append("speedtest_latency_failure_ratio{phase=\"");
+            out.append(phase);
+            out.append("\"} ");
+            // In ppm, so that it is rendered the same way as other metrics.
+            out.append_fixed(stats->probes == 0 ? 0 : stats->failed * 1'000'000 / stats->probes, 6);
+            out.append('\n');
+        }
+
+        append_gauge(out, "speedtest_server_id", "Id of the server used by the latest test.",
+                     static_cast<std::uint64_t>(result->server_id));
+
+        auto distance_m = std::isfinite(result->distance) && result->distance > 0 ?
+            std::llround(result->distance * 1000) : 0;
+        append_gauge(out, "speedtest_server_distance_meters", "Distance to the server used by the latest test.",
+                     static_cast<std::uint64_t>(distance_m));
+
+        append_family(out, openmetrics ? "speedtest_server" : "speedtest_server_info",
+                      openmetrics ? "info" : "gauge", "Server used by the latest test.");
+        out.append("speedtest_server_info{id=\"");
+        out.append_int(result->server_id);
+        out.append("\",sponsor=");
+        append_label_value(out, result->sponsor_name);
+        out.append(",name=");
+        append_label_value(out, result->server_name);
+        out.append("} 1\n");
+    }
+
+    append_histogram(out, "speedtest_run_download_bytes_per_second", "Download speed of every test.",
+                     download_speed, 0);
+    append_histogram(out, "speedtest_run_upload_bytes_per_second", "Upload speed of every test.",
+                     upload_speed, 0);
+    append_histogram(out, "speedtest_run_latency_seconds", "Median idle latency of every test.",
+                     latency, 6);
+    append_histogram(out, "speedtest_run_duration_seconds", "Time taken by every test.",
+                     duration, 3);
+
+    if (openmetrics)
+        out.append("# EOF\n");
+
+    return out.len;
+}
+
+bool Metrics_sink::publish(std::size_t len) noexcept
+{
+    if (len > snapshot_sz) {
+        errno = EMSGSIZE;
+        return false;
+    }
+
+    snapshot_lens[back] = len;
+    back = published.exchange(back | fresh_bit, std::memory_order_acq_rel) & ~fresh_bit;
+
+    return true;
+}
+
+bool Metrics_sink::write(const SpeedtestResult &result) noexcept
+{
+    ++runs;
+    download_speed.observe(result.download_speed);
+    upload_speed.observe(result.upload_speed);
+    // Median is meaningless if every probe failed.
+    if (result.latency.failed != result.latency.probes)
+        latency.observe(result.latency.median);
+    duration.observe(result.duration_ms);
+
+    bool success = publish(render(&result, buffer.get() + back * snapshot_sz, snapshot_sz, true));
+
+    if (textfile_path) {
+        auto *textfile = buffer.get() + 3 * snapshot_sz;
+        auto len = render(&result, textfile, snapshot_sz, false);
+
+        if (len > snapshot_sz) {
+            errno = EMSGSIZE;
+            return false;
+        }
+        if (!utils::write_file_atomic(textfile_path, textfile, len))
+            return false;
+    }
+
+    return success;
+}
+
+bool Metrics_sink::flush() noexcept
+{
+    return true;
+}
+
+auto Metrics_sink::acquire() noexcept -> std::string_view
+{
+    if (published.load(std::memory_order_relaxed) & fresh_bit)
+        front = published.exchange(front, std::memory_order_acq_rel) & ~fresh_bit;
+
+    return {buffer.get() + front * snapshot_sz, snapshot_lens[front]};
+}
+
+Metrics_exporter::Metrics_exporter(Metrics_sink &sink) noexcept:
+    sink{sink}
+{}
+
+Metrics_exporter::~Metrics_exporter()
+{
+    stop();
+}
+
+bool Metrics_exporter::start(const char *host, const char *port) noexcept
+{
+    stop();
+
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    struct addrinfo *addrs;
+    if (int ret = getaddrinfo(host, port, &hints, &addrs); ret != 0) {
+        errno = ret == EAI_SYSTEM ? errno : EADDRNOTAVAIL;
+        return false;
+    }
+
+    for (auto *addr = addrs; addr; addr = addr->ai_next) {
+        int fd = socket(addr->ai_family, addr->ai_socktype | SOCK_CLOEXEC, addr->ai_protocol);
+        if (fd == -1)
+            continue;
+
+        int enable = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+        if (bind(fd, addr->ai_addr, addr->ai_addrlen) == 0 && listen(fd, 16) == 0) {
+            listen_fd = fd;
+            break;
+        }
+
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+    }
+    freeaddrinfo(addrs);
+
+    if (listen_fd == -1)
+        return false;
+
+    stopping.store(false, std::memory_order_relaxed);
+    thread = std::thread{&Metrics_exporter::run, this};
+
+    return true;
+}
+
+void Metrics_exporter::stop() noexcept
+{
+    if (listen_fd == -1)
+        return;
+
+    stopping.store(true, std::memory_order_relaxed);
+    thread.join();
+
+    close(listen_fd);
+    listen_fd = -1;
+}
+
+void Metrics_exporter::run() noexcept
+{
+    struct pollfd pfd = {listen_fd, POLLIN, 0};
+
+    while (!stopping.load(std::memory_order_relaxed)) {
+        // Wake up periodically to check stopping.
+        if (poll(&pfd, 1, 200) <= 0)
+            continue;
+
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd == -1)
+            continue;
+
+        serve(fd);
+        close(fd);
+    }
+}
+
+static bool send_all(int fd, const char *data, std::size_t len) noexcept
+{
+    while (len != 0) {
+        auto ret = send(fd, data, len, MSG_NOSIGNAL);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+void Metrics_exporter::serve(int fd) noexcept
+{
+    // Bound the time a slow or stalled client can block the next scrape.
+    struct timeval timeout = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    char request[4096];
+    std::size_t len = 0;
+
+    // Only the request line matters, but the whole header is read so that
+    // the client does not get a reset for closing with unread data.
+    while (std::string_view{request, len}.find("\r\n\r\n") == std::string_view::npos) {
+        if (len == sizeof(request))
+            return;
+
+        auto ret = recv(fd, request + len, sizeof(request) - len, 0);
+        if (ret == -1 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return;
+        len += ret;
+    }
+
+    std::string_view request_line{request, len};
+    request_line = request_line.substr(0, request_line.find("\r\n"));
+
+    bool is_head = request_line.rfind("HEAD ", 0) == 0;
+    bool is_get = request_line.rfind("GET ", 0) == 0;
+
+    std::string_view target;
+    if (is_get || is_head) {
+        target = request_line.substr(request_line.find(' ') + 1);
+        target = target.substr(0, target.find(' '));
+        target = target.substr(0, target.find('?'));
+    }
+
+    char header[256];
+    std::string_view body;
+    int header_len;
+
+    if (target == "/metrics") {
+        body = sink.acquire();
+        header_len = std::snprintf(header, sizeof(header),
+                                   "HTTP/1.1 200 OK\r\n"
+                                   "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+                                   "Content-Length: %zu\r\n"
+                                   "Connection: close\r\n\r\n",
+                                   body.size());
+    } else {
+        body = "Not Found\n";
+        header_len = std::snprintf(header, sizeof(header),
+                                   "HTTP/1.1 404 Not Found\r\n"
+                                   "Content-Type: text/plain\r\n"
+                                   "Content-Length: %zu\r\n"
+                                   "Connection: close\r\n\r\n",
+                                   body.size());
+    }
+
+    if (send_all(fd, header, header_len) && !is_head)
+        send_all(fd, body.data(), body.size());
+}
+} /* namespace speedtest */
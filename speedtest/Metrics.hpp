@@ -0,0 +1,213 @@
+/**
+ * The classes in this headers utilizes STL but has -fno-exceptions
+ * enabled, thus if STL is out of memory, it will raise SIGABRT.
+ */
+
+#ifndef  __cpp_speedest_speedtest_Metrics_HPP__
+# define __cpp_speedest_speedtest_Metrics_HPP__
+
+# include "SpeedtestResult.hpp"
+# include "Result_sink.hpp"
+
+# include <cstddef>
+# include <cstdint>
+# include <atomic>
+# include <memory>
+# include <string_view>
+# include <thread>
+
+namespace speedtest {
+/**
+ * Expose the latest result, and histograms of every result since the
+ * process starts, as metrics scraped by Prometheus.
+ *
+ * write() renders the metrics in OpenMetrics text format into one of three
+ * buffers and publishes it with a single atomic exchange, so that a reader
+ * on another thread always gets a complete snapshot, and neither side
+ * ever waits for the other.
+ * <br>Histograms are cumulative as Prometheus expects, rate() or increase()
+ * over a range gives the distribution of recent runs.
+ *
+ * @warning write() and flush() must be called from one thread, and
+ *          acquire() from at most one other thread.
+ *
+ * This class has no cp/mv ctor/assignment.
+ */
+class Metrics_sink: public Result_sink {
+public:
+    /**
+     * Snapshot larger than this is not published, write() returns false.
+     */
+    static constexpr const std::size_t snapshot_sz = 32 * 1024;
+
+    /**
+     * Observations are integers in the unit of the measurement, e.g. us for
+     * latency, so that counting them never loses precision; they are scaled
+     * to the base unit only when rendered.
+     */
+    struct Histogram {
+        static constexpr const std::size_t max_bounds_cnt = 15;
+
+        /**
+         * Upper bounds of buckets in ascending order, +Inf is implicit.
+         */
+        const std::uint64_t *bounds;
+        std::size_t bounds_cnt;
+
+        /**
+         * Number of observations in each bucket, not cumulative.
+         * <br>counts[bounds_cnt] is the +Inf bucket.
+         */
+        std::uint64_t counts[max_bounds_cnt + 1] = {};
+        std::uint64_t count = 0;
+        std::uint64_t sum = 0;
+
+        template <std::size_t N>
+        Histogram(const std::uint64_t (&bounds)[N]) noexcept:
+            bounds{bounds},
+            bounds_cnt{N}
+        {
+            static_assert(N <= max_bounds_cnt);
+        }
+
+        void observe(std::uint64_t value) noexcept;
+    };
+
+protected:
+    /**
+     * 3 snapshots of snapshot_sz each, followed by the buffer of textfile.
+     */
+    std::unique_ptr<char[]> buffer;
+    std::size_t snapshot_lens[3] = {};
+
+    static constexpr const unsigned fresh_bit = 4;
+    /**
+     * Index of the snapshot published last, or-ed with fresh_bit if
+     * the reader has not taken it yet.
+     */
+    std::atomic<unsigned> published{1};
+    /**
+     * Owned by the writer.
+     */
+    unsigned back = 0;
+    /**
+     * Owned by the reader.
+     */
+    unsigned front = 2;
+
+    /**
+     * If not null, metrics are also written to this file after each result,
+     * in the format read by the textfile collector of node_exporter.
+     */
+    const char *textfile_path;
+
+    std::uint64_t runs = 0;
+
+    Histogram download_speed;
+    Histogram upload_speed;
+    Histogram latency;
+    Histogram duration;
+
+    /**
+     * @param result the latest result, or nullptr if there is none.
+     * @param openmetrics if false, render Prometheus text format 0.0.4
+     *                    which node_exporter expects, else OpenMetrics 1.0.0.
+     * @return length of the whole rendering, see SpeedtestResult::format_csv.
+     */
+    auto render(const SpeedtestResult *result, char *p, std::size_t size, bool openmetrics) const noexcept ->
+        std::size_t;
+
+    /**
+     * Publish the snapshot of length len rendered in back, then take 
+     * another snapshot as back.
+     *
+     * @return false if len > snapshot_sz, errno is set to EMSGSIZE.
+     */
+    bool publish(std::size_t len) noexcept;
+
+public:
+    /**
+     * Publish a snapshot with no result, so that histograms are exported 
+     * before the first test completes.
+     *
+     * @param textfile_path must be kept around until Metrics_sink is destroyed.
+     *                      <br>Should end with ".prom" to be picked up by node_exporter.
+     */
+    Metrics_sink(const char *textfile_path = nullptr) noexcept;
+
+    Metrics_sink(const Metrics_sink&) = delete;
+    Metrics_sink(Metrics_sink&&) = delete;
+
+    Metrics_sink& operator = (const Metrics_sink&) = delete;
+    Metrics_sink& operator = (Metrics_sink&&) = delete;
+
+    ~Metrics_sink() = default;
+
+    /**
+     * @return false if the metrics do not fit in snapshot_sz, errno is set to 
+     *         EMSGSIZE, or failed to write textfile_path, errno is set.
+     *         <br>The result is still counted in histograms.
+     */
+    bool write(const SpeedtestResult &result) noexcept;
+    /**
+     * Does nothing since every result is published by write().
+     */
+    bool flush() noexcept;
+
+    /**
+     * @return the latest snapshot, valid until the next call to acquire().
+     */
+    auto acquire() noexcept -> std::string_view;
+};
+
+/**
+ * Minimal HTTP server that serves Metrics_sink::acquire() at /metrics
+ * on a thread of its own.
+ *
+ * Requests are served one at a time, each connection is closed after
+ * the response.
+ *
+ * This class has no cp/mv ctor/assignment.
+ */
+class Metrics_exporter {
+protected:
+    Metrics_sink &sink;
+
+    int listen_fd = -1;
+    std::atomic<bool> stopping{false};
+    std::thread thread;
+
+    void run() noexcept;
+    void serve(int fd) noexcept;
+
+public:
+    /**
+     * @param sink must be kept around until Metrics_exporter is destroyed.
+     *             <br>Nothing else may call sink.acquire().
+     */
+    Metrics_exporter(Metrics_sink &sink) noexcept;
+
+    Metrics_exporter(const Metrics_exporter&) = delete;
+    Metrics_exporter(Metrics_exporter&&) = delete;
+
+    Metrics_exporter& operator = (const Metrics_exporter&) = delete;
+    Metrics_exporter& operator = (Metrics_exporter&&) = delete;
+
+    /**
+     * Call stop().
+     */
+    ~Metrics_exporter();
+
+    /**
+     * @param host address to listen on, nullptr to listen on every address.
+     * @return false if the address cannot be listened on, errno is set.
+     */
+    bool start(const char *host, const char *port) noexcept;
+    /**
+     * Wait for the request being served, if any, then stop listening.
+     */
+    void stop() noexcept;
+};
+} /* namespace speedtest */
+
+#endif
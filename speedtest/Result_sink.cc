@@ -0,0 +1,218 @@
+#include "Result_sink.hpp"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cinttypes>
+#include <cerrno>
+#include <cstring>
+#include <new>
+
+namespace speedtest {
+Print_sink::Print_sink(FILE *stream) noexcept:
+    stream{stream}
+{}
+
+static void print_latency(FILE *stream, const char *name, const LatencySampler::Stats &latency) noexcept
+{
+    std::fprintf(stream, "%s latency (us): min = %" PRIu64 ", median = %" PRIu64 ", p90 = %" PRIu64,
+                 name, latency.min, latency.median, latency.p90);
+    // p99 is not reported with too few probes.
+    if (latency.p99 != 0)
+        std::fprintf(stream, ", p99 = %" PRIu64, latency.p99);
+    std::fprintf(stream, ", jitter = %" PRIu64 ", failed = %.1f%% of %zu probes\n",
+                 latency.jitter, latency.failure_ratio * 100, latency.probes);
+}
+
+bool Print_sink::write(const SpeedtestResult &result) noexcept
+{
+    std::fprintf(stream, "Server %ld (%s, %s), %.1f km away\n",
+                 result.server_id, result.sponsor_name.c_str(), result.server_name.c_str(), result.distance);
+
+    print_latency(stream, "Idle", result.latency);
+    print_latency(stream, "Download", result.download_latency);
+    print_latency(stream, "Upload", result.upload_latency);
+
+    std::fprintf(stream, "Download speed = %zu (raw %zu)\nUpload speed = %zu (raw %zu)\n",
+                 result.download_speed, result.raw_download_speed,
+                 result.upload_speed, result.raw_upload_speed);
+
+    // Results are far apart in daemon mode, so make each visible at once.
+    std::fflush(stream);
+
+    if (std::ferror(stream)) {
+        std::clearerr(stream);
+        errno = EIO;
+        return false;
+    }
+    return true;
+}
+
+bool Print_sink::flush() noexcept
+{
+    return std::fflush(stream) == 0;
+}
+
+Tee_sink::Tee_sink(Result_sink &first, Result_sink &second) noexcept:
+    first{first},
+    second{second}
+{}
+
+bool Tee_sink::write(const SpeedtestResult &result) noexcept
+{
+    bool success = first.write(result);
+    return second.write(result) && success;
+}
+
+bool Tee_sink::flush() noexcept
+{
+    bool success = first.flush();
+    return second.flush() && success;
+}
+
+File_sink::File_sink(Format format) noexcept:
+    File_sink{format, Sync_policy{}}
+{}
+File_sink::File_sink(Format format, const Sync_policy &sync_policy) noexcept:
+    format{format},
+    sync_policy{sync_policy}
+{}
+
+File_sink::~File_sink()
+{
+    close();
+}
+
+auto File_sink::format_result(const SpeedtestResult &result, char *p, std::size_t size) const noexcept -> 
+    std::size_t
+{
+    switch (format) {
+    case Format::csv:
+        return result.format_csv(p, size);
+    case Format::json_lines:
+        return result.format_json(p, size);
+    case Format::binary:
+        return result.format_binary(p, size);
+    }
+    return 0;
+}
+
+bool File_sink::drain() noexcept
+{
+    std::size_t written = 0;
+
+    while (written != buffer_len) {
+        auto ret = ::write(fd, buffer.get() + written, buffer_len - written);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+
+            std::memmove(buffer.get(), buffer.get() + written, buffer_len - written);
+            buffer_len -= written;
+            return false;
+        }
+        written += ret;
+    }
+
+    buffer_len = 0;
+    return true;
+}
+
+bool File_sink::sync() noexcept
+{
+    if (!drain() || fdatasync(fd) == -1)
+        return false;
+
+    pending = 0;
+    last_sync = std::chrono::steady_clock::now();
+    return true;
+}
+
+bool File_sink::open(const char *path) noexcept
+{
+    if (!close())
+        return false;
+
+    if (!buffer) {
+        buffer.reset(new (std::nothrow) char[buffer_sz]);
+        if (!buffer) {
+            errno = ENOMEM;
+            return false;
+        }
+    }
+
+    fd = ::open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd == -1)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+
+    if (format == Format::csv && st.st_size == 0)
+        buffer_len = SpeedtestResult::format_csv_header(buffer.get(), buffer_sz);
+
+    pending = 0;
+    last_sync = std::chrono::steady_clock::now();
+
+    return true;
+}
+
+bool File_sink::close() noexcept
+{
+    if (fd == -1)
+        return true;
+
+    bool success = sync();
+    // Keep errno of sync.
+    int saved_errno = errno;
+
+    if (::close(fd) == -1 && success)
+        success = false;
+    else
+        errno = saved_errno;
+
+    fd = -1;
+    buffer_len = 0;
+
+    return success;
+}
+
+bool File_sink::is_open() const noexcept
+{
+    return fd != -1;
+}
+
+bool File_sink::write(const SpeedtestResult &result) noexcept
+{
+    auto len = format_result(result, buffer.get() + buffer_len, buffer_sz - buffer_len);
+
+    if (len > buffer_sz - buffer_len) {
+        if (!drain())
+            return false;
+
+        len = format_result(result, buffer.get(), buffer_sz);
+        if (len > buffer_sz) {
+            errno = EMSGSIZE;
+            return false;
+        }
+    }
+
+    buffer_len += len;
+    ++pending;
+
+    if (pending >= sync_policy.records || std::chrono::steady_clock::now() - last_sync >= sync_policy.interval)
+        return sync();
+
+    return true;
+}
+
+bool File_sink::flush() noexcept
+{
+    return fd == -1 || sync();
+}
+} /* namespace speedtest */
@@ -0,0 +1,208 @@
+#ifndef  __cpp_speedest_speedtest_Result_sink_HPP__
+# define __cpp_speedest_speedtest_Result_sink_HPP__
+
+# include "SpeedtestResult.hpp"
+
+# include <cstddef>
+# include <cstdio>
+# include <chrono>
+# include <memory>
+
+namespace speedtest {
+/**
+ * Destination of results of every test run by Session.
+ */
+class Result_sink {
+protected:
+    Result_sink() = default;
+
+    Result_sink(const Result_sink&) = default;
+    Result_sink(Result_sink&&) = default;
+
+    Result_sink& operator = (const Result_sink&) = default;
+    Result_sink& operator = (Result_sink&&) = default;
+
+    ~Result_sink() = default;
+
+public:
+    /**
+     * @return false on any I/O error, errno is set.
+     */
+    virtual bool write(const SpeedtestResult &result) noexcept = 0;
+
+    /**
+     * Make every result written so far durable or visible to readers.
+     * <br>Called once Session::run stops.
+     *
+     * @return false on any I/O error, errno is set.
+     */
+    virtual bool flush() noexcept = 0;
+};
+
+/**
+ * Print results in human-readable form.
+ */
+class Print_sink: public Result_sink {
+protected:
+    FILE *stream;
+
+public:
+    /**
+     * @param stream must be kept open until Print_sink is destroyed.
+     */
+    Print_sink(FILE *stream) noexcept;
+
+    Print_sink(const Print_sink&) = default;
+    Print_sink& operator = (const Print_sink&) = default;
+
+    ~Print_sink() = default;
+
+    bool write(const SpeedtestResult &result) noexcept;
+    bool flush() noexcept;
+};
+
+/**
+ * Write results to two sinks.
+ */
+class Tee_sink: public Result_sink {
+protected:
+    Result_sink &first;
+    Result_sink &second;
+
+public:
+    /**
+     * @param first, second must be kept around until Tee_sink is destroyed.
+     */
+    Tee_sink(Result_sink &first, Result_sink &second) noexcept;
+
+    Tee_sink(const Tee_sink&) = default;
+
+    ~Tee_sink() = default;
+
+    /**
+     * Results are written to second even if first fails.
+     *
+     * @return false if either fails, with errno of the last failure.
+     */
+    bool write(const SpeedtestResult &result) noexcept;
+    bool flush() noexcept;
+};
+
+/**
+ * Append results to a file, in one of the formats of SpeedtestResult.
+ *
+ * Results are formatted into a buffer allocated once by open(), then written
+ * and fdatasync-ed in batches, so that recording a result does not
+ * allocate nor wait for the disk.
+ * <br>Results not yet synced are lost if the process crashes.
+ *
+ * @warning all functions is this class is not thread-safe.
+ *
+ * This class has no cp/mv ctor/assignment.
+ */
+class File_sink: public Result_sink {
+public:
+    enum class Format {
+        /**
+         * SpeedtestResult::format_csv, with SpeedtestResult::format_csv_header
+         * written first if the file is empty.
+         */
+        csv,
+        /**
+         * SpeedtestResult::format_json
+         */
+        json_lines,
+        /**
+         * SpeedtestResult::format_binary
+         */
+        binary,
+    };
+
+    /**
+     * Results are synced once either limit is reached.
+     * <br>Since the interval is only checked on write, results written
+     * further apart than interval are synced one by one.
+     */
+    struct Sync_policy {
+        std::size_t records = 64;
+        std::chrono::steady_clock::duration interval = std::chrono::seconds{60};
+    };
+
+    /**
+     * A result that does not fit in an empty buffer is rejected.
+     */
+    static constexpr const std::size_t buffer_sz = 64 * 1024;
+
+protected:
+    Format format;
+    Sync_policy sync_policy;
+
+    int fd = -1;
+
+    std::unique_ptr<char[]> buffer;
+    std::size_t buffer_len = 0;
+
+    /**
+     * Number of results written since last sync.
+     */
+    std::size_t pending = 0;
+    std::chrono::steady_clock::time_point last_sync;
+
+    auto format_result(const SpeedtestResult &result, char *p, std::size_t size) const noexcept -> std::size_t;
+
+    /**
+     * Write buffer to fd.
+     * <br>On failure, bytes not yet written are kept in buffer.
+     */
+    bool drain() noexcept;
+    /**
+     * drain() then fdatasync.
+     */
+    bool sync() noexcept;
+
+public:
+    /**
+     * Use default Sync_policy.
+     */
+    File_sink(Format format) noexcept;
+    File_sink(Format format, const Sync_policy &sync_policy) noexcept;
+
+    File_sink(const File_sink&) = delete;
+    File_sink(File_sink&&) = delete;
+
+    File_sink& operator = (const File_sink&) = delete;
+    File_sink& operator = (File_sink&&) = delete;
+
+    /**
+     * Call close().
+     */
+    ~File_sink();
+
+    /**
+     * Open path for appending, creating it if not exist, closing the file 
+     * previously opened.
+     *
+     * @return false on any I/O error, errno is set.
+     */
+    bool open(const char *path) noexcept;
+    /**
+     * Sync and close the file.
+     *
+     * @return false on any I/O error, errno is set.
+     */
+    bool close() noexcept;
+
+    bool is_open() const noexcept;
+
+    /**
+     * @pre is_open()
+     */
+    bool write(const SpeedtestResult &result) noexcept;
+    /**
+     * Sync every result written, does nothing if !is_open().
+     */
+    bool flush() noexcept;
+};
+} /* namespace speedtest */
+
+#endif
@@ -0,0 +1,329 @@
+#include "ServerCache.hpp"
+
+#include "../utils/get_unix_timestamp_ms.hpp"
+#include "../utils/write_file_atomic.hpp"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <utility>
+
+namespace speedtest {
+static constexpr const std::uint32_t byte_order = 0x01020304;
+
+static std::size_t align8(std::size_t offset) noexcept
+{
+    return (offset + 7) / 8 * 8;
+}
+
+ServerCache::Layout::Layout(std::size_t count, std::size_t strings_size, std::size_t validators_size) noexcept
+{
+    std::size_t offset = align8(sizeof(Header));
+
+    ids = offset;
+    offset = align8(offset + count * sizeof(std::int64_t));
+
+    lats = offset;
+    offset = align8(offset + count * sizeof(float));
+
+    lons = offset;
+    offset = align8(offset + count * sizeof(float));
+
+    for (auto &field_offsets: offsets) {
+        field_offsets = offset;
+        offset = align8(offset + count * sizeof(std::uint32_t));
+    }
+
+    strings = offset;
+    offset += strings_size;
+
+    validators = offset;
+    size = offset + validators_size;
+}
+
+void ServerCache::Writer::add(std::int64_t id, const char *url, std::string_view name, std::string_view sponsor,
+                              float lat, float lon, std::string_view country) noexcept
+{
+    ids.push_back(id);
+    lats.push_back(lat);
+    lons.push_back(lon);
+
+    const std::string_view fields[] = {url, name, sponsor, country};
+    static_assert(sizeof(fields) / sizeof(fields[0]) == fields_cnt);
+
+    for (std::size_t i = 0; i != fields_cnt; ++i) {
+        offsets[i].push_back(strings.size());
+        strings.append(fields[i]);
+        strings.push_back('\0');
+    }
+}
+
+void ServerCache::Writer::add_validators(std::string_view url, std::string_view etag, 
+                                         std::string_view last_modified) noexcept
+{
+    for (auto str: {url, etag, last_modified}) {
+        validators.append(str);
+        validators.push_back('\0');
+    }
+    ++validators_cnt;
+}
+
+bool ServerCache::Writer::write(const char *path) const noexcept
+{
+    if (strings.size() > UINT32_MAX) {
+        errno = EFBIG;
+        return false;
+    }
+
+    auto count = ids.size();
+    Layout layout{count, strings.size(), validators.size()};
+
+    auto buffer = std::unique_ptr<char[]>{new (std::nothrow) char[layout.size]()};
+    if (!buffer) {
+        errno = ENOMEM;
+        return false;
+    }
+
+    Header header{};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.byte_order = byte_order;
+    header.created_ms = utils::get_unix_timestamp_ms();
+    header.count = count;
+    header.strings_size = strings.size();
+    header.validators_cnt = validators_cnt;
+    header.validators_size = validators.size();
+
+    std::memcpy(buffer.get(), &header, sizeof(header));
+    // data() of empty vectors can be nullptr, which memcpy does not accept.
+    if (count != 0) {
+        std::memcpy(buffer.get() + layout.ids, ids.data(), count * sizeof(std::int64_t));
+        std::memcpy(buffer.get() + layout.lats, lats.data(), count * sizeof(float));
+        std::memcpy(buffer.get() + layout.lons, lons.data(), count * sizeof(float));
+        for (std::size_t i = 0; i != fields_cnt; ++i)
+            std::memcpy(buffer.get() + layout.offsets[i], offsets[i].data(), count * sizeof(std::uint32_t));
+        std::memcpy(buffer.get() + layout.strings, strings.data(), strings.size());
+    }
+    std::memcpy(buffer.get() + layout.validators, validators.data(), validators.size());
+
+    return utils::write_file_atomic(path, buffer.get(), layout.size);
+}
+
+ServerCache::ServerCache(ServerCache &&other) noexcept
+{
+    *this = std::move(other);
+}
+auto ServerCache::operator = (ServerCache &&other) noexcept -> ServerCache&
+{
+    if (this == &other)
+        return *this;
+
+    close();
+
+    addr = std::exchange(other.addr, nullptr);
+    len = std::exchange(other.len, 0);
+
+    header = std::exchange(other.header, nullptr);
+    ids = std::exchange(other.ids, nullptr);
+    lats = std::exchange(other.lats, nullptr);
+    lons = std::exchange(other.lons, nullptr);
+    for (std::size_t i = 0; i != fields_cnt; ++i)
+        offsets[i] = std::exchange(other.offsets[i], nullptr);
+    strings = std::exchange(other.strings, nullptr);
+    validators = std::exchange(other.validators, nullptr);
+
+    return *this;
+}
+
+ServerCache::~ServerCache()
+{
+    close();
+}
+
+void ServerCache::close() noexcept
+{
+    if (addr)
+        munmap(addr, len);
+
+    addr = nullptr;
+    len = 0;
+    header = nullptr;
+}
+
+bool ServerCache::open(const char *path) noexcept
+{
+    close();
+
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || static_cast<std::size_t>(st.st_size) < sizeof(Header)) {
+        ::close(fd);
+        return false;
+    }
+
+    std::size_t size = st.st_size;
+    auto *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (p == MAP_FAILED)
+        return false;
+
+    const auto *base = static_cast<const char*>(p);
+    const auto *hdr = static_cast<const Header*>(p);
+
+    auto is_valid = [&]() noexcept
+    {
+        if (std::memcmp(hdr->magic, magic, sizeof(magic)) != 0 || hdr->version != version ||
+            hdr->byte_order != byte_order)
+            return false;
+
+        // Reject count and sizes that would overflow Layout.
+        if (hdr->count > size || hdr->strings_size > size || hdr->validators_size > size)
+            return false;
+
+        Layout layout{hdr->count, hdr->strings_size, hdr->validators_size};
+        if (layout.size != size)
+            return false;
+
+        // Validators must be exactly validators_cnt * 3 null-terminated strings.
+        std::uint64_t strings_cnt = 0;
+        for (std::size_t i = 0; i != hdr->validators_size; ++i)
+            strings_cnt += base[layout.validators + i] == '\0';
+        if (strings_cnt != hdr->validators_cnt * 3 || 
+            (hdr->validators_size != 0 && base[layout.validators + hdr->validators_size - 1] != '\0'))
+            return false;
+
+        if (hdr->count == 0)
+            return true;
+
+        // Every string, even corrupted offsets, must end within the file.
+        if (hdr->strings_size == 0 || base[layout.strings + hdr->strings_size - 1] != '\0')
+            return false;
+
+        for (auto field_offsets: layout.offsets) {
+            const auto *array = reinterpret_cast<const std::uint32_t*>(base + field_offsets);
+            for (std::size_t i = 0; i != hdr->count; ++i) {
+                if (array[i] >= hdr->strings_size)
+                    return false;
+            }
+        }
+
+        return true;
+    };
+
+    if (!is_valid()) {
+        munmap(p, size);
+        return false;
+    }
+
+    Layout layout{hdr->count, hdr->strings_size, hdr->validators_size};
+
+    addr = p;
+    len = size;
+
+    header = hdr;
+    ids = reinterpret_cast<const std::int64_t*>(base + layout.ids);
+    lats = reinterpret_cast<const float*>(base + layout.lats);
+    lons = reinterpret_cast<const float*>(base + layout.lons);
+    for (std::size_t i = 0; i != fields_cnt; ++i)
+        offsets[i] = reinterpret_cast<const std::uint32_t*>(base + layout.offsets[i]);
+    strings = base + layout.strings;
+    validators = base + layout.validators;
+
+    return true;
+}
+
+bool ServerCache::is_open() const noexcept
+{
+    return header != nullptr;
+}
+
+bool ServerCache::is_expired(std::chrono::seconds ttl) const noexcept
+{
+    auto now = utils::get_unix_timestamp_ms();
+    auto created = header->created_ms;
+
+    // A file from the future is treated as expired, in case the clock is adjusted.
+    return now < created || now - created > static_cast<std::uint64_t>(ttl.count()) * 1000;
+}
+
+bool ServerCache::write_revalidated(const char *path, const Writer &writer) const noexcept
+{
+    // Validators are at the end of the file, everything before them is kept.
+    auto prefix_sz = static_cast<std::size_t>(validators - static_cast<const char*>(addr));
+    auto size = prefix_sz + writer.validators.size();
+
+    auto buffer = std::unique_ptr<char[]>{new (std::nothrow) char[size]};
+    if (!buffer) {
+        errno = ENOMEM;
+        return false;
+    }
+
+    std::memcpy(buffer.get(), addr, prefix_sz);
+    std::memcpy(buffer.get() + prefix_sz, writer.validators.data(), writer.validators.size());
+
+    Header new_header = *header;
+    new_header.created_ms = utils::get_unix_timestamp_ms();
+    new_header.validators_cnt = writer.validators_cnt;
+    new_header.validators_size = writer.validators.size();
+    std::memcpy(buffer.get(), &new_header, sizeof(new_header));
+
+    return utils::write_file_atomic(path, buffer.get(), size);
+}
+
+bool ServerCache::find_validators(std::string_view url, std::string_view &etag, std::string_view &last_modified) 
+    const noexcept
+{
+    const char *p = validators;
+
+    for (std::uint64_t i = 0; i != header->validators_cnt; ++i) {
+        std::string_view strs[3];
+        for (auto &str: strs) {
+            str = p;
+            p += str.size() + 1;
+        }
+
+        if (strs[0] == url) {
+            etag = strs[1];
+            last_modified = strs[2];
+            return true;
+        }
+    }
+
+    return false;
+}
+
+auto ServerCache::size() const noexcept -> std::size_t
+{
+    return header ? header->count : 0;
+}
+
+auto ServerCache::get_id(std::size_t i) const noexcept -> std::int64_t
+{
+    return ids[i];
+}
+
+auto ServerCache::get_lats() const noexcept -> const float*
+{
+    return lats;
+}
+auto ServerCache::get_lons() const noexcept -> const float*
+{
+    return lons;
+}
+
+auto ServerCache::get(std::size_t i, Field field) const noexcept -> const char*
+{
+    return strings + offsets[static_cast<unsigned>(field)][i];
+}
+} /* namespace speedtest */
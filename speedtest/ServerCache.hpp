@@ -0,0 +1,205 @@
+/**
+ * The classes in this headers utilizes STL but has -fno-exceptions
+ * enabled, thus if STL is out of memory, it will raise SIGABRT.
+ */
+
+#ifndef  __cpp_speedest_speedtest_ServerCache_HPP__
+# define __cpp_speedest_speedtest_ServerCache_HPP__
+
+# include <cstddef>
+# include <cstdint>
+# include <chrono>
+# include <string>
+# include <string_view>
+# include <vector>
+
+namespace speedtest {
+/**
+ * Server list persisted on disk, which is memory-mapped and queried in place,
+ * so that a warm start does not need to download or parse anything.
+ *
+ * The file is a header followed by arrays of ids, latitudes, longitudes and
+ * offsets of strings, then all strings null-terminated in one blob, then
+ * validators of the server lists the servers come from.
+ * <br>It is written in native byte order and is not meant to be shared
+ * between machines.
+ *
+ * @warning all functions is this class is not thread-safe.
+ */
+class ServerCache {
+public:
+    static constexpr const char magic[8] = {'S', 'P', 'D', 'T', 'S', 'R', 'V', 'S'};
+    static constexpr const std::uint32_t version = 2;
+
+    struct Header {
+        char magic[8];
+        std::uint32_t version;
+        /**
+         * Written as 0x01020304 to detect byte order mismatch.
+         */
+        std::uint32_t byte_order;
+        /**
+         * Unix timestamp in ms when the file is written.
+         */
+        std::uint64_t created_ms;
+        std::uint64_t count;
+        std::uint64_t strings_size;
+        /**
+         * Number of validators, each is 3 null-terminated strings: url, etag and last_modified.
+         */
+        std::uint64_t validators_cnt;
+        std::uint64_t validators_size;
+    };
+
+    /**
+     * Strings of each server.
+     */
+    enum class Field: unsigned {
+        /**
+         * In the same format as Speedtest::Config::Candidate_servers::Server::url.
+         */
+        url,
+        name,
+        sponsor,
+        country,
+    };
+    static constexpr const std::size_t fields_cnt = 4;
+
+    /**
+     * Offset of each array in the file, each aligned to 8 bytes.
+     */
+    struct Layout {
+        std::size_t ids;
+        std::size_t lats;
+        std::size_t lons;
+        std::size_t offsets[fields_cnt];
+        std::size_t strings;
+        std::size_t validators;
+        std::size_t size;
+
+        Layout(std::size_t count, std::size_t strings_size, std::size_t validators_size) noexcept;
+    };
+
+    /**
+     * Build the file in memory, then write it to disk.
+     */
+    class Writer {
+        friend ServerCache;
+
+    protected:
+        std::vector<std::int64_t> ids;
+        std::vector<float> lats;
+        std::vector<float> lons;
+        std::vector<std::uint32_t> offsets[fields_cnt];
+        std::string strings;
+
+        std::uint64_t validators_cnt = 0;
+        std::string validators;
+
+    public:
+        /**
+         * @param url in the same format as Speedtest::Config::Candidate_servers::Server::url.
+         */
+        void add(std::int64_t id, const char *url, std::string_view name, std::string_view sponsor,
+                 float lat, float lon, std::string_view country) noexcept;
+
+        /**
+         * Record validators of the server list retrieved from url, so that it
+         * can be revalidated with a conditional request later.
+         */
+        void add_validators(std::string_view url, std::string_view etag, std::string_view last_modified) noexcept;
+
+        /**
+         * Write atomically with utils::write_file_atomic.
+         *
+         * @return false on any I/O error, errno is set.
+         */
+        bool write(const char *path) const noexcept;
+    };
+
+protected:
+    void *addr = nullptr;
+    std::size_t len = 0;
+
+    const Header *header = nullptr;
+    const std::int64_t *ids = nullptr;
+    const float *lats = nullptr;
+    const float *lons = nullptr;
+    const std::uint32_t *offsets[fields_cnt] = {};
+    const char *strings = nullptr;
+    const char *validators = nullptr;
+
+public:
+    ServerCache() = default;
+
+    ServerCache(const ServerCache&) = delete;
+    ServerCache(ServerCache &&other) noexcept;
+
+    ServerCache& operator = (const ServerCache&) = delete;
+    ServerCache& operator = (ServerCache &&other) noexcept;
+
+    ~ServerCache();
+
+    /**
+     * Map path into memory, closing the file previously mapped.
+     *
+     * @return false if path cannot be mapped or is not a valid cache file
+     *         of this version.
+     */
+    bool open(const char *path) noexcept;
+    void close() noexcept;
+
+    bool is_open() const noexcept;
+
+    /**
+     * @pre is_open()
+     * @return true if the file is written more than ttl ago.
+     */
+    bool is_expired(std::chrono::seconds ttl) const noexcept;
+
+    /**
+     * Write servers of this cache along with validators added to writer,
+     * instead of the validators recorded, to path as if it is written now.
+     * <br>Used after the content is revalidated, since a 304 response may 
+     * carry updated validators.
+     *
+     * @pre is_open()
+     * @param writer servers added to it are ignored.
+     * @return false on any I/O error, errno is set.
+     */
+    bool write_revalidated(const char *path, const Writer &writer) const noexcept;
+
+    /**
+     * @pre is_open()
+     * @return false if no validators is recorded for url.
+     */
+    bool find_validators(std::string_view url, std::string_view &etag, std::string_view &last_modified) 
+        const noexcept;
+
+    /**
+     * @return 0 if !is_open()
+     */
+    auto size() const noexcept -> std::size_t;
+
+    /**
+     * @pre i < size(), same for the functions below.
+     */
+    auto get_id(std::size_t i) const noexcept -> std::int64_t;
+
+    /**
+     * @return array of size() latitudes in degrees.
+     */
+    auto get_lats() const noexcept -> const float*;
+    /**
+     * @return array of size() longitudes in degrees.
+     */
+    auto get_lons() const noexcept -> const float*;
+
+    /**
+     * @return null-terminated string valid until the cache is closed.
+     */
+    auto get(std::size_t i, Field field) const noexcept -> const char*;
+};
+} /* namespace speedtest */
+
+#endif
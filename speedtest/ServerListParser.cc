@@ -0,0 +1,355 @@
+#include "ServerListParser.hpp"
+
+#include <cstring>
+#include <cstdint>
+
+namespace speedtest {
+static bool is_space(char c) noexcept
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static auto trim(std::string_view str) noexcept -> std::string_view
+{
+    while (!str.empty() && is_space(str.front()))
+        str.remove_prefix(1);
+    while (!str.empty() && is_space(str.back()))
+        str.remove_suffix(1);
+    return str;
+}
+
+ServerListParser::ServerListParser(callback_t callback, void *arg) noexcept:
+    callback{callback}, arg{arg}
+{}
+
+void ServerListParser::reset() noexcept
+{
+    state = State::text;
+    partial.clear();
+    saw_servers_end = false;
+}
+
+bool ServerListParser::is_complete() const noexcept
+{
+    return saw_servers_end && state != State::error;
+}
+
+static void append_utf8(std::string &out, std::uint32_t code_point) noexcept
+{
+    if (code_point < 0x80)
+        out += char(code_point);
+    else if (code_point < 0x800) {
+        out += char(0xC0 | (code_point >> 6));
+        out += char(0x80 | (code_point & 0x3F));
+    } else if (code_point < 0x10000) {
+        out += char(0xE0 | (code_point >> 12));
+        out += char(0x80 | ((code_point >> 6) & 0x3F));
+        out += char(0x80 | (code_point & 0x3F));
+    } else {
+        out += char(0xF0 | (code_point >> 18));
+        out += char(0x80 | ((code_point >> 12) & 0x3F));
+        out += char(0x80 | ((code_point >> 6) & 0x3F));
+        out += char(0x80 | (code_point & 0x3F));
+    }
+}
+
+/**
+ * @param entity content between '&' and ';'
+ * @return false if entity is unknown or malformed.
+ */
+static bool decode_entity(std::string_view entity, std::string &out) noexcept
+{
+    if (entity == "lt")
+        out += '<';
+    else if (entity == "gt")
+        out += '>';
+    else if (entity == "amp")
+        out += '&';
+    else if (entity == "quot")
+        out += '"';
+    else if (entity == "apos")
+        out += '\'';
+    else if (entity.size() >= 2 && entity[0] == '#') {
+        entity.remove_prefix(1);
+
+        int base = 10;
+        if (entity[0] == 'x') {
+            base = 16;
+            entity.remove_prefix(1);
+        }
+        if (entity.empty() || entity.size() > 8)
+            return false;
+
+        std::uint32_t code_point = 0;
+        for (char c: entity) {
+            unsigned digit;
+            if (c >= '0' && c <= '9')
+                digit = c - '0';
+            else if (base == 16 && c >= 'a' && c <= 'f')
+                digit = c - 'a' + 10;
+            else if (base == 16 && c >= 'A' && c <= 'F')
+                digit = c - 'A' + 10;
+            else
+                return false;
+            code_point = code_point * base + digit;
+        }
+        if (code_point > 0x10FFFF)
+            return false;
+
+        append_utf8(out, code_point);
+    } else
+        return false;
+
+    return true;
+}
+
+auto ServerListParser::decode(std::string_view value, std::string &out) noexcept -> std::string_view
+{
+    auto *amp = static_cast<const char*>(std::memchr(value.data(), '&', value.size()));
+    if (!amp)
+        return value;
+
+    out.clear();
+
+    while (amp) {
+        out.append(value.data(), amp - value.data());
+        value.remove_prefix(amp - value.data());
+
+        auto semicolon = value.find(';');
+        if (semicolon == std::string_view::npos || !decode_entity(value.substr(1, semicolon - 1), out)) {
+            out += '&';
+            value.remove_prefix(1);
+        } else
+            value.remove_prefix(semicolon + 1);
+
+        amp = static_cast<const char*>(std::memchr(value.data(), '&', value.size()));
+    }
+    out.append(value);
+
+    return out;
+}
+
+bool ServerListParser::on_server(std::string_view attrs) noexcept
+{
+    Server server{};
+
+    std::string_view Server::* const fields[] = {
+        &Server::id, &Server::url, &Server::lat, &Server::lon, &Server::name, &Server::sponsor, &Server::country,
+    };
+    static constexpr const std::string_view names[] = {
+        "id", "url", "lat", "lon", "name", "sponsor", "country",
+    };
+    static_assert(sizeof(names) / sizeof(names[0]) == sizeof(decoded) / sizeof(decoded[0]));
+
+    for (;;) {
+        attrs = trim(attrs);
+        if (attrs.empty() || attrs[0] == '/')
+            break;
+
+        auto eq = attrs.find('=');
+        if (eq == std::string_view::npos)
+            break;
+
+        auto name = trim(attrs.substr(0, eq));
+        attrs = trim(attrs.substr(eq + 1));
+
+        if (attrs.empty() || (attrs[0] != '"' && attrs[0] != '\''))
+            break;
+
+        auto closing = attrs.find(attrs[0], 1);
+        if (closing == std::string_view::npos)
+            break;
+
+        auto value = attrs.substr(1, closing - 1);
+        attrs.remove_prefix(closing + 1);
+
+        for (std::size_t i = 0; i != sizeof(names) / sizeof(names[0]); ++i) {
+            if (name == names[i]) {
+                server.*fields[i] = decode(value, decoded[i]);
+                break;
+            }
+        }
+    }
+
+    return callback(server, arg);
+}
+
+bool ServerListParser::on_tag(std::string_view tag) noexcept
+{
+    static constexpr const std::string_view server_tag = "server";
+
+    if (tag.substr(0, server_tag.size()) == server_tag && tag.size() > server_tag.size() &&
+        (is_space(tag[server_tag.size()]) || tag[server_tag.size()] == '/'))
+        return on_server(tag.substr(server_tag.size()));
+
+    if (trim(tag) == "/servers")
+        saw_servers_end = true;
+
+    return true;
+}
+
+bool ServerListParser::feed(const char *data, std::size_t len) noexcept
+{
+    const char *p = data;
+    const char * const end = data + len;
+
+    // Start of the tag in this chunk.
+    const char *tag_start = data;
+
+    auto is_comment = [&]() noexcept
+    {
+        char prefix[3];
+        std::size_t n = 0;
+
+        for (; n != 3 && n != partial.size(); ++n)
+            prefix[n] = partial[n];
+        for (auto *q = tag_start; n != 3 && q != end; ++q)
+            prefix[n++] = *q;
+
+        return n == 3 && std::memcmp(prefix, "!--", 3) == 0;
+    };
+
+    while (p != end) {
+        switch (state) {
+        case State::error:
+            return false;
+
+        case State::text:
+        {
+            auto *lt = static_cast<const char*>(std::memchr(p, '<', end - p));
+            if (!lt)
+                return true;
+
+            p = lt + 1;
+            tag_start = p;
+            partial.clear();
+
+            state = State::tag;
+            break;
+        }
+
+        case State::tag:
+        {
+            auto *q = p;
+            while (q != end && *q != '>' && *q != '"' && *q != '\'')
+                ++q;
+
+            if (q == end) {
+                p = end;
+                break;
+            }
+
+            if (*q != '>') {
+                if (is_comment()) {
+                    // Quotes in comments are not paired.
+                    state = State::comment;
+                    p = q;
+                } else {
+                    quote = *q;
+                    state = State::tag_quoted;
+                    p = q + 1;
+                }
+                break;
+            }
+
+            std::string_view tag;
+            if (partial.empty())
+                tag = std::string_view(tag_start, q - tag_start);
+            else {
+                partial.append(tag_start, q - tag_start);
+                tag = partial;
+            }
+
+            p = q + 1;
+
+            if (tag.substr(0, 3) == "!--" && (tag.size() < 5 || tag.substr(tag.size() - 2) != "--")) {
+                state = State::comment;
+                partial.assign(tag.substr(tag.size() - 2));
+                break;
+            }
+
+            state = State::text;
+            if (!on_tag(tag)) {
+                state = State::error;
+                return false;
+            }
+
+            break;
+        }
+
+        case State::tag_quoted:
+        {
+            auto *q = static_cast<const char*>(std::memchr(p, quote, end - p));
+            if (!q) {
+                p = end;
+                break;
+            }
+
+            p = q + 1;
+            state = State::tag;
+            break;
+        }
+
+        case State::comment:
+        {
+            auto *gt = static_cast<const char*>(std::memchr(p, '>', end - p));
+            if (!gt) {
+                p = end;
+                break;
+            }
+
+            // The 2 chars before '>' might be in partial.
+            char before[2];
+            for (int i = 0; i != 2; ++i) {
+                // Use index, since a pointer before data is undefined.
+                auto index = (gt - data) - 2 + i;
+                auto back = static_cast<std::size_t>(-index);
+
+                if (index >= 0)
+                    before[i] = data[index];
+                else if (back <= partial.size())
+                    before[i] = partial[partial.size() - back];
+                else
+                    before[i] = '\0';
+            }
+
+            p = gt + 1;
+            if (before[0] == '-' && before[1] == '-') {
+                partial.clear();
+                state = State::text;
+            }
+
+            break;
+        }
+        }
+    }
+
+    // Keep the incomplete tag for the next call.
+    switch (state) {
+    case State::tag:
+    case State::tag_quoted:
+        partial.append(tag_start, end - tag_start);
+        if (partial.size() > max_tag_len) {
+            state = State::error;
+            return false;
+        }
+        break;
+
+    case State::comment:
+        // Only the last 2 chars is needed to detect "-->".
+        if (len >= 2)
+            partial.assign(end - 2, 2);
+        else if (len == 1) {
+            if (partial.size() > 1)
+                partial.erase(0, partial.size() - 1);
+            partial += end[-1];
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    return state != State::error;
+}
+} /* namespace speedtest */
@@ -0,0 +1,120 @@
+/**
+ * The classes in this headers utilizes STL but has -fno-exceptions
+ * enabled, thus if STL is out of memory, it will raise SIGABRT.
+ */
+
+#ifndef  __cpp_speedest_speedtest_ServerListParser_HPP__
+# define __cpp_speedest_speedtest_ServerListParser_HPP__
+
+# include <cstddef>
+# include <string>
+# include <string_view>
+
+namespace speedtest {
+/**
+ * Incremental parser of the server list xml, which extracts attributes
+ * of every &lt;server&gt; tag as bytes arrive, without building a DOM or
+ * buffering the whole response.
+ *
+ * Only the tags are parsed, text and unknown tags are skipped.
+ * <br>Tags and closing quotes are located with memchr, which glibc vectorizes.
+ *
+ * @warning all functions is this class is not thread-safe.
+ */
+class ServerListParser {
+public:
+    /**
+     * Attributes of a server, with xml entities decoded.
+     * <br>Missing attributes are empty.
+     *
+     * The views are only valid during the callback.
+     */
+    struct Server {
+        std::string_view id;
+        std::string_view url;
+        std::string_view lat;
+        std::string_view lon;
+        std::string_view name;
+        std::string_view sponsor;
+        std::string_view country;
+    };
+
+    /**
+     * @return false to stop parsing, feed() will then return false.
+     */
+    using callback_t = bool (*)(const Server &server, void *arg) noexcept;
+
+    /**
+     * Tags longer than this is treated as malformed.
+     */
+    static constexpr const std::size_t max_tag_len = 64 * 1024;
+
+protected:
+    enum class State {
+        text,
+        tag,
+        tag_quoted,
+        comment,
+        error,
+    } state = State::text;
+
+    callback_t callback;
+    void *arg;
+
+    /**
+     * Quote char of the attribute value being scanned.
+     */
+    char quote;
+
+    /**
+     * Bytes of the tag being scanned that arrived in previous feed().
+     */
+    std::string partial;
+
+    /**
+     * Used to decode attributes that contains entities.
+     */
+    std::string decoded[7];
+
+    bool saw_servers_end = false;
+
+    /**
+     * @param tag content between '<' and '>'.
+     */
+    bool on_tag(std::string_view tag) noexcept;
+
+    /**
+     * @return false if parse failed or callback returns false.
+     */
+    bool on_server(std::string_view attrs) noexcept;
+
+public:
+    ServerListParser(callback_t callback, void *arg) noexcept;
+
+    /**
+     * Start parsing a new document.
+     */
+    void reset() noexcept;
+
+    /**
+     * @return false if the document is malformed or callback returns false.
+     *         <br>Once false is returned, all following calls would return false.
+     */
+    bool feed(const char *data, std::size_t len) noexcept;
+
+    /**
+     * @return true if &lt;/servers&gt; is seen and no error occured.
+     */
+    bool is_complete() const noexcept;
+
+    /**
+     * Decode xml entities in value.
+     *
+     * @return value if it contains no entities, otherwise out.
+     *         <br>Unknown or malformed entities are kept as-is.
+     */
+    static auto decode(std::string_view value, std::string &out) noexcept -> std::string_view;
+};
+} /* namespace speedtest */
+
+#endif
@@ -0,0 +1,229 @@
+#include "ServerTable.hpp"
+
+namespace speedtest {
+/**
+ * FNV-1a
+ */
+static std::uint64_t hash_str(std::string_view str) noexcept
+{
+    std::uint64_t hash = 0xcbf29ce484222325u;
+    for (unsigned char c: str) {
+        hash ^= c;
+        hash *= 0x100000001b3u;
+    }
+    return hash;
+}
+
+/**
+ * Finalizer of splitmix64, so that sequential ids spread over the table.
+ */
+static std::uint64_t hash_id(std::int64_t id) noexcept
+{
+    auto hash = static_cast<std::uint64_t>(id);
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9u;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebu;
+    return hash ^ (hash >> 31);
+}
+
+/**
+ * @param slots size must be power of 2 and have at least one empty slot.
+ * @return index of the first empty slot probed from hash.
+ */
+static std::size_t find_empty_slot(const std::vector<std::uint32_t> &slots, std::uint64_t hash) noexcept
+{
+    auto mask = slots.size() - 1;
+    auto i = hash & mask;
+    while (slots[i] != 0)
+        i = (i + 1) & mask;
+    return i;
+}
+
+/**
+ * @return power of 2 at least twice of cnt, so that load factor is at most 0.5.
+ */
+static std::size_t get_slots_cnt(std::size_t cnt) noexcept
+{
+    std::size_t slots_cnt = 16;
+    while (slots_cnt < cnt * 2)
+        slots_cnt *= 2;
+    return slots_cnt;
+}
+
+auto ServerTable::append(std::string_view str) noexcept -> std::uint32_t
+{
+    auto offset = arena.size();
+
+    arena.append(str);
+    arena.push_back('\0');
+
+    return offset;
+}
+
+auto ServerTable::intern(std::string_view str) noexcept -> std::uint32_t
+{
+    if ((interned_cnt + 1) * 2 > intern_slots.size()) {
+        std::vector<std::uint32_t> slots(get_slots_cnt(interned_cnt + 1));
+
+        for (auto slot: intern_slots) {
+            if (slot != 0)
+                slots[find_empty_slot(slots, hash_str(arena.data() + slot - 1))] = slot;
+        }
+
+        intern_slots.swap(slots);
+    }
+
+    auto mask = intern_slots.size() - 1;
+    for (auto i = hash_str(str) & mask; ; i = (i + 1) & mask) {
+        auto slot = intern_slots[i];
+
+        if (slot == 0) {
+            auto offset = append(str);
+            intern_slots[i] = offset + 1;
+            ++interned_cnt;
+            return offset;
+        }
+
+        std::uint32_t offset = slot - 1;
+        // Strings in arena are null-terminated, so arena[offset + str.size()] is always valid.
+        if (arena.compare(offset, str.size(), str) == 0 && arena[offset + str.size()] == '\0')
+            return offset;
+    }
+}
+
+void ServerTable::insert_id(Ref ref) noexcept
+{
+    if (ids.size() * 2 > id_slots.size()) {
+        std::vector<std::uint32_t> slots(get_slots_cnt(ids.size()));
+
+        // Insert in order, so that find() returns the first server added with the same id.
+        for (Ref i = 0; i != ids.size(); ++i)
+            slots[find_empty_slot(slots, hash_id(ids[i]))] = i + 1;
+
+        id_slots.swap(slots);
+        return;
+    }
+
+    id_slots[find_empty_slot(id_slots, hash_id(ids[ref]))] = ref + 1;
+}
+
+void ServerTable::reserve(std::size_t servers, std::size_t arena_sz) noexcept
+{
+    ids.reserve(servers);
+    lats.reserve(servers);
+    lons.reserve(servers);
+
+    urls.reserve(servers);
+    names.reserve(servers);
+    sponsors.reserve(servers);
+    countries.reserve(servers);
+
+    arena.reserve(arena_sz);
+}
+
+void ServerTable::clear() noexcept
+{
+    ids.clear();
+    lats.clear();
+    lons.clear();
+
+    urls.clear();
+    names.clear();
+    sponsors.clear();
+    countries.clear();
+
+    arena.clear();
+
+    id_slots.clear();
+    intern_slots.clear();
+    interned_cnt = 0;
+}
+
+auto ServerTable::add(std::int64_t id, std::string_view url, std::string_view name, std::string_view sponsor,
+                      float lat, float lon, std::string_view country) noexcept -> Ref
+{
+    Ref ref = ids.size();
+
+    ids.push_back(id);
+    lats.push_back(lat);
+    lons.push_back(lon);
+
+    urls.push_back(append(url));
+    names.push_back(append(name));
+    sponsors.push_back(intern(sponsor));
+    countries.push_back(intern(country));
+
+    insert_id(ref);
+
+    return ref;
+}
+
+auto ServerTable::add(const ServerTable &servers, Ref ref) noexcept -> Ref
+{
+    return add(servers.get_id(ref), servers.get_url(ref), servers.get_name(ref), servers.get_sponsor(ref),
+               servers.lats[ref], servers.lons[ref], servers.get_country(ref));
+}
+
+auto ServerTable::find(std::int64_t id) const noexcept -> Ref
+{
+    if (id_slots.empty())
+        return npos;
+
+    auto mask = id_slots.size() - 1;
+    for (auto i = hash_id(id) & mask; id_slots[i] != 0; i = (i + 1) & mask) {
+        Ref ref = id_slots[i] - 1;
+        if (ids[ref] == id)
+            return ref;
+    }
+
+    return npos;
+}
+
+auto ServerTable::size() const noexcept -> std::size_t
+{
+    return ids.size();
+}
+bool ServerTable::empty() const noexcept
+{
+    return ids.empty();
+}
+
+auto ServerTable::get_id(Ref ref) const noexcept -> std::int64_t
+{
+    return ids[ref];
+}
+
+auto ServerTable::get_lats() const noexcept -> const float*
+{
+    return lats.data();
+}
+auto ServerTable::get_lons() const noexcept -> const float*
+{
+    return lons.data();
+}
+
+auto ServerTable::get_url(Ref ref) const noexcept -> const char*
+{
+    return arena.data() + urls[ref];
+}
+auto ServerTable::get_name(Ref ref) const noexcept -> const char*
+{
+    return arena.data() + names[ref];
+}
+auto ServerTable::get_sponsor(Ref ref) const noexcept -> const char*
+{
+    return arena.data() + sponsors[ref];
+}
+auto ServerTable::get_country(Ref ref) const noexcept -> const char*
+{
+    return arena.data() + countries[ref];
+}
+
+auto ServerTable::get_arena_size() const noexcept -> std::size_t
+{
+    return arena.size();
+}
+auto ServerTable::get_interned_cnt() const noexcept -> std::size_t
+{
+    return interned_cnt;
+}
+} /* namespace speedtest */
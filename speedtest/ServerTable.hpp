@@ -0,0 +1,130 @@
+/**
+ * The classes in this headers utilizes STL but has -fno-exceptions
+ * enabled, thus if STL is out of memory, it will raise SIGABRT.
+ */
+
+#ifndef  __cpp_speedest_speedtest_ServerTable_HPP__
+# define __cpp_speedest_speedtest_ServerTable_HPP__
+
+# include <cstddef>
+# include <cstdint>
+# include <string>
+# include <string_view>
+# include <vector>
+
+namespace speedtest {
+/**
+ * Flat storage of servers: ids, coordinates and offsets of strings are kept
+ * in contiguous arrays, with all strings null-terminated in one arena.
+ *
+ * Sponsor and country names are interned, since many servers share them.
+ * <br>Servers are referred to by index, which stays valid when the table
+ * is moved or grows.
+ *
+ * @warning all functions is this class is not thread-safe.
+ */
+class ServerTable {
+public:
+    /**
+     * Index of a server in the table.
+     */
+    using Ref = std::uint32_t;
+
+    static constexpr const Ref npos = UINT32_MAX;
+
+protected:
+    std::vector<std::int64_t> ids;
+    std::vector<float> lats;
+    std::vector<float> lons;
+
+    /**
+     * Offsets into arena.
+     */
+    std::vector<std::uint32_t> urls;
+    std::vector<std::uint32_t> names;
+    std::vector<std::uint32_t> sponsors;
+    std::vector<std::uint32_t> countries;
+
+    std::string arena;
+
+    /**
+     * Open addressing hash tables, each slot is 0 if empty,
+     * otherwise the value + 1.
+     */
+    std::vector<std::uint32_t> id_slots;
+    /**
+     * Values are offsets into arena.
+     */
+    std::vector<std::uint32_t> intern_slots;
+    std::size_t interned_cnt = 0;
+
+    auto append(std::string_view str) noexcept -> std::uint32_t;
+    auto intern(std::string_view str) noexcept -> std::uint32_t;
+
+    void insert_id(Ref ref) noexcept;
+
+public:
+    /**
+     * Reserve space for servers servers with arena_sz bytes of strings in total.
+     */
+    void reserve(std::size_t servers, std::size_t arena_sz) noexcept;
+
+    void clear() noexcept;
+
+    /**
+     * @param url, name, sponsor and country must not contain '\0'.
+     * @return ref of the new server.
+     *
+     * Duplicate id is not checked, use find() beforehand if needed.
+     */
+    auto add(std::int64_t id, std::string_view url, std::string_view name, std::string_view sponsor,
+             float lat, float lon, std::string_view country) noexcept -> Ref;
+
+    /**
+     * Append servers[ref] of another table.
+     */
+    auto add(const ServerTable &servers, Ref ref) noexcept -> Ref;
+
+    /**
+     * @return ref of the first server added with id, or npos.
+     */
+    auto find(std::int64_t id) const noexcept -> Ref;
+
+    auto size() const noexcept -> std::size_t;
+    bool empty() const noexcept;
+
+    /**
+     * @pre ref < size(), same for the functions below.
+     */
+    auto get_id(Ref ref) const noexcept -> std::int64_t;
+
+    /**
+     * @return array of size() latitudes in degrees.
+     */
+    auto get_lats() const noexcept -> const float*;
+    /**
+     * @return array of size() longitudes in degrees.
+     */
+    auto get_lons() const noexcept -> const float*;
+
+    /**
+     * The strings returned below are null-terminated and valid until
+     * the table is modified.
+     */
+    auto get_url(Ref ref) const noexcept -> const char*;
+    auto get_name(Ref ref) const noexcept -> const char*;
+    auto get_sponsor(Ref ref) const noexcept -> const char*;
+    auto get_country(Ref ref) const noexcept -> const char*;
+
+    /**
+     * @return bytes used by strings.
+     */
+    auto get_arena_size() const noexcept -> std::size_t;
+    /**
+     * @return number of distinct sponsor and country names.
+     */
+    auto get_interned_cnt() const noexcept -> std::size_t;
+};
+} /* namespace speedtest */
+
+#endif
@@ -0,0 +1,333 @@
+#include "Session.hpp"
+
+#include "../utils/get_unix_timestamp_ms.hpp"
+
+#include <unistd.h>
+
+#include <cstdarg>
+#include <cstring>
+#include <cerrno>
+#include <cinttypes>
+
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <utility>
+
+namespace speedtest {
+Session::Session(Speedtest &speedtest, const Options &options) noexcept:
+    speedtest{speedtest},
+    options{options},
+    config{speedtest}
+{
+    if (options.cache_dir) {
+        config_path = std::string{options.cache_dir} + "/config.bin";
+        servers_path = std::string{options.cache_dir} + "/servers.bin";
+    }
+}
+
+auto Session::get_config() noexcept -> Speedtest::Config&
+{
+    return config;
+}
+
+void Session::log(const char *fmt, ...) noexcept
+{
+    if (options.log != nullptr) {
+        va_list ap;
+        va_start(ap, fmt);
+        std::vfprintf(options.log, fmt, ap);
+        va_end(ap);
+    }
+}
+
+auto Session::refresh_config(clock::time_point now) noexcept -> Ret_except<bool, std::bad_alloc>
+{
+    using Cache_status = Speedtest::Config::Cache_status;
+
+    // The cache is read again on every refresh, in case another process has renewed it.
+    auto status = options.cache_dir ? config.load_config(config_path.c_str(), options.ttl) : Cache_status::invalid;
+
+    if (status == Cache_status::fresh) {
+        log("Using cached configurations\n");
+        config_expiry = now + options.ttl;
+        return true;
+    }
+
+    // An expired cache, or configurations retrieved before, is revalidated
+    // and kept if it is not modified.
+    log(config.config_validators.empty() ? "Retrieving configurations...\n" : "Revalidating configurations...\n");
+
+    if (auto ret = config.get_config(); ret.has_exception_set()) {
+        if (ret.has_exception_type<std::bad_alloc>())
+            return {ret};
+
+        ret.Catch([](const auto &e) noexcept
+        {
+            std::fprintf(stderr, "Failed to retrieve configurations: %s\n", e.what());
+        });
+        return status == Cache_status::expired;
+    }
+
+    config_expiry = now + options.ttl;
+
+    if (options.cache_dir && !config.save_config(config_path.c_str()))
+        std::fprintf(stderr, "Failed to save %s: %s\n", config_path.c_str(), std::strerror(errno));
+
+    return true;
+}
+
+auto Session::refresh_servers(clock::time_point now) noexcept ->
+    Ret_except<void, std::bad_alloc, curl::Exception, curl::libcurl_bug>
+{
+    ServerCache cache;
+    bool has_cache = options.cache_dir && cache.open(servers_path.c_str());
+
+    if (has_cache && !cache.is_expired(options.ttl)) {
+        log("Using cached candidate servers\n");
+
+        auto result = config.get_servers(cache);
+        if (result.has_exception_set())
+            return {result};
+        candidates = std::move(result).get_return_value();
+    } else {
+        log(has_cache ? "Revalidating candidate servers...\n" : "Retrieving candidate servers...\n");
+
+        auto result = config.get_servers(nullptr, nullptr, config.server_list_urls, options.server_list_mode,
+                                         has_cache ? &cache : nullptr);
+        if (result.has_exception_set())
+            return {result};
+        candidates = std::move(result).get_return_value();
+
+        bool saved = true;
+        if (candidates.not_modified)
+            saved = config.save_servers(candidates, servers_path.c_str(), &cache);
+        else if (options.cache_dir && candidates.url_parsed != 0)
+            saved = config.save_servers(candidates, servers_path.c_str());
+
+        if (!saved)
+            std::fprintf(stderr, "Failed to save %s: %s\n", servers_path.c_str(), std::strerror(errno));
+    }
+
+    // Retried on the next refresh, since no test can be run without them.
+    if (candidates.closest_servers.empty())
+        std::fputs("Failed to retrieve any candidate server\n", stderr);
+    else
+        servers_expiry = now + options.ttl;
+
+    return {};
+}
+
+auto Session::refresh() noexcept -> Ret_except<bool, std::bad_alloc, curl::Exception, curl::libcurl_bug>
+{
+    auto now = clock::now();
+
+    if (now >= config_expiry) {
+        bool had_config = has_config;
+        auto position = had_config ? config.client.geolocation.position : Speedtest::Config::GeoPosition{};
+
+        if (auto result = refresh_config(now); result.has_exception_set())
+            return {result};
+        else if (std::move(result).get_return_value())
+            has_config = true;
+        else if (!had_config)
+            return false;
+
+        // closest_servers is sorted by distance to the old position.
+        const auto &new_position = config.client.geolocation.position;
+        if (!had_config || position.lat != new_position.lat || position.lon != new_position.lon)
+            servers_expiry = now;
+    }
+
+    if (now >= servers_expiry) {
+        if (auto result = refresh_servers(now); result.has_exception_set())
+            return {result};
+    }
+
+    return true;
+}
+
+static void log_transfer_result(FILE *log, const char *name, const Speedtest::Transfer_result &result) noexcept
+{
+    if (log == nullptr)
+        return;
+
+    double cpu_per_byte = result.bytes == 0 ? 0 : double(result.cpu_ns) / double(result.bytes);
+
+    std::fprintf(log, "%s: %u concurrent transfers over %" PRIu64 " new connections, %.3f cpu ns/byte\n",
+                 name, result.connections, result.new_connections, cpu_per_byte);
+}
+
+auto Session::run_once(SpeedtestResult &result) noexcept ->
+    Ret_except<bool, std::bad_alloc, curl::Exception, curl::libcurl_bug>
+{
+    if (candidates.closest_servers.empty())
+        return false;
+
+    auto start = clock::now();
+
+    result.timestamp_ms = utils::get_unix_timestamp_ms();
+    result.client = config.client;
+    result.distance = candidates.shortest_distance;
+
+    log("Testing for best server...\n");
+
+    auto best_server = config.get_best_server(candidates);
+    if (best_server.has_exception_set())
+        return {best_server};
+
+    auto [best_server_refs, latency] = std::move(best_server).get_return_value();
+    if (best_server_refs.empty())
+        return false;
+
+    result.latency = latency;
+    result.ping = (latency.median + 500) / 1000;
+
+    auto server_ref = best_server_refs.front();
+    auto server = candidates[server_ref];
+
+    result.server_id = server.server_id;
+    result.server_name = server.server_name;
+    result.sponsor_name = server.sponsor_name;
+
+    urls.clear();
+    url_ptrs.clear();
+
+    // ranked_servers.front() has the same latency as server,
+    // so always put server first.
+    urls.emplace_back(server.url);
+
+    for (const auto &[ranked_ref, ranked_latency]: candidates.ranked_servers) {
+        if (urls.size() == options.servers_cnt)
+            break;
+        if (ranked_ref == server_ref)
+            continue;
+
+        auto ranked = candidates[ranked_ref];
+        log("Adding server %ld (%s, %s) with median latency %" PRIu64 " us\n",
+            ranked.server_id, ranked.sponsor_name, ranked.server_name, ranked_latency.median);
+        urls.emplace_back(ranked.url);
+    }
+
+    for (const auto &url: urls)
+        url_ptrs.push_back(url.c_str());
+
+    auto download = speedtest.download(config, url_ptrs);
+    if (download.has_exception_set())
+        return {download};
+    auto download_result = std::move(download).get_return_value();
+
+    result.download_speed = download_result.speed;
+    result.raw_download_speed = download_result.raw_speed;
+    result.download_latency = download_result.loaded_latency;
+
+    auto upload = speedtest.upload(config, url_ptrs);
+    if (upload.has_exception_set())
+        return {upload};
+    auto upload_result = std::move(upload).get_return_value();
+
+    result.upload_speed = upload_result.speed;
+    result.raw_upload_speed = upload_result.raw_speed;
+    result.upload_latency = upload_result.loaded_latency;
+
+    result.duration_ms = std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - start).count();
+
+    log_transfer_result(options.log, "Download", download_result);
+    log_transfer_result(options.log, "Upload", upload_result);
+
+    if (urls.size() > 1) {
+        for (std::size_t i = 0; i != urls.size(); ++i)
+            log("Server %zu: download speed = %zu (raw %zu), upload speed = %zu (raw %zu)\n",
+                i, download_result.servers[i].speed, download_result.servers[i].raw_speed,
+                upload_result.servers[i].speed, upload_result.servers[i].raw_speed);
+    }
+
+    return true;
+}
+
+/**
+ * Print ret if it has curl::Exception set, which only fails the current test
+ * instead of leaving the session in an undefined state.
+ *
+ * @param what is printed as "Failed to <what>".
+ * @return false if ret has any other exception set, which is left as-is.
+ */
+template <class Ret>
+static bool catch_transient(Ret &ret, const char *what) noexcept
+{
+    if (!ret.template has_exception_type<curl::Exception>())
+        return false;
+
+    ret.Catch([&](const auto &e) noexcept
+    {
+        std::fprintf(stderr, "Failed to %s: %s\n", what, e.what());
+    });
+    return true;
+}
+
+/**
+ * @return false if shutdown_event happens before deadline.
+ */
+static bool sleep_until(Session::clock::time_point deadline, const utils::ShutdownEvent &shutdown_event) noexcept
+{
+    for (;;) {
+        if (shutdown_event.has_event())
+            return false;
+
+        auto now = Session::clock::now();
+        if (now >= deadline)
+            return true;
+
+        // Sleep in slices, so that a signal delivered right before
+        // sleep_for does not delay the shutdown until deadline.
+        std::this_thread::sleep_for(std::min<Session::clock::duration>(deadline - now, std::chrono::seconds{1}));
+    }
+}
+
+auto Session::run(const Schedule &schedule, Result_sink &sink, const utils::ShutdownEvent &shutdown_event) noexcept ->
+    Ret_except<void, std::bad_alloc, curl::Exception, curl::libcurl_bug>
+{
+    std::minstd_rand gen{static_cast<std::minstd_rand::result_type>(utils::get_unix_timestamp_ms() ^ getpid())};
+    std::uniform_int_distribution<std::chrono::milliseconds::rep> jitter_dist{
+        0, std::chrono::duration_cast<std::chrono::milliseconds>(schedule.jitter).count()
+    };
+
+    auto interval = std::max<clock::duration>(schedule.interval, std::chrono::seconds{1});
+    auto slot = clock::now();
+
+    SpeedtestResult result;
+
+    for (;;) {
+        if (!sleep_until(slot + std::chrono::milliseconds{jitter_dist(gen)}, shutdown_event))
+            break;
+
+        if (auto refreshed = refresh(); refreshed.has_exception_set()) {
+            if (!catch_transient(refreshed, "refresh configurations or candidate servers"))
+                return {refreshed};
+        } else if (!std::move(refreshed).get_return_value())
+            std::fputs("No configurations available, test skipped\n", stderr);
+        else if (auto ran = run_once(result); shutdown_event.has_event()) {
+            // A test interrupted in the middle is incomplete, and so is any error from it.
+            if (ran.has_exception_set())
+                ran.Catch([](const auto&) noexcept {});
+            break;
+        } else if (ran.has_exception_set()) {
+            if (!catch_transient(ran, "run test"))
+                return {ran};
+        } else if (!std::move(ran).get_return_value())
+            std::fputs("No candidate server available, test skipped\n", stderr);
+        else if (!sink.write(result))
+            std::fprintf(stderr, "Failed to write result: %s\n", std::strerror(errno));
+
+        auto now = clock::now();
+        do {
+            slot += interval;
+        } while (slot <= now);
+    }
+
+    if (!sink.flush())
+        std::fprintf(stderr, "Failed to flush results: %s\n", std::strerror(errno));
+
+    return {};
+}
+} /* namespace speedtest */
@@ -0,0 +1,171 @@
+/**
+ * The classes in this headers utilizes STL but has -fno-exceptions
+ * enabled, thus if STL is out of memory, it will raise SIGABRT.
+ */
+
+#ifndef  __cpp_speedest_speedtest_Session_HPP__
+# define __cpp_speedest_speedtest_Session_HPP__
+
+# include "../utils/ShutdownEvent.hpp"
+
+# include "speedtest.hpp"
+# include "SpeedtestResult.hpp"
+# include "Result_sink.hpp"
+
+# include <cstdio>
+# include <chrono>
+# include <string>
+# include <vector>
+
+namespace speedtest {
+/**
+ * Keep Speedtest::Config and the candidate servers resident across tests,
+ * so that a long-running process only retrieves them again once they expire.
+ *
+ * @warning all functions is this class is not thread-safe.
+ *
+ * This class has no cp/mv ctor/assignment.
+ */
+class Session {
+public:
+    using clock = std::chrono::steady_clock;
+
+    struct Options {
+        /**
+         * Test against this many servers with lowest latency at once.
+         */
+        unsigned servers_cnt = 1;
+
+        Speedtest::Config::Server_list_mode server_list_mode = Speedtest::Config::Server_list_mode::first_success;
+
+        /**
+         * If not null, configurations and server lists are cached in this directory,
+         * so that they can be shared with other processes and survive restart.
+         * <br>Otherwise, they are kept in memory only and server lists are
+         * retrieved again in full once expired.
+         */
+        const char *cache_dir = nullptr;
+        /**
+         * How long configurations and server lists are used before refreshed.
+         */
+        std::chrono::seconds ttl{3600};
+
+        /**
+         * Progress is printed to log, set to nullptr to disable.
+         */
+        FILE *log = stdout;
+    };
+
+    struct Schedule {
+        /**
+         * Time between the scheduled start of consecutive tests, at least 1s.
+         * <br>If a test overruns, the slots it covers are skipped instead of
+         * being run back to back.
+         */
+        std::chrono::seconds interval;
+        /**
+         * Each test starts at a random delay in [0, jitter] after its slot,
+         * so that processes started together do not test at the same time.
+         */
+        std::chrono::seconds jitter{0};
+    };
+
+protected:
+    Speedtest &speedtest;
+    Options options;
+
+    Speedtest::Config config;
+    Speedtest::Config::Candidate_servers candidates;
+
+    std::string config_path;
+    std::string servers_path;
+
+    /**
+     * Expired at construction, so that the first refresh() retrieves both.
+     */
+    clock::time_point config_expiry{};
+    clock::time_point servers_expiry{};
+
+    /**
+     * Set once configurations are loaded from cache or retrieved,
+     * config must not be used before that.
+     */
+    bool has_config = false;
+
+    /**
+     * Reused by run_once.
+     */
+    std::vector<std::string> urls;
+    std::vector<const char*> url_ptrs;
+
+    void log(const char *fmt, ...) noexcept;
+
+    /**
+     * @return false if configurations are neither loaded from cache nor retrieved,
+     *         the error is printed.
+     *         <br>If they are loaded from an expired cache but cannot be revalidated,
+     *         true is returned and they are revalidated again on the next call.
+     */
+    auto refresh_config(clock::time_point now) noexcept -> Ret_except<bool, std::bad_alloc>;
+    auto refresh_servers(clock::time_point now) noexcept ->
+        Ret_except<void, std::bad_alloc, curl::Exception, curl::libcurl_bug>;
+
+public:
+    /**
+     * @param speedtest must be kept around until Session is destroyed.
+     */
+    Session(Speedtest &speedtest, const Options &options) noexcept;
+
+    Session(const Session&) = delete;
+    Session(Session&&) = delete;
+
+    Session& operator = (const Session&) = delete;
+    Session& operator = (Session&&) = delete;
+
+    /**
+     * Can be used to tune config before the first test.
+     */
+    auto get_config() noexcept -> Speedtest::Config&;
+
+    /**
+     * Retrieve configurations and candidate servers if they have expired.
+     * <br>If the client has moved, candidate servers are refreshed as well.
+     *
+     * Failure to retrieve configurations is printed and retried on the next call,
+     * with the ones retrieved before kept.
+     * <br>Same for candidate servers, except that exceptions from get_servers
+     * are returned.
+     *
+     * @return false if no configurations has ever been loaded, in which case
+     *         candidate servers are not refreshed and no test can be run.
+     *         <br>If std::bad_alloc, then the session is in an undefined state.
+     */
+    auto refresh() noexcept -> Ret_except<bool, std::bad_alloc, curl::Exception, curl::libcurl_bug>;
+
+    /**
+     * Pick the best servers among candidates and test download and upload against them.
+     *
+     * @return false if there is no candidate server to test against,
+     *         in which case result is left unspecified.
+     *         <br>If std::bad_alloc, then the session is in an undefined state.
+     */
+    auto run_once(SpeedtestResult &result) noexcept ->
+        Ret_except<bool, std::bad_alloc, curl::Exception, curl::libcurl_bug>;
+
+    /**
+     * refresh() and run_once() on schedule and write every result to sink,
+     * until shutdown_event happens.
+     *
+     * A test interrupted by shutdown_event is not written.
+     * <br>sink is flushed before returning.
+     *
+     * curl::Exception from refresh() or run_once(), e.g. the network is down,
+     * is printed and only that test is skipped.
+     * <br>std::bad_alloc and curl::libcurl_bug are returned.
+     */
+    auto run(const Schedule &schedule, Result_sink &sink, const utils::ShutdownEvent &shutdown_event) noexcept ->
+        Ret_except<void, std::bad_alloc, curl::Exception, curl::libcurl_bug>;
+};
+} /* namespace speedtest */
+
+#endif
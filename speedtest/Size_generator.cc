@@ -0,0 +1,19 @@
+#include "Size_generator.hpp"
+
+namespace speedtest {
+Size_generator::Size_generator(const unsigned *sizes, std::size_t n, unsigned repeat) noexcept:
+    sizes{sizes}, n{n}, repeat{repeat}
+{}
+
+unsigned Size_generator::operator () () noexcept
+{
+    if (repeat == 0)
+        return 0;
+
+    auto i = next.fetch_add(1, std::memory_order_relaxed) / repeat;
+    if (i >= n)
+        return 0;
+
+    return sizes[i];
+}
+} /* namespace speedtest */
@@ -0,0 +1,42 @@
+#ifndef  __cpp_speedest_speedtest_Size_generator_HPP__
+# define __cpp_speedest_speedtest_Size_generator_HPP__
+
+# include <cstddef>
+# include <atomic>
+
+namespace speedtest {
+/**
+ * Generate sizes of transfers for download and upload:
+ * each of sizes[0], sizes[1], ..., sizes[n - 1] is repeated for repeat times.
+ *
+ * It is lock-free and can be shared by multiple threads.
+ */
+class Size_generator {
+    const unsigned *sizes;
+    std::size_t n;
+    unsigned repeat;
+
+    std::atomic<std::size_t> next{0};
+
+public:
+    /**
+     * @param sizes must be kept around until Size_generator is destroyed.
+     */
+    Size_generator(const unsigned *sizes, std::size_t n, unsigned repeat) noexcept;
+
+    Size_generator(const Size_generator&) = delete;
+    Size_generator(Size_generator&&) = delete;
+
+    Size_generator& operator = (const Size_generator&) = delete;
+    Size_generator& operator = (Size_generator&&) = delete;
+
+    /**
+     * @return 0 if all sizes are generated.
+     *
+     * Thread-safe.
+     */
+    unsigned operator () () noexcept;
+};
+} /* namespace speedtest */
+
+#endif
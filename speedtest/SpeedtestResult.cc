@@ -1,14 +1,205 @@
 #include "SpeedtestResult.hpp"
+#include "../utils/Output_buffer.hpp"
+
+#include <cstring>
+
+#include <algorithm>
+#include <string_view>
 
 namespace speedtest {
-/*
+using utils::Output_buffer;
+
+auto SpeedtestResult::format_csv(char *buffer, std::size_t size, const char *delimiter) const noexcept ->
+    std::size_t
+{
+    std::string_view delim = delimiter;
+    Output_buffer out{buffer, size};
+
+    out.append_int(server_id);
+    out.append(delim);
+    out.append_csv_field(sponsor_name, delim);
+    out.append(delim);
+    out.append_csv_field(server_name, delim);
+    out.append(delim);
+    out.append_timestamp(timestamp_ms);
+    out.append(delim);
+    out.append_float(distance);
+    out.append(delim);
+    out.append_float(latency.median / 1000.0);
+    out.append(delim);
+    out.append_int(std::uint64_t{download_speed} * 8);
+    out.append(delim);
+    out.append_int(std::uint64_t{upload_speed} * 8);
+    out.append(delim);
+    out.append_csv_field(share_url, delim);
+    out.append(delim);
+    out.append_csv_field(client.ip, delim);
+    out.append('\n');
+
+    return out.len;
+}
+
+auto SpeedtestResult::format_csv_header(char *buffer, std::size_t size, const char *delimiter) noexcept ->
+    std::size_t
+{
+    static constexpr const char *names[] = {
+        "Server ID", "Sponsor", "Server Name", "Timestamp", "Distance", "Ping", "Download", "Upload", "Share",
+        "IP Address",
+    };
+
+    Output_buffer out{buffer, size};
+
+    for (const auto *name: names) {
+        if (name != names[0])
+            out.append(delimiter);
+        out.append(name);
+    }
+    out.append('\n');
+
+    return out.len;
+}
+
+static void append_json_latency(Output_buffer &out, const LatencySampler::Stats &latency) noexcept
+{
+    out.append("{\"min\":");
+    out.append_int(latency.min);
+    out.append(",\"median\":");
+    out.append_int(latency.median);
+    out.append(",\"p90\":");
+    out.append_int(latency.p90);
+    out.append(",\"p99\":");
+    out.append_int(latency.p99);
+    out.append(",\"jitter\":");
+    out.append_int(latency.jitter);
+    out.append(",\"probes\":");
+    out.append_int(latency.probes);
+    out.append(",\"failed\":");
+    out.append_int(latency.failed);
+    out.append('}');
+}
+
+auto SpeedtestResult::format_json(char *buffer, std::size_t size) const noexcept -> std::size_t
+{
+    Output_buffer out{buffer, size};
+
+    out.append("{\"timestamp\":");
+    out.append_int(timestamp_ms);
+    out.append(",\"duration_ms\":");
+    out.append_int(duration_ms);
+
+    out.append(",\"server\":{\"id\":");
+    out.append_int(server_id);
+    out.append(",\"sponsor\":");
+    out.append_json_str(sponsor_name);
+    out.append(",\"name\":");
+    out.append_json_str(server_name);
+    out.append(",\"distance\":");
+    out.append_float(distance);
+    out.append('}');
+
+    out.append(",\"ping\":");
+    out.append_int(ping);
+    out.append(",\"latency\":");
+    append_json_latency(out, latency);
+
+    out.append(",\"download\":{\"speed\":");
+    out.append_int(download_speed);
+    out.append(",\"raw_speed\":");
+    out.append_int(raw_download_speed);
+    out.append(",\"latency\":");
+    append_json_latency(out, download_latency);
+    out.append('}');
+
+    out.append(",\"upload\":{\"speed\":");
+    out.append_int(upload_speed);
+    out.append(",\"raw_speed\":");
+    out.append_int(raw_upload_speed);
+    out.append(",\"latency\":");
+    append_json_latency(out, upload_latency);
+    out.append('}');
+
+    out.append(",\"client\":{\"ip\":");
+    out.append_json_str(client.ip);
+    out.append(",\"isp\":");
+    out.append_json_str(client.isp);
+    out.append(",\"country\":");
+    out.append_json_str(client.geolocation.country);
+    out.append('}');
+
+    out.append(",\"share_url\":");
+    out.append_json_str(share_url);
+    out.append("}\n");
+
+    return out.len;
+}
+
+/**
+ * Store the lowest bytes of value in little endian.
+ */
+static char* put_le(char *p, std::uint64_t value, std::size_t bytes) noexcept
+{
+    for (std::size_t i = 0; i != bytes; ++i)
+        p[i] = static_cast<char>(value >> (8 * i));
+    return p + bytes;
+}
+
+static char* put_latency(char *p, const LatencySampler::Stats &latency) noexcept
+{
+    auto saturate = [](std::uint64_t value) noexcept
+    {
+        return std::min<std::uint64_t>(value, UINT32_MAX);
+    };
+
+    p = put_le(p, saturate(latency.median), 4);
+    p = put_le(p, saturate(latency.p90), 4);
+    p = put_le(p, saturate(latency.p99), 4);
+    p = put_le(p, saturate(latency.jitter), 4);
+    p = put_le(p, saturate(latency.probes), 4);
+    return put_le(p, saturate(latency.failed), 4);
+}
+
+auto SpeedtestResult::format_binary(char *buffer, std::size_t size) const noexcept -> std::size_t
+{
+    static_assert(sizeof(client.ip) == 46);
+
+    if (size < binary_record_size)
+        return binary_record_size;
+
+    std::memset(buffer, 0, binary_record_size);
+
+    float distance_f = distance;
+    std::uint32_t distance_bits;
+    std::memcpy(&distance_bits, &distance_f, sizeof(distance_bits));
+
+    char *p = buffer;
+    std::memcpy(p, binary_magic, sizeof(binary_magic));
+    p += sizeof(binary_magic);
+    p = put_le(p, binary_version, 2);
+    p = put_le(p, binary_record_size, 2);
+    p = put_le(p, timestamp_ms, 8);
+    p = put_le(p, static_cast<std::uint64_t>(server_id), 8);
+    p = put_le(p, download_speed, 8);
+    p = put_le(p, upload_speed, 8);
+    p = put_le(p, raw_download_speed, 8);
+    p = put_le(p, raw_upload_speed, 8);
+    p = put_le(p, distance_bits, 4);
+    p = put_le(p, std::min<std::uint64_t>(ping, UINT32_MAX), 4);
+    p = put_latency(p, latency);
+    p = put_latency(p, download_latency);
+    p = put_latency(p, upload_latency);
+
+    std::memcpy(p, client.ip, strnlen(client.ip, sizeof(client.ip)));
+
+    return binary_record_size;
+}
+
 auto SpeedtestResult::to_csv_str(const char *delimiter) const noexcept -> std::string
 {
     std::string csv;
 
-    csv.append("");
+    csv.resize(format_csv(nullptr, 0, delimiter));
+    format_csv(csv.data(), csv.size(), delimiter);
 
     return csv;
 }
-*/
 } /* namespace speedtest */
@@ -8,17 +8,51 @@
 
 # include "speedtest.hpp"
 
+# include <cstddef>
+# include <cstdint>
+# include <string>
+
 namespace speedtest {
 struct SpeedtestResult {
+    /**
+     * Unix timestamp in ms when the test starts.
+     */
+    std::uint64_t timestamp_ms;
+    /**
+     * Time taken by the whole test in ms, including picking the best server.
+     */
+    std::uint64_t duration_ms;
+
+    /**
+     * Speed in bytes per second, with warm-up excluded.
+     */
     std::size_t download_speed;
     std::size_t upload_speed;
 
+    /**
+     * Speed in bytes per second, with warm-up included.
+     */
+    std::size_t raw_download_speed;
+    std::size_t raw_upload_speed;
+
     /**
      * The server should be the one returned by config.get_best_server(candidates).get_return_value()
      */
 
     double distance;
+    /**
+     * Median latency of the server in ms, rounded.
+     */
     std::size_t ping;
+    /**
+     * Latency of the server measured by get_best_server, in us.
+     */
+    LatencySampler::Stats latency;
+    /**
+     * Latency of the server measured while download/upload is running, in us.
+     */
+    LatencySampler::Stats download_latency;
+    LatencySampler::Stats upload_latency;
 
     typename Speedtest::Config::Server_id server_id;
     std::string server_name;
@@ -30,8 +64,65 @@ struct SpeedtestResult {
     std::string share_url;
 
     /**
-     * Return server id, server sponsor, server name, unix timestamp in iso, 
-     * distance, ping, download speed, upload speed, share_url, ip
+     * The format_* functions below write the record into buffer without
+     * any heap allocation, and never write more than size bytes.
+     *
+     * @return length of the whole record, which is not null-terminated.
+     *         <br>If it is larger than size, the record is truncated and
+     *         the caller should retry with a buffer at least that large.
+     */
+
+    /**
+     * Write server id, server sponsor, server name, timestamp in ISO 8601,
+     * distance in km, ping in ms, download speed and upload speed in bit/s, 
+     * share_url and ip, terminated by '\n'.
+     *
+     * Fields that contain delimiter, '"' or newline are quoted as in RFC 4180.
+     */
+    auto format_csv(char *buffer, std::size_t size, const char *delimiter = ",") const noexcept -> std::size_t;
+    /**
+     * Write names of the fields written by format_csv, terminated by '\n'.
+     */
+    static auto format_csv_header(char *buffer, std::size_t size, const char *delimiter = ",") noexcept -> 
+        std::size_t;
+
+    /**
+     * Write every field as a JSON object on one line, terminated by '\n'.
+     */
+    auto format_json(char *buffer, std::size_t size) const noexcept -> std::size_t;
+
+    /**
+     * Fixed-layout record in little endian:
+     *
+     *     offset  size  field
+     *          0     4  magic "SPDR"
+     *          4     2  version
+     *          6     2  size of the record
+     *          8     8  timestamp_ms
+     *         16     8  server_id
+     *         24     8  download_speed
+     *         32     8  upload_speed
+     *         40     8  raw_download_speed
+     *         48     8  raw_upload_speed
+     *         56     4  distance as IEEE 754 float
+     *         60     4  ping
+     *         64    24  latency
+     *         88    24  download_latency
+     *        112    24  upload_latency
+     *        136    46  client.ip, padded with '\0'
+     *        182     2  padding
+     *
+     * Each latency is 6 uint32: median, p90, p99, jitter in us,
+     * saturated at UINT32_MAX, then probes and failed.
+     */
+    static constexpr const char binary_magic[4] = {'S', 'P', 'D', 'R'};
+    static constexpr const std::uint16_t binary_version = 1;
+    static constexpr const std::size_t binary_record_size = 184;
+
+    auto format_binary(char *buffer, std::size_t size) const noexcept -> std::size_t;
+
+    /**
+     * Same as format_csv, but return the record as std::string.
      */
     auto to_csv_str(const char *delimiter = ",") const noexcept -> std::string;
 };
@@ -0,0 +1,113 @@
+#include "ThroughputSampler.hpp"
+
+#include <algorithm>
+
+namespace chrono = std::chrono;
+
+namespace speedtest {
+ThroughputSampler::ThroughputSampler(clock::duration interval) noexcept:
+    interval{interval}
+{}
+
+void ThroughputSampler::start(clock::duration expected_len) noexcept
+{
+    samples.clear();
+    samples.reserve(expected_len / interval + 2);
+
+    start_time = clock::now();
+
+    samples.push_back({0, 0, 0});
+}
+
+void ThroughputSampler::sample(std::uint64_t bytes, std::uint64_t failed) noexcept
+{
+    auto ns = chrono::duration_cast<chrono::nanoseconds>(clock::now() - start_time).count();
+
+    samples.push_back({static_cast<std::uint64_t>(ns), bytes, failed});
+}
+
+auto ThroughputSampler::get_interval() const noexcept -> clock::duration
+{
+    return interval;
+}
+auto ThroughputSampler::get_samples() const noexcept -> const std::vector<Sample>&
+{
+    return samples;
+}
+auto ThroughputSampler::get_bytes() const noexcept -> std::uint64_t
+{
+    return samples.back().bytes - samples.back().failed;
+}
+
+auto ThroughputSampler::get_rate(const Sample &begin, const Sample &end) noexcept -> double
+{
+    if (end.ns == begin.ns)
+        return 0;
+
+    // A transfer counted before begin may fail in between.
+    auto bytes = static_cast<double>(end.bytes - begin.bytes) - static_cast<double>(end.failed - begin.failed);
+    return std::max(bytes, 0.0) / static_cast<double>(end.ns - begin.ns);
+}
+
+auto ThroughputSampler::get_throughput(std::size_t first) const noexcept -> std::size_t
+{
+    if (first + 1 >= samples.size())
+        return 0;
+
+    // get_rate uses double, since bytes * 10^9 can easily overflow std::uint64_t.
+    return get_rate(samples[first], samples.back()) * 1e9;
+}
+
+auto ThroughputSampler::find_steady_state(const Warmup &warmup) const noexcept -> std::size_t
+{
+    using Mode = Warmup::Mode;
+
+    // Keep at least 2 samples for get_throughput
+    if (samples.size() <= 2)
+        return 0;
+    auto last = samples.size() - 2;
+
+    switch (warmup.mode) {
+    case Mode::none:
+        return 0;
+
+    case Mode::fixed:
+    {
+        auto ramp_ns = static_cast<std::uint64_t>(chrono::duration_cast<chrono::nanoseconds>(warmup.ramp).count());
+        for (std::size_t i = 0; i <= last; ++i) {
+            if (samples[i].ns >= ramp_ns)
+                return i;
+        }
+        return 0;
+    }
+
+    case Mode::plateau:
+    {
+        std::size_t window = warmup.window == 0 ? 1 : warmup.window;
+
+        auto get_window_rate = [&](std::size_t i) noexcept
+        {
+            return get_rate(samples[i], samples[i + window]);
+        };
+
+        /**
+         * Steady state begins at the first window whose rate is not exceeded
+         * by the rate of the following window by more than tolerance.
+         *
+         * The last 2 windows is reserved, so that there's always something
+         * to measure after warm-up.
+         */
+        for (std::size_t i = 0; i + 3 * window < samples.size(); i += window) {
+            auto curr = get_window_rate(i);
+            auto next = get_window_rate(i + window);
+
+            if (curr > 0 && next <= curr * (1 + warmup.tolerance))
+                return i;
+        }
+        return 0;
+    }
+    }
+
+    return 0;
+}
+} /* namespace speedtest */
@@ -0,0 +1,138 @@
+/**
+ * The classes in this headers utilizes STL but has -fno-exceptions
+ * enabled, thus if STL is out of memory, it will raise SIGABRT.
+ */
+
+#ifndef  __cpp_speedest_speedtest_ThroughputSampler_HPP__
+# define __cpp_speedest_speedtest_ThroughputSampler_HPP__
+
+# include <cstddef>
+# include <cstdint>
+# include <chrono>
+# include <vector>
+
+namespace speedtest {
+/**
+ * Record total bytes transfered at a fixed interval, so that throughput
+ * can be calculated in nanosecond resolution from bytes that are still
+ * in-flight, instead of from completed transfers only.
+ *
+ * @warning all functions is this class is not thread-safe.
+ */
+class ThroughputSampler {
+public:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr const auto default_interval = std::chrono::milliseconds{50};
+
+    struct Sample {
+        /**
+         * Nanoseconds elapsed since start() is called.
+         */
+        std::uint64_t ns;
+        /**
+         * Bytes transfered since start() is called.
+         */
+        std::uint64_t bytes;
+        /**
+         * Bytes among bytes of transfers that failed since start() is called.
+         * <br>They are counted in bytes as they arrive, and only known to be
+         * failed once the transfer is done, so they are subtracted when
+         * rates are computed instead of being removed from bytes.
+         */
+        std::uint64_t failed;
+    };
+
+    /**
+     * How to detect the end of warm-up (DNS, TCP/TLS handshake and TCP slow start).
+     */
+    struct Warmup {
+        enum class Mode {
+            /**
+             * Use all samples.
+             */
+            none,
+            /**
+             * Discard samples taken in the first ramp.
+             */
+            fixed,
+            /**
+             * Discard samples until throughput of consecutive windows
+             * stop rising by more than tolerance.
+             */
+            plateau,
+        } mode = Mode::plateau;
+
+        /**
+         * Used by Mode::fixed.
+         */
+        clock::duration ramp = std::chrono::seconds{2};
+
+        /**
+         * Used by Mode::plateau, number of intervals in a window.
+         */
+        unsigned window = 4;
+        /**
+         * Used by Mode::plateau, relative change of throughput between
+         * consecutive windows that is considered as steady.
+         */
+        double tolerance = 0.1;
+    };
+
+protected:
+    clock::duration interval;
+
+    clock::time_point start_time;
+
+    std::vector<Sample> samples;
+
+public:
+    /**
+     * @param interval should be > 0.
+     */
+    ThroughputSampler(clock::duration interval = default_interval) noexcept;
+
+    /**
+     * Discard all samples and start sampling, with first sample (0, 0, 0) taken.
+     *
+     * @param expected_len used to reserve space for samples.
+     */
+    void start(clock::duration expected_len = {}) noexcept;
+
+    /**
+     * Should be called every interval, and once all transfer is done.
+     *
+     * @param bytes transfered since start() is called.
+     * @param failed bytes among bytes of transfers that failed since start() is called.
+     *               <br>Both must not be less than those of the last sample.
+     */
+    void sample(std::uint64_t bytes, std::uint64_t failed = 0) noexcept;
+
+    auto get_interval() const noexcept -> clock::duration;
+    auto get_samples() const noexcept -> const std::vector<Sample>&;
+    /**
+     * @return bytes of the last sample that are not failed.
+     */
+    auto get_bytes() const noexcept -> std::uint64_t;
+
+    /**
+     * @return bytes per nanosecond between begin and end that are not failed,
+     *         0 if more bytes failed than transfered in between.
+     */
+    static auto get_rate(const Sample &begin, const Sample &end) noexcept -> double;
+
+    /**
+     * @return bytes per second between samples[first] and the last sample.
+     *         <br>0 if there's no sample after samples[first].
+     */
+    auto get_throughput(std::size_t first = 0) const noexcept -> std::size_t;
+
+    /**
+     * @return index of the first sample in steady state.
+     *         <br>If steady state isn't detected, 0 is returned so that all samples are used.
+     */
+    auto find_steady_state(const Warmup &warmup) const noexcept -> std::size_t;
+};
+} /* namespace speedtest */
+
+#endif
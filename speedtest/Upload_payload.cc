@@ -0,0 +1,85 @@
+#include "Upload_payload.hpp"
+
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+namespace speedtest {
+void Upload_payload::Free_deleter::operator () (char *p) const noexcept
+{
+    std::free(p);
+}
+
+bool Upload_payload::init(Kind kind) noexcept
+{
+    if (data && this->kind == kind)
+        return true;
+
+    auto period = kind == Kind::alphabet ? chars.size() : random_period;
+
+    static constexpr const std::size_t alignment = 64;
+    auto size = prefix.size() + period + max_chunk;
+    size = (size + alignment - 1) / alignment * alignment;
+
+    auto *p = static_cast<char*>(std::aligned_alloc(alignment, size));
+    if (!p)
+        return false;
+
+    std::memcpy(p, prefix.data(), prefix.size());
+    auto *pattern = p + prefix.size();
+
+    if (kind == Kind::alphabet) {
+        for (std::size_t i = 0; i != period; ++i)
+            pattern[i] = chars[i];
+    } else {
+        // xorshift64*, the payload only has to be incompressible, not unpredictable.
+        std::uint64_t state = 0x9E3779B97F4A7C15u;
+        for (std::size_t i = 0; i < period; i += sizeof(std::uint64_t)) {
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+            auto val = state * 0x2545F4914F6CDD1Du;
+
+            std::memcpy(pattern + i, &val, sizeof(val));
+        }
+    }
+
+    // Repeat the pattern so that max_chunk bytes from any offset in period is contiguous.
+    for (std::size_t i = period; i < period + max_chunk; ) {
+        auto n = std::min(i, period + max_chunk - i);
+        std::memcpy(pattern + i, pattern, n);
+        i += n;
+    }
+
+    this->kind = kind;
+    this->period = period;
+    data.reset(p);
+
+    return true;
+}
+
+void Upload_payload::read(char *buffer, std::size_t offset, std::size_t len) const noexcept
+{
+    const auto *pattern = data.get() + prefix.size();
+
+    if (offset < prefix.size()) {
+        auto n = std::min(len, prefix.size() - offset);
+        std::memcpy(buffer, data.get() + offset, n);
+
+        buffer += n;
+        offset += n;
+        len -= n;
+    }
+
+    auto i = (offset - prefix.size()) % period;
+    while (len != 0) {
+        auto n = std::min(len, max_chunk);
+        std::memcpy(buffer, pattern + i, n);
+
+        buffer += n;
+        len -= n;
+
+        i = (i + n) % period;
+    }
+}
+} /* namespace speedtest */
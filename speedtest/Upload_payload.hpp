@@ -0,0 +1,79 @@
+#ifndef  __cpp_speedest_speedtest_Upload_payload_HPP__
+# define __cpp_speedest_speedtest_Upload_payload_HPP__
+
+# include <cstddef>
+# include <cstdlib>
+# include <memory>
+# include <string_view>
+
+namespace speedtest {
+/**
+ * Request body of upload, generated once into an aligned, read-only buffer
+ * so that serving a read callback is a bulk copy.
+ *
+ * The body is prefix followed by a pattern that repeats every period bytes.
+ */
+class Upload_payload {
+public:
+    static constexpr const std::string_view prefix{"content1="};
+    static constexpr const std::string_view chars = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+    enum class Kind {
+        /**
+         * chars repeated, which is what speedtest.net sends.
+         */
+        alphabet,
+        /**
+         * Pseudo random bytes, which cannot be compressed by middleboxes.
+         */
+        random,
+    };
+
+    /**
+     * Max number of bytes copied in one memcpy, equal to CURL_MAX_READ_SIZE.
+     */
+    static constexpr const std::size_t max_chunk = 512 * 1024;
+
+    /**
+     * Period of the pattern of Kind::random.
+     */
+    static constexpr const std::size_t random_period = 1024 * 1024;
+
+protected:
+    struct Free_deleter {
+        void operator () (char *p) const noexcept;
+    };
+
+    Kind kind = Kind::alphabet;
+    std::size_t period = 0;
+
+    /**
+     * prefix, then period + max_chunk bytes of pattern, so that any
+     * max_chunk bytes of the body starting at pattern offset [0, period)
+     * is contiguous.
+     */
+    std::unique_ptr<char, Free_deleter> data;
+
+public:
+    Upload_payload() = default;
+
+    Upload_payload(Upload_payload&&) = default;
+    Upload_payload& operator = (Upload_payload&&) = default;
+
+    /**
+     * Generate the payload if it isn't generated or kind is different.
+     *
+     * @return false if out of memory.
+     */
+    bool init(Kind kind = Kind::alphabet) noexcept;
+
+    /**
+     * @pre init() is called and succeeds.
+     *
+     * Copy bytes [offset, offset + len) of body into buffer.
+     */
+    void read(char *buffer, std::size_t offset, std::size_t len) const noexcept;
+};
+} /* namespace speedtest */
+
+#endif
@@ -1,14 +1,22 @@
 #include "speedtest.hpp"
 
 #include "../curl-cpp/curl_easy.hpp"
+#include "../curl-cpp/curl_multi.hpp"
 
 #include "../utils/type_name.hpp"
 #include "../utils/split2int.hpp"
 #include "../utils/strncpy.hpp"
 #include "../utils/affix.hpp"
 #include "../utils/dirname.hpp"
-#include "../utils/geo_distance.hpp"
 #include "../utils/get_unix_timestamp_ms.hpp"
+#include "../utils/geo_distance.hpp"
+#include "../utils/write_file_atomic.hpp"
+
+#include "ServerListParser.hpp"
+
+#include <curl/curl.h>
+
+#include <strings.h>
 
 #include <cerrno>
 
@@ -16,12 +24,17 @@
 
 #include <cstring>
 #include <cstdio>
+#include <cstdlib>
 #include <cinttypes>
+#include <limits>
 
 #include <string_view>
+#include <charconv>
+#include <vector>
 #include <memory>
 #include <new>
 #include <utility>
+#include <algorithm>
 
 // Feature tuning
 #define PUGIXML_HEADER_ONLY
@@ -40,6 +53,11 @@ namespace speedtest {
 Speedtest::Config::Config(Speedtest &speedtest_arg) noexcept:
     speedtest{speedtest_arg}
 {}
+Speedtest::Config::~Config()
+{
+    if (easy)
+        speedtest.release_easy(std::move(easy));
+}
 
 Speedtest::Config::xml_parse_error::xml_parse_error(const char *error_msg):
     Exception{""},
@@ -50,22 +68,6 @@ const char* Speedtest::Config::xml_parse_error::what() const noexcept
     return error;
 }
 
-Speedtest::Config::Candidate_servers::Server::Server(Server_id server_id,
-                                                     std::unique_ptr<char[]> &&url, 
-                                                     std::string &&server_name, 
-                                                     std::string &&sponsor_name, 
-                                                     GeoPosition pos, 
-                                                     std::string &&country_name) noexcept:
-    server_id{server_id},
-    url{std::move(url)},
-
-    server_name{std::move(server_name)},
-    sponsor_name{std::move(sponsor_name)},
-
-    position{pos},
-    country_name{std::move(country_name)}
-{}
-
 auto Speedtest::Config::get_easy_ref() noexcept -> curl::Easy_ref_t
 {
     if (!easy)
@@ -90,6 +92,162 @@ void Speedtest::Config::Candidate_servers::Server::append_dirname_url(const char
         built_url.append(common_pattern.substr(0, 15));
     }
 }
+void Speedtest::Config::Candidate_servers::Server::append_latency_url(const char *url, std::string &built_url) 
+    noexcept
+{
+    static constexpr const std::string_view query_prefix = "/latency.txt?x=";
+    // the 20-byte is for the unix timestamp in ms 
+    // plus trailing '.'.
+    char url_params[20 + 1 + 1];
+
+    std::snprintf(url_params, sizeof(url_params), "%" PRIu64 ".", utils::get_unix_timestamp_ms());
+
+    append_dirname_url(url, built_url);
+
+    built_url.append(query_prefix);
+    built_url.append(url_params);
+}
+void Speedtest::Config::Candidate_servers::Server::append_image_name(unsigned size, std::string &built_url) 
+    noexcept
+{
+    char name[image_name_sz];
+
+    // to_chars instead of snprintf, since this is called for every transfer of download.
+    auto *end = std::to_chars(name, name + 10, size).ptr;
+    *end++ = 'x';
+    end = std::to_chars(end, end + 10, size).ptr;
+    std::memcpy(end, ".jpg", 4);
+    end += 4;
+
+    built_url.append(name, end - name);
+}
+
+auto Speedtest::Config::Candidate_servers::operator [] (Server_ref ref) const noexcept -> Server
+{
+    return {
+        servers.get_id(ref),
+        servers.get_url(ref),
+        servers.get_name(ref),
+        servers.get_sponsor(ref),
+        GeoPosition{servers.get_lats()[ref], servers.get_lons()[ref]},
+        servers.get_country(ref),
+    };
+}
+
+void Speedtest::Config::Candidate_servers::build_index() noexcept
+{
+    index.build(servers.get_lats(), servers.get_lons(), servers.size());
+}
+
+auto Speedtest::Config::Candidate_servers::get_nearest(GeoPosition position, std::size_t k) const noexcept -> 
+    Nearby_servers
+{
+    std::vector<GeoIndex::Result> results;
+    index.k_nearest(position.lat, position.lon, k, results);
+
+    Nearby_servers nearby;
+    nearby.reserve(results.size());
+    for (const auto &result: results)
+        nearby.emplace_back(result.index, result.distance);
+
+    return nearby;
+}
+auto Speedtest::Config::Candidate_servers::get_within(GeoPosition position, double radius) const noexcept -> 
+    Nearby_servers
+{
+    std::vector<GeoIndex::Result> results;
+    index.within(position.lat, position.lon, radius, results);
+
+    Nearby_servers nearby;
+    nearby.reserve(results.size());
+    for (const auto &result: results)
+        nearby.emplace_back(result.index, result.distance);
+
+    return nearby;
+}
+
+bool Speedtest::Config::Validators::empty() const noexcept
+{
+    return etag.empty() && last_modified.empty();
+}
+
+using Slist_t = Speedtest::Slist_t;
+
+/**
+ * @param headers set to If-None-Match and If-Modified-Since built from etag and 
+ *                last_modified, or nullptr if both are empty.
+ * @return false if out of memory.
+ */
+static bool make_conditional_headers(std::string_view etag, std::string_view last_modified, Slist_t &headers) 
+    noexcept
+{
+    headers.reset();
+
+    std::string header;
+    auto append = [&](std::string_view name, std::string_view value) noexcept
+    {
+        if (value.empty())
+            return true;
+
+        header.assign(name);
+        header.append(value);
+
+        auto *list = curl_slist_append(headers.get(), header.c_str());
+        if (!list)
+            return false;
+
+        headers.release();
+        headers.reset(list);
+
+        return true;
+    };
+
+    return append("If-None-Match: ", etag) && append("If-Modified-Since: ", last_modified);
+}
+
+/**
+ * CURLOPT_HEADERFUNCTION that collects validators of the last response 
+ * into arg, which must be Speedtest::Config::Validators*.
+ */
+static std::size_t on_header(char *buffer, std::size_t size, std::size_t nitems, void *arg) noexcept
+{
+    auto &validators = *static_cast<Speedtest::Config::Validators*>(arg);
+    auto bytes = size * nitems;
+
+    std::string_view line{buffer, bytes};
+
+    // Every response, including redirects and 1xx, starts with a status line.
+    if (utils::has_prefix(line, "HTTP/")) {
+        validators.etag.clear();
+        validators.last_modified.clear();
+        return bytes;
+    }
+
+    auto colon = line.find(':');
+    if (colon == std::string_view::npos)
+        return bytes;
+
+    auto name = line.substr(0, colon);
+    auto value = line.substr(colon + 1);
+
+    while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+        value.remove_prefix(1);
+    while (!value.empty() && (value.back() == ' ' || value.back() == '\t' || 
+                              value.back() == '\r' || value.back() == '\n'))
+        value.remove_suffix(1);
+
+    auto is_name = [&](std::string_view expected) noexcept
+    {
+        return name.size() == expected.size() && strncasecmp(name.data(), expected.data(), name.size()) == 0;
+    };
+
+    if (is_name("ETag"))
+        validators.etag.assign(value);
+    else if (is_name("Last-Modified"))
+        validators.last_modified.assign(value);
+
+    return bytes;
+}
 
 static auto xml2geoposition(pugi::xml_node &xml_node)
 {
@@ -119,10 +277,41 @@ auto Speedtest::Config::get_config() noexcept -> Ret
      */
     response.reserve(13700);
 
-    if (auto result = easy_ref.perform(); result.has_exception_set())
+    Slist_t headers;
+    if (!make_conditional_headers(config_validators.etag, config_validators.last_modified, headers))
+        return {std::bad_alloc{}};
+
+    Validators validators;
+
+    curl_easy_setopt(easy_ref.curl_easy, CURLOPT_HTTPHEADER, headers.get());
+    curl_easy_setopt(easy_ref.curl_easy, CURLOPT_HEADERFUNCTION, on_header);
+    curl_easy_setopt(easy_ref.curl_easy, CURLOPT_HEADERDATA, &validators);
+
+    auto result = easy_ref.perform();
+
+    // headers and validators do not outlive this call.
+    curl_easy_setopt(easy_ref.curl_easy, CURLOPT_HTTPHEADER, nullptr);
+    curl_easy_setopt(easy_ref.curl_easy, CURLOPT_HEADERFUNCTION, nullptr);
+    curl_easy_setopt(easy_ref.curl_easy, CURLOPT_HEADERDATA, nullptr);
+
+    if (result.has_exception_set())
         return {result};
 
-    if (auto response_code = easy_ref.get_response_code(); response_code != 200) {
+    auto response_code = easy_ref.get_response_code();
+
+    if (response_code == 304 && headers) {
+        speedtest.debug("In %s, speedtest-config.php is not modified\n", __PRETTY_FUNCTION__);
+
+        // A 304 response may carry updated validators.
+        if (!validators.etag.empty())
+            config_validators.etag = std::move(validators.etag);
+        if (!validators.last_modified.empty())
+            config_validators.last_modified = std::move(validators.last_modified);
+
+        return curl::Easy_ref_t::code::ok;
+    }
+
+    if (response_code != 200) {
         char buffer[64];
         std::snprintf(buffer, 64, "Get response code %ld", response_code);
         return {Error_Response_code{buffer}};
@@ -181,17 +370,261 @@ auto Speedtest::Config::get_config() noexcept -> Ret
     client.isp_dlavg  = client_xml.attribute("ispdlavg").as_float();
     client.isp_ulavg  = client_xml.attribute("ispulavg").as_float();
 
+    config_validators = std::move(validators);
+
     return curl::Easy_ref_t::code::ok;
 }
 
+/**
+ * Layout of the file written by save_config, followed by ignore_cnt ids
+ * of ignore_servers, then etag_len bytes of etag and last_modified_len bytes
+ * of last_modified of config_validators.
+ *
+ * It is written in native byte order and is not meant to be shared
+ * between machines.
+ */
+struct Config_cache_header {
+    static constexpr const char magic_v[8] = {'S', 'P', 'D', 'T', 'C', 'O', 'N', 'F'};
+    static constexpr const std::uint32_t version_v = 2;
+    static constexpr const std::uint32_t byte_order_v = 0x01020304;
+
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    /**
+     * Unix timestamp in ms when the file is written.
+     */
+    std::uint64_t created_ms;
+
+    unsigned char upload_start;
+    Speedtest::Config::Counts counts;
+    Speedtest::Config::Threads threads;
+    Speedtest::Config::Length length;
+    unsigned upload_max;
+    Speedtest::Config::Client client;
+
+    std::uint64_t ignore_cnt;
+    std::uint32_t etag_len;
+    std::uint32_t last_modified_len;
+};
+
+bool Speedtest::Config::save_config(const char *path) const noexcept
+{
+    Config_cache_header header{};
+
+    std::memcpy(header.magic, header.magic_v, sizeof(header.magic));
+    header.version = header.version_v;
+    header.byte_order = header.byte_order_v;
+    header.created_ms = utils::get_unix_timestamp_ms();
+
+    header.upload_start = sizes.upload_start;
+    header.counts = counts;
+    header.threads = threads;
+    header.length = length;
+    header.upload_max = upload_max;
+    header.client = client;
+
+    header.ignore_cnt = ignore_servers.size();
+    header.etag_len = config_validators.etag.size();
+    header.last_modified_len = config_validators.last_modified.size();
+
+    std::string buffer;
+    buffer.reserve(sizeof(header) + ignore_servers.size() * sizeof(std::int64_t) + 
+                   header.etag_len + header.last_modified_len);
+
+    buffer.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (std::int64_t server_id: ignore_servers)
+        buffer.append(reinterpret_cast<const char*>(&server_id), sizeof(server_id));
+
+    buffer.append(config_validators.etag);
+    buffer.append(config_validators.last_modified);
+
+    return utils::write_file_atomic(path, buffer.data(), buffer.size());
+}
+
+auto Speedtest::Config::load_config(const char *path, std::chrono::seconds ttl) noexcept -> Cache_status
+{
+    auto *file = std::fopen(path, "rb");
+    if (!file)
+        return Cache_status::invalid;
+
+    std::string buffer;
+    char chunk[4096];
+    for (std::size_t n; (n = std::fread(chunk, 1, sizeof(chunk), file)) != 0; )
+        buffer.append(chunk, n);
+
+    bool has_error = std::ferror(file);
+    std::fclose(file);
+
+    Config_cache_header header;
+    if (has_error || buffer.size() < sizeof(header))
+        return Cache_status::invalid;
+
+    std::memcpy(&header, buffer.data(), sizeof(header));
+
+    if (std::memcmp(header.magic, header.magic_v, sizeof(header.magic)) != 0 || 
+        header.version != header.version_v || header.byte_order != header.byte_order_v)
+        return Cache_status::invalid;
+
+    auto ids_size = buffer.size() - sizeof(header) - header.etag_len - header.last_modified_len;
+    if (buffer.size() < sizeof(header) + header.etag_len + header.last_modified_len ||
+        ids_size / sizeof(std::int64_t) != header.ignore_cnt || ids_size % sizeof(std::int64_t) != 0)
+        return Cache_status::invalid;
+
+    ignore_servers.clear();
+    for (std::size_t i = 0; i != header.ignore_cnt; ++i) {
+        std::int64_t server_id;
+        std::memcpy(&server_id, buffer.data() + sizeof(header) + i * sizeof(server_id), sizeof(server_id));
+        ignore_servers.emplace(server_id);
+    }
+
+    const char *validators = buffer.data() + sizeof(header) + ids_size;
+    config_validators.etag.assign(validators, header.etag_len);
+    config_validators.last_modified.assign(validators + header.etag_len, header.last_modified_len);
+
+    sizes.upload_start = header.upload_start;
+    counts = header.counts;
+    threads = header.threads;
+    length = header.length;
+    upload_max = header.upload_max;
+    client = header.client;
+
+    // Strings in a corrupted file might not be null-terminated.
+    client.ip[sizeof(client.ip) - 1] = '\0';
+    client.geolocation.country[sizeof(client.geolocation.country) - 1] = '\0';
+    client.isp[sizeof(client.isp) - 1] = '\0';
+
+    auto now = utils::get_unix_timestamp_ms();
+    // A file from the future is treated as expired, in case the clock is adjusted.
+    if (now < header.created_ms || now - header.created_ms > static_cast<std::uint64_t>(ttl.count()) * 1000)
+        return Cache_status::expired;
+
+    return Cache_status::fresh;
+}
+
+/**
+ * @return true if server_id should not be added to Candidate_servers by get_servers.
+ */
+static bool is_filtered(Speedtest::Config::Server_id server_id,
+                        const std::set<Speedtest::Config::Server_id> *servers_include_p,
+                        const std::set<Speedtest::Config::Server_id> *servers_exclude_p,
+                        const std::set<Speedtest::Config::Server_id> &ignore_servers) noexcept
+{
+    if (servers_include_p && servers_include_p->size() != 0 && !servers_include_p->count(server_id))
+        return true;
+    if (servers_exclude_p && servers_exclude_p->count(server_id))
+        return true;
+    return ignore_servers.count(server_id);
+}
+
+/**
+ * One server list being fetched by get_servers.
+ */
+struct Server_list_fetch {
+    using Server = Speedtest::Config::Candidate_servers::Server;
+    using Server_id = Speedtest::Config::Server_id;
+
+    const std::set<Server_id> *servers_include_p;
+    const std::set<Server_id> *servers_exclude_p;
+    const std::set<Server_id> *ignore_servers_p;
+
+    /**
+     * Url passed to get_servers.
+     */
+    const char *url;
+
+    curl::Easy_t easy;
+    bool in_multi = false;
+
+    /**
+     * Conditional request headers, nullptr if the request is unconditional.
+     */
+    Slist_t headers;
+    /**
+     * Validators of the response, collected by on_header.
+     */
+    Speedtest::Config::Validators validators;
+    bool not_modified = false;
+
+    ServerListParser parser;
+
+    /**
+     * Servers parsed so far, in the order they appear.
+     * <br>Only merged into candidates once the whole list is parsed.
+     */
+    ServerTable servers;
+    /**
+     * Reused to build url of each server.
+     */
+    std::string url_buffer;
+
+    Server_list_fetch() noexcept:
+        parser{on_server, this}
+    {}
+
+    static bool on_server(const ServerListParser::Server &server, void *arg) noexcept;
+    static std::size_t on_data(char *buffer, std::size_t size, std::size_t nitems, void *arg) noexcept;
+};
+
+bool Server_list_fetch::on_server(const ServerListParser::Server &server, void *arg) noexcept
+{
+    auto &fetch = *static_cast<Server_list_fetch*>(arg);
+
+    Server_id server_id = 0;
+    std::from_chars(server.id.data(), server.id.data() + server.id.size(), server_id);
+
+    if (is_filtered(server_id, fetch.servers_include_p, fetch.servers_exclude_p, *fetch.ignore_servers_p))
+        return true;
+
+    static constexpr const auto &common_pattern = Server::common_pattern;
+    std::string_view url = server.url;
+
+    bool is_common_pattern = utils::has_suffix(url, common_pattern);
+    if (is_common_pattern)
+        url.remove_suffix(common_pattern.size()); // Remove common_pattern off the url
+
+    if (utils::has_prefix(url, "http")) {
+        url.remove_prefix(4);
+        if (url[0] == 's')
+            url.remove_prefix(1);
+        url.remove_prefix(3); // Remove '://'
+    }
+
+    auto &url_buffer = fetch.url_buffer;
+    url_buffer.assign(1, static_cast<char>(is_common_pattern + 1));
+    url_buffer.append(url);
+
+    // strtof requires null-terminated string.
+    auto to_float = [](std::string_view str) noexcept
+    {
+        char buffer[32];
+        utils::strncpy(buffer, std::min(sizeof(buffer), str.size() + 1), str.data());
+        return std::strtof(buffer, nullptr);
+    };
+
+    fetch.servers.add(server_id, url_buffer, server.name, server.sponsor, 
+                      to_float(server.lat), to_float(server.lon), server.country);
+
+    return true;
+}
+
+std::size_t Server_list_fetch::on_data(char *buffer, std::size_t size, std::size_t nitems, void *arg) noexcept
+{
+    auto &fetch = *static_cast<Server_list_fetch*>(arg);
+    auto bytes = size * nitems;
+
+    // Returning less than bytes aborts the transfer.
+    return fetch.parser.feed(buffer, bytes) ? bytes : 0;
+}
+
 auto Speedtest::Config::get_servers(const std::set<Server_id> *servers_include_p, 
                                     const std::set<Server_id> *servers_exclude_p, 
-                                    const char * const urls[]) noexcept ->
-    Ret_except<Candidate_servers, std::bad_alloc>
+                                    const char * const urls[],
+                                    Server_list_mode mode,
+                                    const ServerCache *cache) noexcept ->
+    Ret_except<Candidate_servers, std::bad_alloc, curl::Exception, curl::libcurl_bug>
 {
-    auto easy_ref = get_easy_ref();
-    if (!easy_ref.curl_easy)
-        return {std::bad_alloc{}};
+    using Easy_ref_t = curl::Easy_ref_t;
 
     // Built query
     // ?threads=number
@@ -204,187 +637,551 @@ auto Speedtest::Config::get_servers(const std::set<Server_id> *servers_include_p
     speedtest.reserve_built_url(49 + query.size());
 
     Candidate_servers candidates;
+    candidates.shortest_distance = std::numeric_limits<float>::max();
+
+    std::size_t urls_cnt = 0;
+    while (urls[urls_cnt] != nullptr)
+        ++urls_cnt;
+
+    if (urls_cnt == 0)
+        return candidates;
+
+    curl::Multi_t multi;
+    if (auto result = speedtest.create_multi(); result.has_exception_set())
+        return {result};
+    else
+        multi = std::move(result).get_return_value();
 
-    std::set<Server_id> known_servers;
+    std::vector<Server_list_fetch> fetches(urls_cnt);
+
+    auto release_easies = [&]() noexcept
+    {
+        for (auto &fetch: fetches) {
+            if (!fetch.easy)
+                continue;
+
+            if (fetch.in_multi) {
+                auto easy_ref = Easy_ref_t{fetch.easy.get()};
+                multi.remove_easy(easy_ref);
+                fetch.in_multi = false;
+            }
+            speedtest.release_easy(std::move(fetch.easy));
+        }
+    };
+
+    auto merge = [&](Server_list_fetch &fetch) noexcept
+    {
+        auto &servers = candidates.servers;
+
+        for (ServerTable::Ref ref = 0; ref != fetch.servers.size(); ++ref) {
+            if (servers.find(fetch.servers.get_id(ref)) == ServerTable::npos)
+                servers.add(fetch.servers, ref);
+        }
+
+        fetch.servers = ServerTable{};
+
+        candidates.validators.emplace_back(fetch.url, std::move(fetch.validators));
+    };
+
+    bool oom = false;
+    bool done = false;
 
     /**
-     * On my machine, the maximum response I get from server_list_urls
-     * with '?thread=4' is 221658, thus reserve 222000.
+     * Number of lists that are not modified since cache is written.
      */
-    response.reserve(222000);
-    easy_ref.set_readall_writeback(response);
+    std::size_t not_modified_cnt = 0;
 
-    for (std::size_t i = 0; urls[i] != nullptr; ++i) {
-        if (auto result = speedtest.set_url(easy_ref, {urls[i], query}); result.has_exception_set())
-            return {result};
+    auto perform_callback = [&](Easy_ref_t &easy_ref, Easy_ref_t::perform_ret_t perform_ret, 
+                                curl::Multi_t &multi, void*) noexcept
+    {
+        auto &fetch = *static_cast<Server_list_fetch*>(easy_ref.get_private());
 
-        response.clear();
+        multi.remove_easy(easy_ref);
+        fetch.in_multi = false;
+
+        if (done || oom) {
+            perform_ret.Catch([](const auto&) noexcept {});
+            return;
+        }
 
-        if (auto result = speedtest.perform_and_check(easy_ref, __PRETTY_FUNCTION__); 
+        if (fetch.headers && !perform_ret.has_exception_set() && easy_ref.get_response_code() == 304) {
+            speedtest.debug("In %s, server list retrieved from %s is not modified\n", 
+                            __PRETTY_FUNCTION__, easy_ref.getinfo_effective_url());
+
+            fetch.not_modified = true;
+            ++not_modified_cnt;
+            if (mode == Server_list_mode::first_success)
+                done = true;
+            return;
+        }
+
+        if (auto result = speedtest.perform_and_check(easy_ref, perform_ret, __PRETTY_FUNCTION__); 
             result.has_exception_set())
-            return {result};
-        else if (!result)
-            continue;
+        {
+            oom = true;
+            result.Catch([](const auto&) noexcept {});
+            return;
+        } else if (!result)
+            return;
+
+        if (!fetch.parser.is_complete()) {
+            speedtest.error("Failed to parse server list retrieved from %s\n", easy_ref.getinfo_effective_url());
+            return;
+        }
 
-        pugi::xml_document doc;
+        merge(fetch);
 
-        // The following line requies CharT* std::string::data() noexcept; (Since C++17)
-        if (auto result = doc.load_buffer_inplace(response.data(), response.size()); !result) {
-            speedtest.error("pugixml failed to parse xml retrieved from %s: %s\n",
-                            easy_ref.getinfo_effective_url(), result.description());
-            continue;
+        ++candidates.url_parsed;
+        if (mode == Server_list_mode::first_success)
+            done = true;
+    };
+
+    for (std::size_t i = 0; i != urls_cnt; ++i) {
+        auto &fetch = fetches[i];
+
+        fetch.easy = speedtest.create_easy();
+        if (!fetch.easy) {
+            release_easies();
+            return {std::bad_alloc{}};
         }
 
-        candidates.shortest_distance = std::numeric_limits<float>::max();
-        auto servers_xml = doc.child("settings").child("servers");
-        for (auto &&server_xml: servers_xml.children("server")) {
-            auto server_id = server_xml.attribute("id").as_llong();
+        auto easy_ref = Easy_ref_t{fetch.easy.get()};
 
-            if (known_servers.count(server_id))
-                continue;
-            if (servers_include_p && servers_include_p->size() != 0 && !servers_include_p->count(server_id))
-                continue;
-            if (servers_exclude_p && servers_exclude_p->count(server_id))
-                continue;
-            if (ignore_servers.count(server_id))
-                continue;
+        if (auto result = speedtest.set_url(easy_ref, {urls[i], query}); result.has_exception_set()) {
+            release_easies();
+            return {result};
+        }
 
-            known_servers.emplace(server_id);
+        fetch.url = urls[i];
+        fetch.servers_include_p = servers_include_p;
+        fetch.servers_exclude_p = servers_exclude_p;
+        fetch.ignore_servers_p = &ignore_servers;
+
+        std::string_view etag, last_modified;
+        if (cache && cache->find_validators(urls[i], etag, last_modified) && 
+            !make_conditional_headers(etag, last_modified, fetch.headers)) 
+        {
+            release_easies();
+            return {std::bad_alloc{}};
+        }
 
-            static constexpr const auto &common_pattern = Candidate_servers::Server::common_pattern;
-            std::string_view url = server_xml.attribute("url").value();
+        curl_easy_setopt(easy_ref.curl_easy, CURLOPT_HTTPHEADER, fetch.headers.get());
+        curl_easy_setopt(easy_ref.curl_easy, CURLOPT_HEADERFUNCTION, on_header);
+        curl_easy_setopt(easy_ref.curl_easy, CURLOPT_HEADERDATA, &fetch.validators);
 
-            bool is_common_pattern = utils::has_suffix(url, common_pattern);
-            if (is_common_pattern)
-                url.remove_suffix(common_pattern.size()); // Remove common_pattern off the url
+        // Servers are parsed as they arrive, instead of buffering the whole response.
+        easy_ref.set_writeback(Server_list_fetch::on_data, &fetch);
 
-            if (utils::has_prefix(url, "http")) {
-                url.remove_prefix(4);
-                if (url[0] == 's')
-                    url.remove_prefix(1);
-                url.remove_prefix(3); // Remove '://'
-            }
+        easy_ref.set_private(&fetch);
 
-            auto url_ptr = std::unique_ptr<char[]>{new (std::nothrow) char[1 + url.size() + 1]};
-            if (!url_ptr)
+        multi.add_easy(easy_ref);
+        fetch.in_multi = true;
+    }
+
+    for (;;) {
+        do {
+            if (auto result = multi.perform(perform_callback, nullptr); result.has_exception_set()) {
+                release_easies();
+                return {result};
+            }
+            if (oom) {
+                release_easies();
                 return {std::bad_alloc{}};
+            }
+            if (done)
+                // Cancel the rest of the transfers.
+                break;
+        } while (multi.break_or_poll().get_return_value() != -1);
+
+        if (mode != Server_list_mode::merge_all || not_modified_cnt == 0 || candidates.url_parsed == 0)
+            break;
+
+        // Some lists are modified, and servers of lists that are not modified 
+        // cannot be told apart in cache, so retrieve them again unconditionally.
+        for (auto &fetch: fetches) {
+            if (!fetch.not_modified)
+                continue;
+
+            fetch.not_modified = false;
+            fetch.headers.reset();
+            fetch.parser.reset();
+
+            auto easy_ref = Easy_ref_t{fetch.easy.get()};
+            curl_easy_setopt(easy_ref.curl_easy, CURLOPT_HTTPHEADER, nullptr);
 
-            url_ptr[0] = char{is_common_pattern} + 1;
-            utils::strncpy(url_ptr.get() + 1, url.size() + 1, url.data());
+            multi.add_easy(easy_ref);
+            fetch.in_multi = true;
+        }
+        not_modified_cnt = 0;
+    }
 
-            auto position = xml2geoposition(server_xml);
+    release_easies();
 
-            candidates.servers.emplace_front(server_id, 
-                                             std::move(url_ptr), 
-                                             server_xml.attribute("name").value(),
-                                             server_xml.attribute("sponsor").value(),
-                                             position, 
-                                             server_xml.attribute("country").value());
+    if (not_modified_cnt != 0 && candidates.url_parsed == 0) {
+        auto result = get_servers(*cache, servers_include_p, servers_exclude_p);
+        if (result.has_exception_set()) {
+            // The only exception is std::bad_alloc.
+            result.Catch([](const auto&) noexcept {});
+            return {std::bad_alloc{}};
+        }
 
-            auto d = utils::geo_distance(position.lat, position.lon, 
-                                         client.geolocation.position.lat, client.geolocation.position.lon);
+        auto cached = std::move(result).get_return_value();
+        cached.not_modified = true;
 
-            if (d > candidates.shortest_distance)
+        // A 304 response may carry updated validators, the rest are kept as recorded in cache.
+        for (std::size_t i = 0; i != urls_cnt; ++i) {
+            std::string_view etag, last_modified;
+            if (!cache->find_validators(urls[i], etag, last_modified))
                 continue;
 
-            if (d < candidates.shortest_distance) {
-                candidates.shortest_distance = d;
-                candidates.closest_servers.clear();
-            }
-            candidates.closest_servers.emplace_back(candidates.servers.begin());
+            auto &fetch = fetches[i];
+            auto &validators = cached.validators.emplace_back(urls[i], Validators{}).second;
+
+            if (fetch.not_modified && !fetch.validators.etag.empty())
+                validators.etag = std::move(fetch.validators.etag);
+            else
+                validators.etag.assign(etag);
+
+            if (fetch.not_modified && !fetch.validators.last_modified.empty())
+                validators.last_modified = std::move(fetch.validators.last_modified);
+            else
+                validators.last_modified.assign(last_modified);
         }
 
-        ++candidates.url_parsed;
+        return cached;
     }
 
+    candidates.build_index();
+
+    auto nearest = candidates.get_nearest(client.geolocation.position, nearest_servers);
+
+    candidates.closest_servers.reserve(nearest.size());
+    for (const auto &[server_ref, distance]: nearest)
+        candidates.closest_servers.push_back(server_ref);
+
+    if (!nearest.empty())
+        candidates.shortest_distance = nearest.front().second;
+
     return candidates;
 }
 
-auto Speedtest::Config::get_best_server(Candidate_servers &candidates) noexcept ->
-    Ret_except<std::pair<std::vector<Candidate_servers::Server_ref>, std::size_t>, std::bad_alloc>
+bool Speedtest::Config::save_servers(const Candidate_servers &candidates, const char *path,
+                                     const ServerCache *cache) noexcept
 {
-    auto easy_ref = get_easy_ref();
-    if (!easy_ref.curl_easy)
-        return {std::bad_alloc{}};
+    ServerCache::Writer writer;
 
-    static constexpr const std::string_view query_prefix = "/latency.txt?x=";
-    // the 20-byte is for the unix timestamp in ms 
-    // plus trailing '.'.
-    char url_params[20 + 1 + 1];
+    for (const auto &[url, validators]: candidates.validators)
+        writer.add_validators(url, validators.etag, validators.last_modified);
 
-    // The longest element of servers I observed is 69-byte long
-    // the additional byte is for the trail_num
-    speedtest.reserve_built_url(69 + query_prefix.size() + sizeof(url_params) + 1);
+    if (candidates.not_modified)
+        return cache->write_revalidated(path, writer);
 
-    easy_ref.set_writeback(Speedtest::null_writeback, nullptr);
+    for (Candidate_servers::Server_ref ref = 0; ref != candidates.servers.size(); ++ref) {
+        auto server = candidates[ref];
+        writer.add(server.server_id, server.url, server.server_name, server.sponsor_name, 
+                   server.position.lat, server.position.lon, server.country_name);
+    }
 
-    // Disable all compression methods.
-    if (auto result = easy_ref.set_encoding(nullptr); result.has_exception_set())
-        return {result};
+    return writer.write(path);
+}
+
+auto Speedtest::Config::get_servers(const ServerCache &cache,
+                                    const std::set<Server_id> *servers_include_p, 
+                                    const std::set<Server_id> *servers_exclude_p) noexcept ->
+    Ret_except<Candidate_servers, std::bad_alloc>
+{
+    using Field = ServerCache::Field;
+
+    Candidate_servers candidates;
+    candidates.shortest_distance = std::numeric_limits<float>::max();
+
+    auto n = cache.size();
+    const auto *lats = cache.get_lats();
+    const auto *lons = cache.get_lons();
+
+    const auto &position = client.geolocation.position;
+
+    // Servers are not indexed in the cache, since a batch of distances
+    // over the whole list is cheaper than building the index.
+    std::vector<float> distances(n);
+    utils::geo_distance(position.lat, position.lon, lats, lons, n, distances.data());
+
+    std::vector<std::size_t> indexes;
+    indexes.reserve(n);
+    for (std::size_t i = 0; i != n; ++i) {
+        if (!is_filtered(cache.get_id(i), servers_include_p, servers_exclude_p, ignore_servers))
+            indexes.push_back(i);
+    }
+
+    auto k = std::min(nearest_servers, indexes.size());
+    std::partial_sort(indexes.begin(), indexes.begin() + k, indexes.end(), 
+                      [&](std::size_t x, std::size_t y) noexcept
+    {
+        return distances[x] < distances[y] || (distances[x] == distances[y] && x < y);
+    });
+    indexes.resize(k);
+
+    // Added in order, so that servers is sorted by distance.
+    candidates.closest_servers.reserve(k);
+    for (auto i: indexes) {
+        auto ref = candidates.servers.add(cache.get_id(i), cache.get(i, Field::url), cache.get(i, Field::name), 
+                                          cache.get(i, Field::sponsor), lats[i], lons[i], 
+                                          cache.get(i, Field::country));
+        candidates.closest_servers.push_back(ref);
+    }
 
-    std::pair<std::vector<Candidate_servers::Server_ref>, std::size_t> ret;
+    candidates.build_index();
+
+    if (k != 0)
+        candidates.shortest_distance = distances[indexes.front()];
+
+    return candidates;
+}
+
+/**
+ * One in-flight probe of get_best_server.
+ */
+struct Latency_probe_slot {
+    curl::Easy_t easy;
+    bool in_multi = false;
+
+    std::string url;
+    /**
+     * Size of url without the trailing probe index.
+     */
+    std::size_t url_sz;
+
+    /**
+     * Index of the server being probed.
+     */
+    std::size_t server;
+    /**
+     * Index of the current probe of the server, in [0, latency_probe.count).
+     */
+    unsigned i;
+};
+
+auto Speedtest::Config::get_best_server(Candidate_servers &candidates) noexcept ->
+    Ret_except<std::pair<std::vector<Candidate_servers::Server_ref>, LatencySampler::Stats>, 
+               std::bad_alloc, curl::Exception, curl::libcurl_bug>
+{
+    using Easy_ref_t = curl::Easy_ref_t;
+
+    std::pair<std::vector<Candidate_servers::Server_ref>, LatencySampler::Stats> ret{};
     auto &best_servers = ret.first;
     auto &lowest_latency = ret.second;
 
-    lowest_latency = std::numeric_limits<std::size_t>::max();
+    auto &ranked_servers = candidates.ranked_servers;
+    ranked_servers.clear();
 
-    for (const auto &server_it: candidates.closest_servers) {
-        const auto &server_id = server_it->server_id;
-        const auto &url = server_it->url;
+    std::vector<Candidate_servers::Server_ref> servers;
+    servers.reserve(candidates.closest_servers.size());
+
+    for (const auto &server_ref: candidates.closest_servers) {
+        auto server = candidates[server_ref];
+        const auto &server_id = server.server_id;
+        const auto *url = server.url;
 
-        static constexpr const auto &common_pattern = Candidate_servers::Server::common_pattern;
-        if (!url) {
-            speedtest.error("server with i = %ld have url == nullptr\n", server_id);
-            continue;
-        }
         if (url[0] == 0 || url[0] > 2) {
             speedtest.error("server with i = %ld have url[0] not in [1, 2], but have %d\n", 
                             server_id, int(url[0]));
             continue;
         }
 
-        std::snprintf(url_params, sizeof(url_params), "%" PRIu64 ".", utils::get_unix_timestamp_ms());
+        servers.push_back(server_ref);
+    }
 
-        auto &built_url = speedtest.built_url;
-        auto original_sz = built_url.size();
+    if (servers.empty())
+        return std::move(ret);
 
-        Candidate_servers::Server::append_dirname_url(url.get(), built_url);
+    curl::Multi_t multi;
+    if (auto result = speedtest.create_multi(); result.has_exception_set())
+        return {result};
+    else
+        multi = std::move(result).get_return_value();
 
-        built_url.append(query_prefix);
-        built_url.append(url_params);
+    auto probes = std::max(latency_probe.count, 1U);
 
-        built_url += 'p'; // placeholder
+    /**
+     * Latency of each server in servers.
+     */
+    std::vector<LatencySampler> latencies(servers.size());
+    for (auto &latency: latencies)
+        latency.clear(probes);
 
-        std::size_t cummulated_time = 0;
-        for (char i = 0; i != 3; ++i) {
-            built_url[built_url.size() - 1] = '0' + i;
+    auto slots_cnt = std::min<std::size_t>(std::max(latency_probe.max_inflight, 1U), servers.size());
+    std::vector<Latency_probe_slot> slots(slots_cnt);
 
-            if (auto result = easy_ref.set_url(built_url.c_str()); result.has_exception_set())
-                return {result};
+    /**
+     * servers[0, next_server) are being probed or have been probed.
+     */
+    std::size_t next_server = 0;
 
-            if (auto result = speedtest.perform_and_check(easy_ref, __PRETTY_FUNCTION__); 
-                result.has_exception_set())
-                return {result};
-            else if (result) {
-                auto transfer_time = easy_ref.getinfo_transfer_time();
-                speedtest.debug("In %s, %d loop for %s, transfer_time = %zu\n",
-                                __PRETTY_FUNCTION__, int{i}, easy_ref.getinfo_effective_url(), transfer_time);
-                cummulated_time += transfer_time;
-            } else
-                cummulated_time += 3600;
+    auto release_easies = [&]() noexcept
+    {
+        for (auto &slot: slots) {
+            if (!slot.easy)
+                continue;
+
+            if (slot.in_multi) {
+                auto easy_ref = Easy_ref_t{slot.easy.get()};
+                multi.remove_easy(easy_ref);
+            }
+            speedtest.release_easy(std::move(slot.easy));
         }
+    };
+
+    auto start_probe = [](Latency_probe_slot &slot) noexcept
+    {
+        char trail_num[10 + 1];
+        std::snprintf(trail_num, sizeof(trail_num), "%u", slot.i);
+
+        slot.url.resize(slot.url_sz);
+        slot.url.append(trail_num);
+
+        return Easy_ref_t{slot.easy.get()}.set_url(slot.url.c_str());
+    };
+
+    // Probes of each server are sent one after another on the same slot, 
+    // so that they reuse the same connection as before.
+    auto start_server = [&](Latency_probe_slot &slot) noexcept
+    {
+        slot.server = next_server++;
+        slot.i = 0;
+
+        // built_url only contains the scheme
+        slot.url.assign(speedtest.built_url);
+
+        Candidate_servers::Server::append_latency_url(candidates[servers[slot.server]].url, slot.url);
+
+        slot.url_sz = slot.url.size();
 
-        built_url.resize(original_sz);
+        return start_probe(slot);
+    };
 
-        if (cummulated_time < lowest_latency) {
-            lowest_latency = cummulated_time;
+    bool oom = false;
+
+    auto perform_callback = [&](Easy_ref_t &easy_ref, Easy_ref_t::perform_ret_t perform_ret, 
+                                curl::Multi_t &multi, void*) noexcept
+    {
+        auto &slot = *static_cast<Latency_probe_slot*>(easy_ref.get_private());
+
+        if (auto result = speedtest.perform_and_check(easy_ref, perform_ret, __PRETTY_FUNCTION__); 
+            result.has_exception_set())
+        {
+            oom = true;
+            result.Catch([](const auto&) noexcept {});
+            return;
+        } else if (auto latency = Speedtest::get_latency(easy_ref); result && latency >= 0) {
+            speedtest.debug("In %s, %u loop for %s, latency = %" PRId64 " us\n",
+                            __PRETTY_FUNCTION__, slot.i, easy_ref.getinfo_effective_url(), 
+                            static_cast<std::int64_t>(latency));
+            latencies[slot.server].add(latency);
+        } else
+            latencies[slot.server].add_failure();
+
+        Ret_except<void, std::bad_alloc> result;
+
+        if (++slot.i != probes)
+            result = start_probe(slot);
+        else {
+            if (next_server == servers.size()) {
+                multi.remove_easy(easy_ref);
+                slot.in_multi = false;
+                return;
+            }
+
+            result = start_server(slot);
+        }
+
+        if (result.has_exception_set()) {
+            oom = true;
+            result.Catch([](const auto&) noexcept {});
+        }
+    };
+
+    for (auto &slot: slots) {
+        slot.easy = speedtest.create_easy();
+        if (!slot.easy) {
+            release_easies();
+            return {std::bad_alloc{}};
+        }
+
+        auto easy_ref = Easy_ref_t{slot.easy.get()};
+
+        easy_ref.set_writeback(Speedtest::null_writeback, nullptr);
+
+        // Disable all compression methods.
+        if (auto result = easy_ref.set_encoding(nullptr); result.has_exception_set()) {
+            release_easies();
+            return {result};
+        }
+
+        if (latency_probe.timeout != 0)
+            easy_ref.set_timeout(latency_probe.timeout);
+
+        easy_ref.set_private(&slot);
+
+        // The longest element of servers I observed is 69-byte long
+        // the additional 10 bytes is for the trail_num
+        slot.url.reserve(speedtest.built_url.size() + 69 + Candidate_servers::Server::latency_url_sz + 10);
+
+        if (auto result = start_server(slot); result.has_exception_set()) {
+            release_easies();
+            return {result};
+        }
+
+        multi.add_easy(easy_ref);
+        slot.in_multi = true;
+    }
+
+    /**
+     * In ms, break_or_poll returns at least this often so that
+     * shutdown_event is noticed.
+     */
+    static constexpr const int poll_timeout = 100;
+
+    do {
+        if (auto result = multi.perform(perform_callback, nullptr); result.has_exception_set()) {
+            release_easies();
+            return {result};
+        }
+        if (oom) {
+            release_easies();
+            return {std::bad_alloc{}};
+        }
+        if (speedtest.shutdown_event.has_event()) {
+            // Probes in-flight are aborted once removed, and no server is picked.
+            release_easies();
+            return std::move(ret);
+        }
+    } while (multi.break_or_poll(nullptr, 0, poll_timeout).get_return_value() != -1);
+
+    release_easies();
+
+    // Rank servers in the same order as they are in closest_servers,
+    // regardless of which probe finishes first.
+    ranked_servers.reserve(servers.size());
+
+    for (std::size_t i = 0; i != servers.size(); ++i) {
+        auto stats = latencies[i].get_stats();
+
+        ranked_servers.emplace_back(servers[i], stats);
+
+        if (best_servers.empty() || stats < lowest_latency) {
+            lowest_latency = stats;
             best_servers.clear();
         }
 
-        if (cummulated_time == lowest_latency)
-            best_servers.emplace_back(server_it);
+        if (stats == lowest_latency)
+            best_servers.emplace_back(servers[i]);
     }
 
+    std::stable_sort(ranked_servers.begin(), ranked_servers.end(), [](const auto &x, const auto &y) noexcept
+    {
+        return x.second < y.second;
+    });
+
     return std::move(ret);
 }
 } /* namespace speedtest */
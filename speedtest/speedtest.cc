@@ -1,20 +1,49 @@
 #include "speedtest.hpp"
+#include "ThroughputSampler.hpp"
+#include "Size_generator.hpp"
+#include "Upload_payload.hpp"
+
+#include "../thread_sync/thread_sync.hpp"
 
 #include "../curl-cpp/curl.hpp"
 #include "../curl-cpp/curl_multi.hpp"
 
 #include "../utils/type_name.hpp"
+#include "../utils/set_thread_affinity.hpp"
+#include "../utils/get_cpu_ns.hpp"
+
+#include <curl/curl.h>
 
 #include <cstdio>
 #include <cstdarg>
+#include <cinttypes>
+#include <cstring>
 
+#include <new>
+#include <memory>
 #include <type_traits>
 #include <iterator>
 #include <chrono>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <algorithm>
 
 namespace chrono = std::chrono;
 
 namespace speedtest {
+/**
+ * @param userptr points to the first of Speedtest::share_locks.
+ */
+static void lock_share(CURL*, curl_lock_data data, curl_lock_access, void *userptr) noexcept
+{
+    static_cast<std::mutex*>(userptr)[data].lock();
+}
+static void unlock_share(CURL*, curl_lock_data data, void *userptr) noexcept
+{
+    static_cast<std::mutex*>(userptr)[data].unlock();
+}
+
 Speedtest::Speedtest(const utils::ShutdownEvent &shutdown_event, 
                      bool secure,
                      const char *useragent,
@@ -32,6 +61,29 @@ Speedtest::Speedtest(const utils::ShutdownEvent &shutdown_event,
     if (secure)
         built_url += 's';
     built_url.append("://");
+
+    static_assert(CURL_LOCK_DATA_LAST <= std::tuple_size_v<decltype(share_locks)>);
+
+    share.reset(curl_share_init());
+    if (share) {
+        curl_share_setopt(share.get(), CURLSHOPT_LOCKFUNC, lock_share);
+        curl_share_setopt(share.get(), CURLSHOPT_UNLOCKFUNC, unlock_share);
+        curl_share_setopt(share.get(), CURLSHOPT_USERDATA, share_locks.data());
+
+        curl_share_setopt(share.get(), CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share.get(), CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        // Requires libcurl >= 7.57.0, if it fails, only DNS and SSL session is shared.
+        curl_share_setopt(share.get(), CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    }
+}
+
+void Speedtest::Share_deleter::operator () (void *share) const noexcept
+{
+    curl_share_cleanup(share);
+}
+void Speedtest::Slist_deleter::operator () (curl_slist *list) const noexcept
+{
+    curl_slist_free_all(list);
 }
 
 bool Speedtest::check_libcurl_support(FILE *stderr_stream) const noexcept
@@ -93,13 +145,76 @@ void Speedtest::debug(const char *fmt, ...) noexcept
     }
 }
 
+void Speedtest::set_warmup(const ThroughputSampler::Warmup &warmup) noexcept
+{
+    this->warmup = warmup;
+}
+void Speedtest::set_concurrency(const Concurrency &concurrency) noexcept
+{
+    this->concurrency = concurrency;
+}
+void Speedtest::set_loaded_latency(const Loaded_latency &loaded_latency) noexcept
+{
+    this->loaded_latency = loaded_latency;
+}
+bool Speedtest::set_transfer_mode(Transfer_mode mode) noexcept
+{
+    if (mode != Transfer_mode::http1 && !curl.has_http2_multiplex_support())
+        return false;
+
+    transfer_mode = mode;
+    return true;
+}
+void Speedtest::set_upload_payload(Upload_payload::Kind kind) noexcept
+{
+    payload_kind = kind;
+}
+void Speedtest::set_transfer_threads(unsigned threads, std::vector<int> cpus) noexcept
+{
+    transfer_threads = threads == 0 ? 1 : threads;
+    transfer_cpus = std::move(cpus);
+}
+bool Speedtest::set_connect_to(const char *host_port) noexcept
+{
+    if (!host_port) {
+        connect_to.reset();
+        return true;
+    }
+
+    // Empty host and port in the entry matches every url.
+    std::string entry{"::"};
+    entry.append(host_port);
+
+    auto *list = curl_slist_append(nullptr, entry.c_str());
+    if (!list)
+        return false;
+
+    connect_to.reset(list);
+    return true;
+}
+
 auto Speedtest::create_easy() noexcept -> curl::Easy_t
 {
-    auto easy = curl.create_easy();
-    if (!easy)
-        return {};
+    curl::Easy_t easy;
+
+    if (!easy_pool.empty()) {
+        easy = std::move(easy_pool.back());
+        easy_pool.pop_back();
+
+        reset_easy(curl::Easy_ref_t{easy.get()});
+    } else {
+        easy = curl.create_easy();
+        if (!easy)
+            return {};
+    }
+
     auto easy_ref = curl::Easy_ref_t{easy.get()};
 
+    if (share)
+        curl_easy_setopt(easy.get(), CURLOPT_SHARE, share.get());
+    if (connect_to)
+        curl_easy_setopt(easy.get(), CURLOPT_CONNECT_TO, connect_to.get());
+
     easy_ref.set_timeout(timeout);
 
     {
@@ -120,6 +235,30 @@ auto Speedtest::create_easy() noexcept -> curl::Easy_t
 
     return {std::move(easy)};
 }
+void Speedtest::reset_easy(curl::Easy_ref_t easy_ref) noexcept
+{
+    auto *curl_easy = easy_ref.curl_easy;
+
+    easy_ref.set_writeback(null_writeback, nullptr);
+    easy_ref.set_private(nullptr);
+    easy_ref.request_get();
+
+    curl_easy_setopt(curl_easy, CURLOPT_HTTPHEADER, nullptr);
+    curl_easy_setopt(curl_easy, CURLOPT_HEADERFUNCTION, nullptr);
+    curl_easy_setopt(curl_easy, CURLOPT_HEADERDATA, nullptr);
+
+    curl_easy_setopt(curl_easy, CURLOPT_ACCEPT_ENCODING, nullptr);
+    curl_easy_setopt(curl_easy, CURLOPT_HTTP_VERSION, long{CURL_HTTP_VERSION_NONE});
+    curl_easy_setopt(curl_easy, CURLOPT_PIPEWAIT, 0L);
+
+    curl_easy_setopt(curl_easy, CURLOPT_XFERINFOFUNCTION, nullptr);
+    curl_easy_setopt(curl_easy, CURLOPT_XFERINFODATA, nullptr);
+    curl_easy_setopt(curl_easy, CURLOPT_NOPROGRESS, 1L);
+}
+void Speedtest::release_easy(curl::Easy_t &&easy) noexcept
+{
+    easy_pool.push_back(std::move(easy));
+}
 
 auto Speedtest::set_url(curl::Easy_ref_t easy_ref, std::initializer_list<std::string_view> parts) noexcept -> 
     Ret_except<void, std::bad_alloc>
@@ -179,7 +318,19 @@ std::size_t Speedtest::null_writeback(char*, std::size_t, std::size_t size, void
     return size;
 }
 
-static auto create_multi(curl::curl_t &curl) noexcept -> Ret_except<curl::Multi_t, curl::Exception>
+auto Speedtest::get_latency(curl::Easy_ref_t easy_ref) noexcept -> std::int64_t
+{
+    curl_off_t pretransfer, starttransfer;
+
+    if (curl_easy_getinfo(easy_ref.curl_easy, CURLINFO_PRETRANSFER_TIME_T, &pretransfer) != CURLE_OK ||
+        curl_easy_getinfo(easy_ref.curl_easy, CURLINFO_STARTTRANSFER_TIME_T, &starttransfer) != CURLE_OK ||
+        starttransfer < pretransfer)
+        return -1;
+
+    return starttransfer - pretransfer;
+}
+
+auto Speedtest::create_multi(bool multiplex) noexcept -> Ret_except<curl::Multi_t, curl::Exception>
 {
     curl::Multi_t multi;
     if (auto result = curl.create_multi(); result.has_exception_set())
@@ -188,247 +339,906 @@ static auto create_multi(curl::curl_t &curl) noexcept -> Ret_except<curl::Multi_
         multi = std::move(result).get_return_value();
 
     if (curl.has_http2_multiplex_support())
-        multi.set_multiplexing(0);
+        multi.set_multiplexing(multiplex);
 
     return std::move(multi);
 }
-auto Speedtest::download(Config &config, const char *url) noexcept -> 
-    Ret_except<std::size_t, std::bad_alloc, curl::Exception, curl::libcurl_bug>
+
+using Deadline_t = chrono::steady_clock::time_point;
+
+/**
+ * Calculate the deadline of a test that last for length seconds.
+ *
+ * @param length in seconds, 0 means the test is not time-bounded.
+ */
+static auto get_deadline(Deadline_t start, unsigned length) noexcept -> Deadline_t
 {
-    using steady_clock = chrono::steady_clock;
-    using Easy_ref_t = curl::Easy_ref_t;
+    if (length == 0)
+        return Deadline_t::max();
+    return start + chrono::seconds{length};
+}
+static bool is_deadline_reached(const Deadline_t &deadline) noexcept
+{
+    return chrono::steady_clock::now() >= deadline;
+}
+
+/**
+ * Shared by all threads used in one download/upload.
+ */
+struct Speedtest::Transfer_job {
+    bool is_upload;
+
+    Size_generator &gen_size;
+    Deadline_t deadline;
+
+    /**
+     * One url per server, connections are spread across them round-robin.
+     *
+     * For download, size + 'x' + size + ".jpg" is appended to url;
+     * <br>For upload, url is used as-is.
+     */
+    std::vector<std::string> urls;
+
+    /**
+     * Request body of upload.
+     */
+    const Upload_payload *payload = nullptr;
+
+    /**
+     * Result of Server::append_latency_url of the first server,
+     * empty to not probe loaded latency.
+     */
+    std::string latency_url;
+};
+
+/**
+ * State of one connection used in download/upload, stored in the private
+ * ptr of the easy handle.
+ */
+struct Speedtest::Transfer_progress {
+    Transfer_worker *worker;
+    CURL *curl_easy;
+
+    /**
+     * Index into Transfer_job::urls.
+     */
+    std::size_t server;
+
+    /**
+     * Bytes of the current transfer that have been counted.
+     */
+    curl_off_t accounted = 0;
+
+    /**
+     * Used by gen_upload_data as the offset into and size of the request body.
+     */
+    std::size_t upload_offset = 0;
+    std::size_t upload_size = 0;
+
+    /**
+     * Count bytes of the current transfer not yet counted,
+     * plus overhead, and then prepare for next transfer.
+     *
+     * @param transfered bytes of body of the current transfer
+     * @param overhead size of headers of the current transfer
+     */
+    void finish(curl_off_t transfered, std::size_t overhead) noexcept;
+    /**
+     * Count bytes of the current transfer that have been counted as failed
+     * too, and then prepare for next transfer.
+     */
+    void discard() noexcept;
+
+    /**
+     * Also abort the transfer once the worker is stopped, with CURLE_ABORTED_BY_CALLBACK.
+     */
+    static int on_progress(void *clientp, curl_off_t, curl_off_t dlnow, curl_off_t, curl_off_t ulnow) noexcept;
+    static std::size_t gen_upload_data(char *buffer, std::size_t size, std::size_t nitems, void *userp) noexcept;
+};
+
+/**
+ * Drives part of the connections of one download/upload on its own
+ * thread and curl::Multi_t.
+ */
+struct Speedtest::Transfer_worker {
+    Speedtest &speedtest;
+    Transfer_job &job;
+    curl::Thread_sync &sync;
+
+    /**
+     * -1 to not pin the thread to any cpu.
+     */
+    int cpu;
 
     curl::Multi_t multi;
-    if (auto result = create_multi(curl); result.has_exception_set())
-        return {result};
-    else
-        multi = std::move(result).get_return_value();
+    std::vector<curl::Easy_t> easies;
+    std::vector<Transfer_progress> progresses;
 
-    auto original_sz = built_url.size();
+    /**
+     * Used to build url of download, so that threads don't share 
+     * speedtest.built_url.
+     */
+    std::string url;
 
-    Config::Candidate_servers::Server::append_dirname_url(url, built_url);
-    built_url.append("/random");
+    using Ret_t = Ret_except<void, std::bad_alloc, curl::Exception, curl::libcurl_bug>;
+    Ret_t ret;
 
     /**
-     * Since number of concurrent requests is limited by 
-     * config.threads.download, it is necessary to create 
-     * a url generator to avoid memory consumption.
+     * Number of connections this worker should run, set by the sampling thread.
+     * <br>Transfers on easies[i] where i >= target are not restarted once done.
      */
-    auto gen_url = [&, it = config.sizes.download.begin(), i = std::size_t{0},
-                    prev_sz = built_url.size()]() mutable noexcept ->
-        const char*
-    {
-        if (i == config.counts.download) {
-            if (auto next = std::next(it); next == config.sizes.download.end())
-                return nullptr;
-            else
-                it = next;
-
-            built_url.resize(prev_sz);
-            i = 0;
-        }
+    std::atomic<unsigned> target{0};
+    /**
+     * easies[0, started) have been added to multi.
+     */
+    std::size_t started = 0;
 
-        if (i == 0) {
-            // unsigned can occupy at most 10-bytes
-            char buffer[10 + 1 + 10 + 4 + 1];
-            std::snprintf(buffer, sizeof(buffer), "%u.%u.jpg", *it, *it);
-            built_url.append(buffer);
-        }
+    /**
+     * Bytes transfered by this worker.
+     * <br>Only written by this worker and put on its own cache line, so 
+     * that it can be read by the sampling thread without contention.
+     */
+    alignas(64) std::atomic<std::uint64_t> bytes{0};
+    /**
+     * Bytes among bytes of transfers that failed afterwards.
+     * <br>Both only increase, so that samples of them stay monotonic.
+     */
+    std::atomic<std::uint64_t> failed_bytes{0};
+    /**
+     * Bytes transfered by this worker to each server in job.urls.
+     */
+    std::vector<std::atomic<std::uint64_t>> server_bytes;
+    std::vector<std::atomic<std::uint64_t>> server_failed_bytes;
 
-        ++i;
+    /**
+     * Sum of CURLINFO_NUM_CONNECTS of finished transfers.
+     * <br>Only accessed by this worker until it is joined.
+     */
+    std::uint64_t new_connections = 0;
 
-        return built_url.c_str();
-    };
+    std::thread thread;
+
+    Transfer_worker(Speedtest &speedtest, Transfer_job &job, curl::Thread_sync &sync, int cpu) noexcept:
+        speedtest{speedtest}, job{job}, sync{sync}, cpu{cpu}, 
+        server_bytes(job.urls.size()), server_failed_bytes(job.urls.size())
+    {}
 
+    /**
+     * @return true once no more bytes should be transfered, either deadline
+     *         is reached or shutdown_event happens.
+     */
+    bool is_stopped() const noexcept
     {
-        const char *buit_url_cstr;
-        for (std::size_t i = 0; i != config.threads.download && (buit_url_cstr = gen_url()); ++i) {
-            auto easy_ref = curl::Easy_ref_t{create_easy().release()};
-            if (!easy_ref.curl_easy)
-                return {std::bad_alloc{}};
+        return is_deadline_reached(job.deadline) || speedtest.shutdown_event.has_event();
+    }
 
-            if (auto result = easy_ref.set_url(buit_url_cstr); result.has_exception_set())
-                return {result};
+    static void count(std::atomic<std::uint64_t> &counter, std::uint64_t n) noexcept
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    void count(std::uint64_t n, std::size_t server) noexcept
+    {
+        count(bytes, n);
+        count(server_bytes[server], n);
+    }
+    void count_failed(std::uint64_t n, std::size_t server) noexcept
+    {
+        count(failed_bytes, n);
+        count(server_failed_bytes[server], n);
+    }
 
-            easy_ref.set_writeback(null_writeback, nullptr);
+    /**
+     * Prepare easy, must be called before the worker is started.
+     *
+     * @param server index into job.urls
+     */
+    auto add_easy(curl::Easy_t &&easy, std::size_t server) noexcept -> Ret_except<void, std::bad_alloc>;
 
-            // Disable all compression methods.
-            if (auto result = easy_ref.set_encoding(nullptr); result.has_exception_set())
-                return {result};
+    /**
+     * @return false if there's no more transfer to start or oom.
+     */
+    bool start_transfer(curl::Easy_ref_t easy_ref, Transfer_progress &progress) noexcept;
+
+    /**
+     * Start transfers on easies[started, target).
+     */
+    void start_pending() noexcept;
+
+    void run() noexcept;
+};
+
+void Speedtest::Transfer_progress::finish(curl_off_t transfered, std::size_t overhead) noexcept
+{
+    if (transfered < accounted)
+        transfered = accounted;
+    worker->count(transfered - accounted + overhead, server);
+
+    accounted = 0;
+    upload_offset = 0;
+}
+void Speedtest::Transfer_progress::discard() noexcept
+{
+    worker->count_failed(accounted, server);
+
+    accounted = 0;
+    upload_offset = 0;
+}
+
+/**
+ * @return true if the response of the transfer is known to be rejected by 
+ *         perform_and_check, before the transfer is done.
+ */
+static bool is_error_response(CURL *curl_easy) noexcept
+{
+    // 0 if no response is received yet, 1xx for "100 Continue" of upload.
+    long response_code = 0;
+    curl_easy_getinfo(curl_easy, CURLINFO_RESPONSE_CODE, &response_code);
+
+    return response_code > 200;
+}
+
+int Speedtest::Transfer_progress::on_progress(void *clientp, curl_off_t, curl_off_t dlnow, curl_off_t, 
+                                              curl_off_t ulnow) noexcept
+{
+    auto &progress = *static_cast<Transfer_progress*>(clientp);
+    auto &job = progress.worker->job;
+
+    auto now = job.is_upload ? ulnow : dlnow;
+    // Body of an error page is not counted.
+    if (now > progress.accounted && !is_error_response(progress.curl_easy)) {
+        progress.worker->count(now - progress.accounted, progress.server);
+        progress.accounted = now;
+    }
+
+    return progress.worker->is_stopped();
+}
+
+std::size_t Speedtest::Transfer_progress::gen_upload_data(char *buffer, std::size_t size, std::size_t nitems, 
+                                                          void *userp) noexcept
+{
+    auto &progress = *static_cast<Transfer_progress*>(userp);
+
+    auto bytes = std::min(size * nitems, progress.upload_size - progress.upload_offset);
+    progress.worker->job.payload->read(buffer, progress.upload_offset, bytes);
+    progress.upload_offset += bytes;
+
+    return bytes;
+}
+
+auto Speedtest::Transfer_worker::add_easy(curl::Easy_t &&easy, std::size_t server) noexcept -> 
+    Ret_except<void, std::bad_alloc>
+{
+    auto easy_ref = curl::Easy_ref_t{easy.get()};
+    easies.push_back(std::move(easy));
+
+    easy_ref.set_writeback(null_writeback, nullptr);
+
+    using Transfer_mode = Speedtest::Transfer_mode;
+
+    if (speedtest.transfer_mode != Transfer_mode::http1) {
+        auto http_version = speedtest.transfer_mode == Transfer_mode::http2 ? 
+                                CURL_HTTP_VERSION_2TLS : CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE;
+        curl_easy_setopt(easy_ref.curl_easy, CURLOPT_HTTP_VERSION, long{http_version});
+
+        // Wait for an existing connection to confirm multiplexing instead of opening a new one.
+        curl_easy_setopt(easy_ref.curl_easy, CURLOPT_PIPEWAIT, 1L);
+    }
+
+    if (job.is_upload) {
+        if (auto result = easy_ref.set_url(job.urls[server].c_str()); result.has_exception_set())
+            return {result};
+    } else {
+        // Disable all compression methods.
+        if (auto result = easy_ref.set_encoding(nullptr); result.has_exception_set())
+            return {result};
+    }
+
+    auto &progress = progresses.emplace_back(Transfer_progress{this, easy_ref.curl_easy, server});
+
+    easy_ref.set_private(&progress);
+
+    curl_easy_setopt(easy_ref.curl_easy, CURLOPT_XFERINFOFUNCTION, Transfer_progress::on_progress);
+    curl_easy_setopt(easy_ref.curl_easy, CURLOPT_XFERINFODATA, &progress);
+    curl_easy_setopt(easy_ref.curl_easy, CURLOPT_NOPROGRESS, 0L);
+
+    return {};
+}
+
+bool Speedtest::Transfer_worker::start_transfer(curl::Easy_ref_t easy_ref, Transfer_progress &progress) 
+    noexcept
+{
+    if (is_stopped())
+        return false;
+
+    auto size = job.gen_size();
+    if (size == 0)
+        return false;
+
+    if (job.is_upload) {
+        progress.upload_size = size;
+        easy_ref.request_post(Transfer_progress::gen_upload_data, &progress, size);
+        return true;
+    }
+
+    url.assign(job.urls[progress.server]);
+    Config::Candidate_servers::Server::append_image_name(size, url);
 
-            multi.add_easy(easy_ref);
+    if (auto result = easy_ref.set_url(url.c_str()); result.has_exception_set()) {
+        result.Catch([](const auto&) noexcept {});
+        ret = Ret_t{std::bad_alloc{}};
+        return false;
+    }
+
+    return true;
+}
+
+void Speedtest::Transfer_worker::start_pending() noexcept
+{
+    auto n = std::min<std::size_t>(target.load(std::memory_order_relaxed), easies.size());
+
+    for (; started < n; ++started) {
+        auto easy_ref = curl::Easy_ref_t{easies[started].get()};
+
+        if (!start_transfer(easy_ref, progresses[started])) {
+            // No more transfers to start.
+            started = easies.size();
+            break;
         }
+
+        multi.add_easy(easy_ref);
     }
+}
+
+void Speedtest::Transfer_worker::run() noexcept
+{
+    using Easy_ref_t = curl::Easy_ref_t;
 
-    std::size_t download_cnt;
+    /**
+     * In ms, break_or_poll returns at least this often so that
+     * change of target is noticed.
+     */
+    static constexpr const int poll_timeout = 50;
 
-    auto start = steady_clock::now();
+    if (cpu >= 0) {
+        if (auto err = utils::set_thread_affinity(cpu); err != 0)
+            speedtest.error("Failed to pin transfer thread to cpu %d: %s\n", cpu, std::strerror(err));
+    }
 
-    bool oom = false;
-    auto perform_callback = [&](Easy_ref_t &easy_ref, Easy_ref_t::perform_ret_t ret, curl::Multi_t &multi, void*)
-        noexcept
+    auto perform_callback = [&](Easy_ref_t &easy_ref, Easy_ref_t::perform_ret_t perform_ret, 
+                                curl::Multi_t &multi, void*) noexcept
     {
-        if (auto result = perform_and_check(easy_ref, ret, __PRETTY_FUNCTION__); 
-            result.has_exception_set()) 
+        bool succeeded = true;
+
+        if (is_stopped()) {
+            // The transfer is aborted by on_progress, bytes already transfered are still counted.
+            perform_ret.Catch([](const auto&) noexcept {});
+            succeeded = !is_error_response(easy_ref.curl_easy);
+        } else if (auto result = speedtest.perform_and_check(easy_ref, perform_ret, __PRETTY_FUNCTION__); 
+                   result.has_exception_set()) 
         {
-            oom = true;
+            ret = Ret_t{std::bad_alloc{}};
             result.Catch([](const auto&) noexcept {});
-        } else
-            /**
-             * Since there is no proxy and the speedtest site
-             * should not redirect to any other site based on experience,
-             * getinfo_sizeof_response_* should be precise.
-             */
-            download_cnt += easy_ref.getinfo_sizeof_response_header() + 
-                            easy_ref.getinfo_sizeof_response_body();
+        } else if (!result)
+            succeeded = false;
+
+        auto &progress = *static_cast<Transfer_progress*>(easy_ref.get_private());
+
+        /**
+         * Bytes of a failed transfer, e.g. an error page or a connection 
+         * reset halfway, are not part of the throughput.
+         *
+         * Since there is no proxy and the speedtest site
+         * should not redirect to any other site based on experience,
+         * getinfo_sizeof_* should be precise.
+         */
+        if (!succeeded)
+            progress.discard();
+        else if (job.is_upload)
+            progress.finish(easy_ref.getinfo_sizeof_uploaded(), easy_ref.getinfo_sizeof_request());
+        else
+            progress.finish(easy_ref.getinfo_sizeof_response_body(), easy_ref.getinfo_sizeof_response_header());
 
-        if (auto url_cstr = gen_url(); url_cstr) {
-            if (auto result = easy_ref.set_url(url_cstr); result.has_exception_set()) {
-                oom = true;
-                result.Catch([](const auto&) noexcept {});
-            }
-        } else {
+        long num_connects = 0;
+        if (curl_easy_getinfo(easy_ref.curl_easy, CURLINFO_NUM_CONNECTS, &num_connects) == CURLE_OK)
+            new_connections += num_connects;
+
+        std::size_t i = &progress - progresses.data();
+
+        // Start another transfer
+        if (ret.has_exception_set() || i >= target.load(std::memory_order_relaxed) || 
+            !start_transfer(easy_ref, progress))
             multi.remove_easy(easy_ref);
-            curl::Easy_t easy{easy_ref.curl_easy};
-        }
     };
 
     do {
-        if (auto result = multi.perform(perform_callback, nullptr); result.has_exception_set())
-            return {result};
-        if (oom)
-            return {std::bad_alloc{}};
-    } while (multi.break_or_poll().get_return_value() != -1);
+        start_pending();
 
-    auto seconds = chrono::duration_cast<chrono::seconds>(steady_clock::now() - start).count();
-    auto download_speed = download_cnt / seconds;
+        if (auto result = multi.perform(perform_callback, nullptr); result.has_exception_set()) {
+            ret = Ret_t{result};
+            break;
+        }
+        if (ret.has_exception_set())
+            break;
+    } while (multi.break_or_poll(nullptr, 0, poll_timeout).get_return_value() != -1);
 
-    built_url.resize(original_sz);
+    sync.thread_done();
+}
 
-    if (download_speed > 100000)
-        config.threads.upload = 8;
+/**
+ * Probe latency on its own thread and connection while transfers are running.
+ */
+struct Speedtest::Latency_prober {
+    Speedtest &speedtest;
+
+    curl::Easy_t easy;
+
+    /**
+     * url[0, url_sz) is the result of append_latency_url.
+     */
+    std::string url;
+    std::size_t url_sz;
+
+    LatencySampler sampler;
+
+    using Ret_t = Ret_except<void, std::bad_alloc>;
+    Ret_t ret;
+
+    std::atomic<bool> stop{false};
+
+    std::thread thread;
+
+    Latency_prober(Speedtest &speedtest, curl::Easy_t &&easy) noexcept:
+        speedtest{speedtest}, easy{std::move(easy)}
+    {}
+
+    bool is_stopped() const noexcept
+    {
+        return stop.load(std::memory_order_relaxed) || speedtest.shutdown_event.has_event();
+    }
+
+    auto init(const std::string &latency_url) noexcept -> Ret_t;
+
+    void run() noexcept;
+
+    /**
+     * Abort the probe in-flight once the prober is stopped.
+     */
+    static int on_probe_progress(void *clientp, curl_off_t, curl_off_t, curl_off_t, curl_off_t) noexcept;
+};
 
-    return download_speed;
+int Speedtest::Latency_prober::on_probe_progress(void *clientp, curl_off_t, curl_off_t, curl_off_t, curl_off_t) 
+    noexcept
+{
+    return static_cast<const Latency_prober*>(clientp)->is_stopped();
 }
 
-static std::size_t gen_upload_data(char *buffer, std::size_t size, std::size_t nitems, void *userp)
+auto Speedtest::Latency_prober::init(const std::string &latency_url) noexcept -> Ret_t
 {
-    auto bytes = size * nitems;
-    auto &i = *static_cast<std::size_t*>(userp);
+    const auto &config = speedtest.loaded_latency;
 
-    static constexpr const std::string_view prefix{"content1="};
-    static constexpr const std::string_view chars = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
-    for (auto end = i + bytes; i != end; ++i) {
-        if (i < prefix.size())
-            buffer[i] = prefix[i];
-        else
-            buffer[i] = chars[(i - prefix.size()) % chars.size()];
-    }
+    auto easy_ref = curl::Easy_ref_t{easy.get()};
 
-    return bytes;
+    easy_ref.set_writeback(null_writeback, nullptr);
+
+    // Disable all compression methods.
+    if (auto result = easy_ref.set_encoding(nullptr); result.has_exception_set())
+        return {result};
+
+    easy_ref.set_timeout(config.timeout);
+
+    curl_easy_setopt(easy_ref.curl_easy, CURLOPT_XFERINFOFUNCTION, on_probe_progress);
+    curl_easy_setopt(easy_ref.curl_easy, CURLOPT_XFERINFODATA, this);
+    curl_easy_setopt(easy_ref.curl_easy, CURLOPT_NOPROGRESS, 0L);
+
+    url.reserve(latency_url.size() + 10);
+    url.assign(latency_url);
+    url_sz = url.size();
+
+    auto probes = config.interval.count() == 0 ? 0 : chrono::seconds{1} / config.interval;
+    sampler.clear(probes * 16);
+
+    return {};
 }
-auto Speedtest::upload(Config &config, const char *url) noexcept -> 
-    Ret_except<std::size_t, std::bad_alloc, curl::Exception, curl::libcurl_bug>
+
+void Speedtest::Latency_prober::run() noexcept
 {
     using steady_clock = chrono::steady_clock;
-    using Easy_ref_t = curl::Easy_ref_t;
 
-    curl::Multi_t multi;
-    if (auto result = create_multi(curl); result.has_exception_set())
-        return {result};
-    else
-        multi = std::move(result).get_return_value();
+    auto easy_ref = curl::Easy_ref_t{easy.get()};
+    auto interval = speedtest.loaded_latency.interval;
 
-    auto original_sz = built_url.size();
-    Config::Candidate_servers::Server::append_url(url, built_url);
+    for (unsigned i = 0; !is_stopped(); ++i) {
+        auto next = steady_clock::now() + interval;
 
-    auto gen_upload_size = [&, i = config.sizes.upload_start, j = std::size_t{0}]() mutable noexcept ->
-        std::size_t
-    {
-        if (j == config.counts.upload) {
-            if (++i == config.sizes.up_sizes.size()) {
-                --i; // so that if this function get called next time, it would still returns -1
-                return -1;
-            }
+        char trail_num[10 + 1];
+        std::snprintf(trail_num, sizeof(trail_num), "%u", i);
+
+        url.resize(url_sz);
+        url.append(trail_num);
 
-            j = 0;
+        if (auto result = easy_ref.set_url(url.c_str()); result.has_exception_set()) {
+            ret = Ret_t{result};
+            break;
         }
 
-        ++j;
+        auto perform_ret = easy_ref.perform();
+        if (is_stopped()) {
+            // Aborted by on_probe_progress, don't count it as failure.
+            perform_ret.Catch([](const auto&) noexcept {});
+            break;
+        }
 
-        return config.sizes.up_sizes[i];
-    };
+        if (auto result = speedtest.perform_and_check(easy_ref, perform_ret, __PRETTY_FUNCTION__); 
+            result.has_exception_set())
+        {
+            ret = Ret_t{std::bad_alloc{}};
+            result.Catch([](const auto&) noexcept {});
+            break;
+        } else if (auto latency = get_latency(easy_ref); result && latency >= 0)
+            sampler.add(latency);
+        else
+            sampler.add_failure();
+
+        // Sleep in small steps, so that stop is noticed soon.
+        for (auto now = steady_clock::now(); now < next && !is_stopped(); now = steady_clock::now())
+            std::this_thread::sleep_for(std::min<steady_clock::duration>(next - now, chrono::milliseconds{10}));
+    }
+}
+
+auto Speedtest::get_transfer_result(const ThroughputSampler &sampler) const noexcept -> Transfer_result
+{
+    auto first = sampler.find_steady_state(warmup);
+
+    // Value-initialized, so that fields not derived from sampler are zero or empty.
+    Transfer_result result{};
+    result.speed = sampler.get_throughput(first);
+    result.raw_speed = sampler.get_throughput();
+    result.warmup_ns = sampler.get_samples()[first].ns;
+    result.bytes = sampler.get_bytes();
+
+    return result;
+}
 
+auto Speedtest::run_transfers(Transfer_job &job, unsigned connections, unsigned length) noexcept ->
+    Ret_except<Transfer_result, std::bad_alloc, curl::Exception, curl::libcurl_bug>
+{
+    using Mode = Concurrency::Mode;
+
+    bool is_adaptive = concurrency.mode == Mode::adaptive;
+
+    /**
+     * In adaptive mode, the connections passed in are ignored: concurrency.max
+     * connections are set up front, and the controller below starts with 
+     * concurrency.initial of them active.
+     */
+    if (is_adaptive)
+        connections = std::max(concurrency.max, 1U);
+
+    auto threads = std::min(transfer_threads, connections);
+
+    unsigned active = connections;
+    if (is_adaptive)
+        active = std::clamp(concurrency.initial, threads, connections);
+
+    curl::Thread_sync sync;
+    std::vector<std::unique_ptr<Transfer_worker>> workers;
+    workers.reserve(threads);
+
+    auto release_easies = [&]() noexcept
     {
-        std::size_t upload_size;
-        for (std::size_t i = 0; i != config.threads.upload && (upload_size = gen_upload_size()) != -1; ++i) {
-            auto easy_ref = curl::Easy_ref_t{create_easy().release()};
-            if (!easy_ref.curl_easy)
-                return {std::bad_alloc{}};
+        for (auto &worker: workers) {
+            for (auto &easy: worker->easies)
+                release_easy(std::move(easy));
+        }
+    };
 
-            if (auto result = easy_ref.set_url(built_url.c_str()); result.has_exception_set())
-                return {result};
+    for (unsigned i = 0; i != threads; ++i) {
+        int cpu = transfer_cpus.empty() ? -1 : transfer_cpus[i % transfer_cpus.size()];
 
-            easy_ref.set_writeback(null_writeback, nullptr);
+        auto worker_p = std::unique_ptr<Transfer_worker>{new (std::nothrow) Transfer_worker{*this, job, sync, cpu}};
+        if (!worker_p) {
+            release_easies();
+            return {std::bad_alloc{}};
+        }
+        auto &worker = *workers.emplace_back(std::move(worker_p));
 
-            auto *upload_cnt = new (std::nothrow) std::size_t{0};
-            if (!upload_cnt)
+        if (auto result = create_multi(transfer_mode != Transfer_mode::http1); result.has_exception_set()) {
+            release_easies();
+            return {result};
+        } else
+            worker.multi = std::move(result).get_return_value();
+
+        // Distribute connections evenly
+        auto n = connections / threads + (i < connections % threads);
+        worker.easies.reserve(n);
+        worker.progresses.reserve(n);
+
+        std::size_t max_url_sz = 0;
+        for (const auto &url: job.urls)
+            max_url_sz = std::max(max_url_sz, url.size());
+        worker.url.reserve(max_url_sz + Config::Candidate_servers::Server::image_name_sz);
+
+        for (unsigned j = 0; j != n; ++j) {
+            auto easy = create_easy();
+            if (!easy) {
+                release_easies();
                 return {std::bad_alloc{}};
+            }
 
-            easy_ref.set_private(upload_cnt);
-            easy_ref.request_post(gen_upload_data, upload_cnt, upload_size);
+            /**
+             * The first target connections of each worker are started first,
+             * so interleave them across servers.
+             */
+            auto server = (i + std::size_t{j} * threads) % job.urls.size();
 
-            multi.add_easy(easy_ref);
+            if (auto result = worker.add_easy(std::move(easy), server); result.has_exception_set()) {
+                release_easies();
+                return {result};
+            }
         }
     }
 
-    std::size_t upload_cnt;
+    auto load = [](const std::atomic<std::uint64_t> &counter) noexcept
+    {
+        return counter.load(std::memory_order_relaxed);
+    };
+
+    // Distribute connections evenly
+    auto set_target = [&](unsigned total) noexcept
+    {
+        for (unsigned i = 0; i != threads; ++i)
+            workers[i]->target.store(total / threads + (i < total % threads), std::memory_order_relaxed);
+    };
+    set_target(active);
+
+    ThroughputSampler sampler;
+    sampler.start(chrono::seconds{length});
+
+    auto servers = job.urls.size();
 
-    auto start = steady_clock::now();
+    std::vector<ThroughputSampler> server_samplers(servers);
+    for (auto &server_sampler: server_samplers)
+        server_sampler.start(chrono::seconds{length});
 
-    bool oom = false;
-    auto perform_callback = [&](Easy_ref_t &easy_ref, Easy_ref_t::perform_ret_t ret, curl::Multi_t &multi, void*)
-        noexcept
+    auto sample = [&]() noexcept
     {
-        if (auto result = perform_and_check(easy_ref, ret, __PRETTY_FUNCTION__); 
-            result.has_exception_set()) 
-        {
-            oom = true;
-            result.Catch([](const auto&) noexcept {});
-        } else
-            /**
-             * Since there is no proxy and the speedtest site
-             * should not redirect to any other site based on experience,
-             * getinfo_sizeof_* should be precise.
-             */
-            upload_cnt += easy_ref.getinfo_sizeof_uploaded() + 
-                          easy_ref.getinfo_sizeof_request(); 
+        std::uint64_t bytes = 0, failed = 0;
+        for (const auto &worker: workers) {
+            bytes += load(worker->bytes);
+            failed += load(worker->failed_bytes);
+        }
+        sampler.sample(bytes, failed);
 
-        auto *cnt = static_cast<std::size_t*>(easy_ref.get_private());
+        if (servers == 1)
+            return;
 
-        if (auto upload_size = gen_upload_size(); upload_size != -1) {
-            // Start another transfer
-            *cnt = 0;
-            easy_ref.request_post(gen_upload_data, cnt, upload_size);
-        } else {
-            delete cnt;
-            multi.remove_easy(easy_ref);
-            curl::Easy_t easy{easy_ref.curl_easy};
+        for (std::size_t i = 0; i != servers; ++i) {
+            std::uint64_t bytes = 0, failed = 0;
+            for (const auto &worker: workers) {
+                bytes += load(worker->server_bytes[i]);
+                failed += load(worker->server_failed_bytes[i]);
+            }
+            server_samplers[i].sample(bytes, failed);
         }
     };
 
-    do {
-        if (auto result = multi.perform(perform_callback, nullptr); result.has_exception_set())
-            return {result};
-        if (oom)
+    std::unique_ptr<Latency_prober> prober;
+    if (loaded_latency.interval.count() != 0 && !job.latency_url.empty()) {
+        auto easy = create_easy();
+        if (easy)
+            prober.reset(new (std::nothrow) Latency_prober{*this, std::move(easy)});
+
+        if (!prober) {
+            if (easy)
+                release_easy(std::move(easy));
+            release_easies();
             return {std::bad_alloc{}};
-    } while (multi.break_or_poll().get_return_value() != -1);
+        }
+
+        if (auto result = prober->init(job.latency_url); result.has_exception_set()) {
+            release_easy(std::move(prober->easy));
+            release_easies();
+            return {result};
+        }
+    }
+
+    auto cpu_start = utils::get_cpu_ns();
+
+    job.deadline = get_deadline(chrono::steady_clock::now(), length);
+
+    sync.reset(threads);
+    for (auto &worker: workers)
+        worker->thread = std::thread{&Transfer_worker::run, worker.get()};
+
+    if (prober)
+        prober->thread = std::thread{&Latency_prober::run, prober.get()};
+
+    /**
+     * The adaptive concurrency controller:
+     * every concurrency.period, double the number of connections if 
+     * throughput of the last period increases by at least concurrency.min_gain.
+     * <br>Otherwise, fall back to the number of connections used in the
+     * previous period and stop.
+     */
+    bool converged = !is_adaptive;
+    auto period_ns = static_cast<std::uint64_t>(chrono::duration_cast<chrono::nanoseconds>(concurrency.period).count());
+    std::size_t period_start = 0;
+    unsigned prev_active = active;
+    double prev_rate = 0;
+
+    while (!sync.wait_for(sampler.get_interval())) {
+        sample();
+
+        // Workers abort their transfers on shutdown_event, so no more connections are needed.
+        if (converged || shutdown_event.has_event())
+            continue;
+
+        const auto &samples = sampler.get_samples();
+        const auto &begin = samples[period_start];
+        const auto &end = samples.back();
+
+        if (end.ns - begin.ns < period_ns)
+            continue;
+
+        auto rate = ThroughputSampler::get_rate(begin, end);
+
+        if (prev_rate != 0 && rate < prev_rate * (1 + concurrency.min_gain)) {
+            active = prev_active;
+            converged = true;
+        } else if (active == connections)
+            converged = true;
+        else {
+            prev_active = active;
+            prev_rate = rate;
+            active = std::min(active * 2, connections);
+        }
+
+        debug("In %s, adaptive concurrency: %s %u connections\n",
+              __PRETTY_FUNCTION__, converged ? "converged on" : "increase to", active);
+
+        set_target(active);
+        period_start = samples.size() - 1;
+    }
+
+    for (auto &worker: workers)
+        worker->thread.join();
+
+    if (prober) {
+        prober->stop.store(true, std::memory_order_relaxed);
+        prober->thread.join();
+    }
+
+    auto cpu_ns = utils::get_cpu_ns() - cpu_start;
+
+    sample();
+
+    for (auto &worker: workers) {
+        // Remove the remaining easy handles before they are released.
+        for (auto &easy: worker->easies) {
+            auto easy_ref = curl::Easy_ref_t{easy.get()};
+            worker->multi.remove_easy(easy_ref);
+        }
+    }
+    release_easies();
+
+    for (auto &worker: workers) {
+        if (worker->ret.has_exception_set())
+            return {std::move(worker->ret)};
+    }
+
+    if (prober) {
+        release_easy(std::move(prober->easy));
+
+        if (prober->ret.has_exception_set())
+            return {std::move(prober->ret)};
+    }
+
+    auto transfer_result = get_transfer_result(sampler);
+    transfer_result.connections = active;
+    transfer_result.bytes = sampler.get_bytes();
+    transfer_result.cpu_ns = cpu_ns;
+
+    transfer_result.new_connections = 0;
+    for (const auto &worker: workers)
+        transfer_result.new_connections += worker->new_connections;
+
+    if (prober)
+        transfer_result.loaded_latency = prober->sampler.get_stats();
+
+    if (servers == 1)
+        transfer_result.servers.push_back({transfer_result.speed, transfer_result.raw_speed});
+    else {
+        transfer_result.servers.reserve(servers);
+        for (const auto &server_sampler: server_samplers) {
+            auto server_result = get_transfer_result(server_sampler);
+            transfer_result.servers.push_back({server_result.speed, server_result.raw_speed});
+        }
+    }
+
+    return transfer_result;
+}
+
+auto Speedtest::download(Config &config, const char *url) noexcept -> 
+    Ret_except<Transfer_result, std::bad_alloc, curl::Exception, curl::libcurl_bug>
+{
+    return download(config, std::vector<const char*>{url});
+}
+auto Speedtest::download(Config &config, const std::vector<const char*> &urls) noexcept -> 
+    Ret_except<Transfer_result, std::bad_alloc, curl::Exception, curl::libcurl_bug>
+{
+    const auto &sizes = config.sizes.download;
+    Size_generator gen_size{sizes.data(), sizes.size(), config.counts.download};
+
+    Transfer_job job{false, gen_size, {}, {}, nullptr, {}};
+
+    job.urls.reserve(urls.size());
+    for (const auto *url: urls) {
+        // built_url only contains the scheme
+        auto &job_url = job.urls.emplace_back(built_url);
+
+        Config::Candidate_servers::Server::append_dirname_url(url, job_url);
+        job_url.append("/random");
+    }
+
+    job.latency_url.assign(built_url);
+    Config::Candidate_servers::Server::append_latency_url(urls.front(), job.latency_url);
+
+    auto result = run_transfers(job, config.threads.download, config.length.download);
+    if (result.has_exception_set())
+        return {std::move(result)};
+
+    auto download_result = std::move(result).get_return_value();
+
+    debug("In %s, download speed = %zu, raw download speed = %zu, warm-up = %" PRIu64 " ns, connections = %u, "
+          "new connections = %" PRIu64 ", cpu = %" PRIu64 " ns\n",
+          __PRETTY_FUNCTION__, download_result.speed, download_result.raw_speed, download_result.warmup_ns,
+          download_result.connections, download_result.new_connections, download_result.cpu_ns);
+
+    if (download_result.speed > 100000)
+        config.threads.upload = 8;
+
+    return download_result;
+}
+
+auto Speedtest::upload(Config &config, const char *url) noexcept -> 
+    Ret_except<Transfer_result, std::bad_alloc, curl::Exception, curl::libcurl_bug>
+{
+    return upload(config, std::vector<const char*>{url});
+}
+auto Speedtest::upload(Config &config, const std::vector<const char*> &urls) noexcept -> 
+    Ret_except<Transfer_result, std::bad_alloc, curl::Exception, curl::libcurl_bug>
+{
+    const auto &sizes = config.sizes.up_sizes;
+    Size_generator gen_size{sizes.data() + config.sizes.upload_start, sizes.size() - config.sizes.upload_start, 
+                            config.counts.upload};
+
+    if (!payload.init(payload_kind))
+        return {std::bad_alloc{}};
+
+    Transfer_job job{true, gen_size, {}, {}, &payload, {}};
+
+    job.urls.reserve(urls.size());
+    for (const auto *url: urls) {
+        // built_url only contains the scheme
+        auto &job_url = job.urls.emplace_back(built_url);
+
+        Config::Candidate_servers::Server::append_url(url, job_url);
+    }
+
+    job.latency_url.assign(built_url);
+    Config::Candidate_servers::Server::append_latency_url(urls.front(), job.latency_url);
+
+    auto result = run_transfers(job, config.threads.upload, config.length.upload);
+    if (result.has_exception_set())
+        return {std::move(result)};
 
-    auto seconds = chrono::duration_cast<chrono::seconds>(steady_clock::now() - start).count();
-    auto upload_speed = upload_cnt / seconds;
+    auto upload_result = std::move(result).get_return_value();
 
-    built_url.resize(original_sz);
+    debug("In %s, upload speed = %zu, raw upload speed = %zu, warm-up = %" PRIu64 " ns, connections = %u, "
+          "new connections = %" PRIu64 ", cpu = %" PRIu64 " ns\n",
+          __PRETTY_FUNCTION__, upload_result.speed, upload_result.raw_speed, upload_result.warmup_ns,
+          upload_result.connections, upload_result.new_connections, upload_result.cpu_ns);
 
-    return upload_speed;
+    return upload_result;
 }
 } /* namespace speedtest */
@@ -8,23 +8,35 @@
 
 # include "../curl-cpp/curl.hpp"
 # include "../curl-cpp/curl_easy.hpp"
+# include "../curl-cpp/curl_multi.hpp"
 # include "../curl-cpp/return-exception/ret-exception.hpp"
 
 # include "../utils/ShutdownEvent.hpp"
 
+# include "ThroughputSampler.hpp"
+# include "LatencySampler.hpp"
+# include "GeoIndex.hpp"
+# include "ServerCache.hpp"
+# include "ServerTable.hpp"
+# include "Upload_payload.hpp"
+
 # include <stdexcept>
 # include <utility>
 # include <cstdio>
+# include <cstdint>
 
 # include <memory>
+# include <mutex>
 
 # include <array>
 # include <vector>
 # include <set>
-# include <forward_list>
 
 # include <string>
 # include <string_view>
+# include <chrono>
+
+struct curl_slist;
 
 namespace speedtest {
 /**
@@ -47,8 +59,158 @@ public:
         verbose_curl = 1 << 2, // Enable curl's verbose mode
     };
 
+    struct Transfer_result {
+        /**
+         * bytes per second, with samples taken before steady state discarded.
+         */
+        std::size_t speed;
+        /**
+         * bytes per second, including warm-up.
+         */
+        std::size_t raw_speed;
+
+        /**
+         * Nanoseconds discarded as warm-up.
+         */
+        std::uint64_t warmup_ns;
+
+        /**
+         * Number of connections used, or in Concurrency::Mode::adaptive, 
+         * the number of connections converged on.
+         *
+         * In Transfer_mode::http2 and Transfer_mode::http2_prior_knowledge,
+         * this is the number of concurrent streams instead.
+         */
+        unsigned connections;
+
+        /**
+         * Number of connections actually opened during the test, 
+         * as reported by CURLINFO_NUM_CONNECTS.
+         * <br>Connections reused from previous phases are not counted.
+         */
+        std::uint64_t new_connections;
+
+        /**
+         * Bytes transfered, including warm-up and protocol overhead.
+         */
+        std::uint64_t bytes;
+        /**
+         * CPU time (user + sys) consumed by the whole process during the test.
+         */
+        std::uint64_t cpu_ns;
+
+        struct Server_speed {
+            std::size_t speed;
+            std::size_t raw_speed;
+        };
+        /**
+         * Speed of each server, in the same order as the urls passed to download/upload.
+         */
+        std::vector<Server_speed> servers;
+
+        /**
+         * Latency of the first server measured while the link is loaded.
+         * <br>loaded_latency.probes == 0 if Loaded_latency::interval is 0.
+         */
+        LatencySampler::Stats loaded_latency;
+    };
+
+    /**
+     * Probe latency of the first server while download and upload 
+     * are running, on a separate connection whose bytes are not counted.
+     */
+    struct Loaded_latency {
+        /**
+         * Interval between the start of consecutive probes, 0 to disable.
+         */
+        std::chrono::steady_clock::duration interval = std::chrono::milliseconds{200};
+        /**
+         * Timeout of each probe in ms, a probe that timed out is treated 
+         * as failed.
+         */
+        unsigned long timeout = 2000;
+    };
+
+    enum class Transfer_mode {
+        /**
+         * One HTTP/1.1 connection per concurrent transfer.
+         */
+        http1,
+        /**
+         * Negotiate HTTP/2 via ALPN and run concurrent transfers as streams
+         * multiplexed over as few connections as possible.
+         * <br>Only https servers can negotiate HTTP/2 this way, transfers 
+         * to http servers fall back to HTTP/1.1.
+         */
+        http2,
+        /**
+         * Same as http2, but also speak HTTP/2 to http servers without
+         * upgrade, which fails if the server does not support it.
+         */
+        http2_prior_knowledge,
+    };
+
+    struct Concurrency {
+        enum class Mode {
+            /**
+             * Use config.threads.download/upload connections.
+             */
+            fixed,
+            /**
+             * Start with initial connections and double them every period
+             * as long as throughput increases by at least min_gain, up to max.
+             */
+            adaptive,
+        } mode = Mode::fixed;
+
+        unsigned initial = 2;
+        unsigned max = 32;
+
+        std::chrono::steady_clock::duration period = std::chrono::milliseconds{500};
+        double min_gain = 0.05;
+    };
+
+    /**
+     * Owns a list built by curl_slist_append.
+     */
+    struct Slist_deleter {
+        void operator () (curl_slist *list) const noexcept;
+    };
+    using Slist_t = std::unique_ptr<curl_slist, Slist_deleter>;
+
 protected:
     curl::curl_t curl;
+
+    /**
+     * One mutex per curl_lock_data, locked by libcurl through the lock callbacks
+     * of share, so that easy handles of different threads can use share.
+     * <br>Declared before share, since curl_share_cleanup locks them too.
+     */
+    std::array<std::mutex, 8> share_locks;
+
+    struct Share_deleter {
+        void operator () (void *share) const noexcept;
+    };
+    /**
+     * libcurl share handle of DNS cache, connection cache and SSL sessions,
+     * used by every easy handle returned by create_easy, so that
+     * get_best_server, download and upload reuse the same connections.
+     *
+     * Can be nullptr if libcurl failed to create it.
+     */
+    std::unique_ptr<void, Share_deleter> share;
+
+    /**
+     * Set by set_connect_to, passed as CURLOPT_CONNECT_TO to every easy 
+     * handle returned by create_easy.
+     */
+    Slist_t connect_to;
+
+    /**
+     * Easy handles released by release_easy, to be reused by create_easy.
+     */
+    std::vector<curl::Easy_t> easy_pool;
+
     const utils::ShutdownEvent &shutdown_event;
 
     unsigned long timeout = 0;
@@ -60,8 +222,51 @@ protected:
     FILE *stderr_stream = nullptr;
     Verbose_level verbose_level = Verbose_level::none;
 
+    ThroughputSampler::Warmup warmup;
+    Concurrency concurrency;
+    Transfer_mode transfer_mode = Transfer_mode::http1;
+    Loaded_latency loaded_latency;
+
+    unsigned transfer_threads = 1;
+    std::vector<int> transfer_cpus;
+
+    Upload_payload::Kind payload_kind = Upload_payload::Kind::alphabet;
+    /**
+     * Generated on first upload and reused afterwards.
+     */
+    Upload_payload payload;
+
+    /**
+     * Reuse an easy handle from easy_pool if there's any, otherwise create one.
+     *
+     * Options set on the reused handle by its previous user is reset by reset_easy.
+     */
     auto create_easy() noexcept -> curl::Easy_t;
 
+    /**
+     * Reset the per-transfer options that users of create_easy set, 
+     * while options set by curl_t::create_easy and connections are kept.
+     * <br>Options set for every handle by create_easy, like timeout, are
+     * set again by create_easy itself.
+     *
+     * An option set on an easy handle returned by create_easy must be reset
+     * here, unless it is always set again before each transfer, like url.
+     */
+    static void reset_easy(curl::Easy_ref_t easy_ref) noexcept;
+
+    /**
+     * @param multiplex if false, multiplexing is explicitly disabled so that
+     *                  every transfer gets its own connection.
+     */
+    auto create_multi(bool multiplex = false) noexcept -> Ret_except<curl::Multi_t, curl::Exception>;
+
+    /**
+     * Put easy back to easy_pool for create_easy to reuse.
+     *
+     * @param easy must not be added to any multi handle.
+     */
+    void release_easy(curl::Easy_t &&easy) noexcept;
+
     /**
      * @param url will be dupped thus can be freed after this call.
      *            <br>Have to be in format hostname:port/path?query. 
@@ -98,8 +303,40 @@ protected:
 
     static std::size_t null_writeback(char*, std::size_t, std::size_t size, void*) noexcept;
 
+    /**
+     * @return time from the request being sent to the first byte of response
+     *         being received in microseconds, so that DNS lookup and connection
+     *         setup is not counted.
+     *         <br>-1 if libcurl failed to provide the timing.
+     */
+    static auto get_latency(curl::Easy_ref_t easy_ref) noexcept -> std::int64_t;
+
+    /**
+     * @param sampler must have at least one sample.
+     * @return result with only speed, raw_speed, warmup_ns and bytes filled in,
+     *         other fields are zero or empty.
+     */
+    auto get_transfer_result(const ThroughputSampler &sampler) const noexcept -> Transfer_result;
+
+    struct Transfer_job;
+    struct Transfer_progress;
+    struct Transfer_worker;
+    struct Latency_prober;
+
+    /**
+     * Spread connections across transfer_threads threads, each has its own
+     * curl::Multi_t, and sample bytes transfered on the calling thread.
+     *
+     * @param connections ignored in Concurrency::Mode::adaptive.
+     * @param length in seconds, 0 means the test is not time-bounded.
+     */
+    auto run_transfers(Transfer_job &job, unsigned connections, unsigned length) noexcept ->
+        Ret_except<Transfer_result, std::bad_alloc, curl::Exception, curl::libcurl_bug>;
+
 public:
     /**
+     * @param shutdown_event once it happens, get_best_server, download and upload in 
+     *                       progress are aborted, their results are incomplete.
      * @param timeout in milliseconds. Set to 0 to disable (default);
      *                should be less than std::numeric_limits<long>::max().
      * @param ip_addr ipv4/ipv6 address
@@ -159,6 +396,68 @@ public:
      */
     void debug(const char *fmt, ...) noexcept;
 
+    /**
+     * Set how download and upload detects the end of warm-up.
+     *
+     * By default, ThroughputSampler::Warmup::Mode::plateau is used.
+     */
+    void set_warmup(const ThroughputSampler::Warmup &warmup) noexcept;
+
+    /**
+     * Set how download and upload decides the number of connections.
+     *
+     * By default, Concurrency::Mode::fixed is used.
+     */
+    void set_concurrency(const Concurrency &concurrency) noexcept;
+
+    /**
+     * Set how latency is probed while download and upload are running.
+     */
+    void set_loaded_latency(const Loaded_latency &loaded_latency) noexcept;
+
+    /**
+     * Set which protocol download and upload use.
+     *
+     * By default, Transfer_mode::http1 is used.
+     *
+     * @return false if mode requires multiplexing and libcurl does not
+     *         support it, in which case the transfer mode is not changed.
+     */
+    bool set_transfer_mode(Transfer_mode mode) noexcept;
+
+    /**
+     * Set what upload sends.
+     *
+     * By default, Upload_payload::Kind::alphabet is used.
+     */
+    void set_upload_payload(Upload_payload::Kind kind) noexcept;
+
+    /**
+     * Set how many threads download and upload spread their connections across,
+     * each thread runs its own event loop.
+     *
+     * By default, only one thread is used.
+     *
+     * @param threads 0 is treated as 1.
+     * @param cpus if not empty, the ith thread is pinned to cpus[i % cpus.size()].
+     */
+    void set_transfer_threads(unsigned threads, std::vector<int> cpus = {}) noexcept;
+
+    /**
+     * Connect to host_port for every url instead of the host and port in it,
+     * e.g. to run against a local server that stands in for speedtest.net 
+     * and every server it lists.
+     * <br>Urls, including the Host header and SNI, are left unchanged.
+     *
+     * Only affects curl::Easy_t created after this call.
+     *
+     * @param host_port in format host:port, or nullptr to connect to the
+     *                  url as is, which is the default.
+     *                  <br>IPv6 address must be enclosed in brackets.
+     * @return false if out of memory, in which case nothing is changed.
+     */
+    bool set_connect_to(const char *host_port) noexcept;
+
     /**
      * @warning all functions is this class is not thread-safe.
      */
@@ -173,7 +472,7 @@ public:
         std::string response;
 
         /**
-         * Call speedtest.create_easy and return easy_ref
+         * Call speedtest.create_easy if easy hasn't been created and return easy_ref
          * @return curl::Easy_ref_t::curl_easy can be nullptr, which in turn
          *         notify std::bad_alloc event.
          */
@@ -196,6 +495,28 @@ public:
          */
         std::set<Server_id> ignore_servers;
 
+        /**
+         * Validators of a http response, sent back in a conditional request
+         * so that the server can reply 304 if the response is not modified.
+         */
+        struct Validators {
+            /**
+             * Value of ETag, empty if absent.
+             */
+            std::string etag;
+            /**
+             * Value of Last-Modified, empty if absent.
+             */
+            std::string last_modified;
+
+            bool empty() const noexcept;
+        };
+
+        /**
+         * Validators of speedtest-config.php, set by get_config and load_config.
+         */
+        Validators config_validators;
+
         struct Sizes {
             static constexpr const std::array up_sizes{
                 32768u, 65536u, 131072u, 262144u, 524288u, 1048576u, 7340032u
@@ -219,6 +540,10 @@ public:
             unsigned download;
         } threads;
 
+        /**
+         * How long the test should last, in seconds.
+         * <br>0 means the test is only bounded by sizes.
+         */
         struct Length {
             unsigned upload;
             unsigned download;
@@ -226,6 +551,32 @@ public:
 
         unsigned upload_max;
 
+        /**
+         * How get_best_server probes latency of candidates.
+         */
+        struct Latency_probe {
+            /**
+             * Number of probes sent to each server, 0 is treated as 1.
+             */
+            unsigned count = 10;
+            /**
+             * Maximum number of servers probed concurrently, 0 is treated as 1.
+             */
+            unsigned max_inflight = 8;
+            /**
+             * Timeout of each probe in ms, a probe that timed out is treated 
+             * as failed.
+             * <br>0 to use the timeout passed to Speedtest (default).
+             */
+            unsigned long timeout = 0;
+        } latency_probe;
+
+        /**
+         * Number of servers nearest to the client that get_servers puts into 
+         * Candidate_servers::closest_servers.
+         */
+        std::size_t nearest_servers = 5;
+
         struct Client {
             /**
              * Information retrieved from [here][1]
@@ -257,6 +608,11 @@ public:
          */
         Config(Speedtest &speedtest_arg) noexcept;
 
+        /**
+         * Return easy to speedtest, so that the connection can be reused.
+         */
+        ~Config();
+
         class Exception: public std::runtime_error {
         public:
             using std::runtime_error::runtime_error;
@@ -281,27 +637,78 @@ public:
          * @return If std::bad_alloc, then both speedtest and config is in an undefined
          *         state.
          *         <br>Attempt to use them will be Undefine Behavior.
+         *
+         * If config_validators is not empty, a conditional request is sent and
+         * if the server replies 304, configurations already loaded are kept as-is.
          */
         auto get_config() noexcept -> Ret;
 
+        /**
+         * Save what get_config retrieved to path, so that load_config can 
+         * skip get_config next time.
+         *
+         * @return false on any I/O error, errno is set.
+         */
+        bool save_config(const char *path) const noexcept;
+
+        enum class Cache_status {
+            /**
+             * The cache cannot be read or is malformed, nothing is loaded.
+             */
+            invalid,
+            /**
+             * The cache is loaded, but written more than ttl ago.
+             * <br>It should be revalidated by get_config, which only
+             * retrieves the configurations again if they have changed.
+             */
+            expired,
+            /**
+             * The cache is loaded and can be used as-is.
+             */
+            fresh,
+        };
+
+        /**
+         * Restore what get_config retrieved, including config_validators, from
+         * path written by save_config.
+         */
+        auto load_config(const char *path, std::chrono::seconds ttl) noexcept -> Cache_status;
+
         struct Candidate_servers {
             /**
              * how many urls is parsed by get_servers
              */
             std::size_t url_parsed = 0;
 
+            /**
+             * Validators of every server list parsed by get_servers, paired with
+             * the url passed to get_servers.
+             */
+            std::vector<std::pair<std::string, Validators>> validators;
+
+            /**
+             * Set by get_servers if it revalidated the cache and found it not modified,
+             * in which case the candidates are from the cache, validators are the ones
+             * recorded in cache updated by the 304 responses, and the cache should
+             * be renewed by save_servers with the cache passed.
+             */
+            bool not_modified = false;
+
+            /**
+             * Non-owning view of a server in servers.
+             */
             struct Server {
                 static constexpr const std::string_view common_pattern = ":8080/speedtest/upload.php";
 
                 /**
-                 * @param url must be result of Server::url::get()
+                 * @param url must be Server::url
                  *
                  * Convenience function.
                  */
                 static void append_url(const char *url, std::string &built_url) noexcept;
 
                 /**
-                 * @param url must be result of Server::url::get()
+                 * @param url must be Server::url
                  *
                  * Convenience function.
                  *
@@ -312,47 +719,110 @@ public:
                  */
                 static void append_dirname_url(const char *url, std::string &built_url) noexcept;
 
+                /**
+                 * Max length appended by append_latency_url in addition to
+                 * append_dirname_url.
+                 */
+                static constexpr const std::size_t latency_url_sz = 15 + 20 + 1;
+
+                /**
+                 * @param url must be Server::url
+                 *
+                 * Convenience function.
+                 *
+                 * Append url of latency.txt, with the unix timestamp in ms 
+                 * and a trailing '.' as query to avoid caching, so that 
+                 * user can append an index to it for each probe.
+                 */
+                static void append_latency_url(const char *url, std::string &built_url) noexcept;
+
+                /**
+                 * Max length appended by append_image_name.
+                 */
+                static constexpr const std::size_t image_name_sz = 10 + 1 + 10 + 4;
+
+                /**
+                 * Append size + 'x' + size + ".jpg", the name of the image
+                 * to download, to a url built by append_dirname_url followed 
+                 * by "/random".
+                 */
+                static void append_image_name(unsigned size, std::string &built_url) noexcept;
+
                 Server_id server_id;
 
                 /**
-                 * If url.get()[0] == 1, then url contains hostname:port/path;
-                 * If url.get()[1] == 2, then url contains hostname only,
+                 * If url[0] == 1, then url contains hostname:port/path;
+                 * If url[0] == 2, then url contains hostname only,
                  * and the port is predefined to be 8080, path predefined to be 
                  * "/speedtest/upload.php"
                  */
-                std::unique_ptr<char[]> url;
+                const char *url;
 
-                std::string server_name;
-                std::string sponsor_name;
+                const char *server_name;
+                const char *sponsor_name;
 
                 GeoPosition position;
-                std::string country_name;
-
-                // Provide this for std::pair
-                Server(Server_id server_id,
-                       std::unique_ptr<char[]> &&url, 
-                       std::string &&server_name, 
-                       std::string &&sponsor_name, 
-                       GeoPosition pos, 
-                       std::string &&country_name) noexcept;
-
-                Server(Server&&) = default;
-                Server& operator = (Server&&) = default;
+                const char *country_name;
             };
 
-            std::forward_list<Server> servers;
+            /**
+             * Every server retrieved, stored flat so that parsing a list of thousands
+             * of servers does not allocate for each of them.
+             */
+            ServerTable servers;
 
-            using Server_ref = std::forward_list<Server>::iterator;
+            using Server_ref = ServerTable::Ref;
 
             /**
-             * shortest_distance is the distance between closest_servers
+             * @return view of servers[ref], whose strings are valid until servers 
+             *         is modified.
+             */
+            auto operator [] (Server_ref ref) const noexcept -> Server;
+
+            /**
+             * shortest_distance is the distance between closest_servers.front()
              * and current location.
              */
             double shortest_distance;
             /**
-             * Iterators into servers.
+             * Refs into servers, sorted by distance to current location.
              */
             std::vector<Server_ref> closest_servers;
+
+        protected:
+            /**
+             * Indexes used by index are refs into servers.
+             */
+            GeoIndex index;
+
+        public:
+            /**
+             * Build the spatial index over servers.
+             * <br>Must be called again after servers is modified.
+             */
+            void build_index() noexcept;
+
+            using Nearby_servers = std::vector<std::pair<Server_ref, double>>;
+
+            /**
+             * @return at most k servers nearest to position, paired with 
+             *         their distance in km and sorted by distance.
+             */
+            auto get_nearest(GeoPosition position, std::size_t k) const noexcept -> Nearby_servers;
+            /**
+             * @return servers within radius km of position, paired with 
+             *         their distance in km and sorted by distance.
+             */
+            auto get_within(GeoPosition position, double radius) const noexcept -> Nearby_servers;
+
+            /**
+             * Filled by get_best_server: every server in closest_servers
+             * that has been probed, paired with its latency and sorted
+             * by LatencySampler::Stats::operator <.
+             *
+             * Can be used to pick top K servers for multi-server download/upload.
+             */
+            std::vector<std::pair<Server_ref, LatencySampler::Stats>> ranked_servers;
         };
 
         static constexpr const char *server_list_urls[] = {
@@ -363,6 +833,18 @@ public:
             nullptr
         };
 
+        enum class Server_list_mode {
+            /**
+             * Wait for every url and merge all lists retrieved.
+             */
+            merge_all,
+            /**
+             * Use the first list that is parsed successfully and 
+             * cancel the rest.
+             */
+            first_success,
+        };
+
         /**
          * @param servers_include_p servers to be used, 
          *                          pass null or an empty set to include all.
@@ -376,62 +858,142 @@ public:
          *         <br>Attempt to use them will be Undefine Behavior.
          *
          * Get list of servers from preconfigured site.
+         *
+         * All urls are fetched concurrently, and lists are parsed in the order
+         * they are retrieved.
+         *
+         * @param cache if not null, must be opened.
+         *              <br>urls with validators recorded in cache are requested
+         *              conditionally.
+         *              <br>In Server_list_mode::first_success, the first list that
+         *              is not modified is taken from cache.
+         *              <br>In Server_list_mode::merge_all, cache is used only if every
+         *              list retrieved is not modified; otherwise, lists that are not 
+         *              modified are retrieved again unconditionally, since the cache
+         *              does not record which list each server comes from.
+         *              <br>In either case, the return value has not_modified set and
+         *              is the same as get_servers(*cache, servers_include_p, servers_exclude_p).
          */
         auto get_servers(const std::set<Server_id> *servers_include_p = nullptr, 
                          const std::set<Server_id> *servers_exclude_p = nullptr, 
-                         const char * const urls[] = server_list_urls) noexcept -> 
+                         const char * const urls[] = server_list_urls,
+                         Server_list_mode mode = Server_list_mode::merge_all,
+                         const ServerCache *cache = nullptr) noexcept -> 
+            Ret_except<Candidate_servers, std::bad_alloc, curl::Exception, curl::libcurl_bug>;
+
+        /**
+         * Save every server in candidates and validators of the lists to path, 
+         * so that get_servers(cache, ...) can use it instead of retrieving the lists again.
+         *
+         * candidates should be retrieved without servers_include_p and
+         * servers_exclude_p, so that the cache can be reused with different filters.
+         *
+         * @param cache if candidates.not_modified, must be the cache passed to get_servers,
+         *              whose servers are written with validators of candidates,
+         *              since candidates only holds the closest servers.
+         * @return false on any I/O error, errno is set.
+         */
+        static bool save_servers(const Candidate_servers &candidates, const char *path,
+                                 const ServerCache *cache = nullptr) noexcept;
+
+        /**
+         * @param cache must be opened.
+         *              <br>Servers are filtered the same way as get_servers, then
+         *              distance to every server is computed from cache in place.
+         * @return Candidate_servers with closest_servers and shortest_distance set, 
+         *         url_parsed == 0.
+         *         <br>Only servers in closest_servers are copied into 
+         *         Candidate_servers::servers, so that no allocation is made
+         *         for the rest.
+         */
+        auto get_servers(const ServerCache &cache,
+                         const std::set<Server_id> *servers_include_p = nullptr, 
+                         const std::set<Server_id> *servers_exclude_p = nullptr) noexcept ->
             Ret_except<Candidate_servers, std::bad_alloc>;
 
         /**
          * @pre candidates.servers.size() != 0
-         * @post after this function call, get_config and get_servers must not be
-         *       called on this object again.
          * @return lists of server that has the lowest latency and 
-         *         the lowest latency in ms.
+         *         the latency of them.
          *         <br>If std::bad_alloc, then both speedtest and config is in an undefined
          *         state.
          *         <br>Attempt to use them will be Undefine Behavior.
          *
-         * get_best_server will test every candidates.closest_servers
-         * and returns the one with lowest average transfer time for fixed
-         * amount of data.
+         * get_best_server will send latency_probe.count probes to every 
+         * candidates.closest_servers and returns the ones with fewest failed
+         * probes and then the lowest median latency.
+         * <br>Latency is measured from sending the request to receiving the first byte 
+         * of response, so DNS lookup and connection setup are excluded.
+         *
+         * Up to latency_probe.max_inflight servers are probed concurrently,
+         * each on its own connection.
+         * <br>If shutdown_event happens, probing is aborted and no server is returned.
          */
         auto get_best_server(Candidate_servers &candidates) noexcept ->
-            Ret_except<std::pair<std::vector<Candidate_servers::Server_ref>, std::size_t>, std::bad_alloc>;
+            Ret_except<std::pair<std::vector<Candidate_servers::Server_ref>, LatencySampler::Stats>, 
+                       std::bad_alloc, curl::Exception, curl::libcurl_bug>;
     };
 
     /**
      * @pre config.threads.download != 0
      * @param url must tbe the same format as Config::Candidate_servers::Server::url.
-     * @return download speed, bytes per second.
+     * @return download speed.
      *         <br>If std::bad_alloc, then both speedtest and config is in an undefined
      *         state.
      *         <br>Attempt to use them will be Undefine Behavior.
      *
-     * @post just before this function return, if return value is larger than 100000 
+     * @post just before this function return, if return value .speed is larger than 100000 
      *       and config.thread.upload < 8, config.thread.upload is set to 8.
      *
-     * config.threads.download will decides how many connections can be run 
-     * in parallel.
+     * In Concurrency::Mode::fixed, config.threads.download will decides how many
+     * connections can be run in parallel.
      * <br>You can modify that value manully.
+     *
+     * If config.length.download != 0, no new transfer will be started after
+     * config.length.download seconds and transfers in-flight will be aborted,
+     * with bytes already transfered counted.
      */
     auto download(Config &config, const char *url) noexcept -> 
-        Ret_except<std::size_t, std::bad_alloc, curl::Exception, curl::libcurl_bug>;
+        Ret_except<Transfer_result, std::bad_alloc, curl::Exception, curl::libcurl_bug>;
+
+    /**
+     * @pre urls.size() != 0
+     * @param urls each must tbe the same format as Config::Candidate_servers::Server::url.
+     *
+     * Same as download(config, url), except that connections are spread across
+     * servers in urls round-robin and speed of each server is also returned.
+     */
+    auto download(Config &config, const std::vector<const char*> &urls) noexcept -> 
+        Ret_except<Transfer_result, std::bad_alloc, curl::Exception, curl::libcurl_bug>;
 
     /**
      * @pre config.threads.upload != 0
      * @param url must tbe the same format as Config::Candidate_servers::Server::url.
-     * @return upload speed, bytes per second.
+     * @return upload speed.
      *         <br>If std::bad_alloc, then both speedtest and config is in an undefined
      *         state.
      *         <br>Attempt to use them will be Undefine Behavior.
      *
-     * config.threads.upload will decides how many connections can be run 
-     * in parallel.
+     * In Concurrency::Mode::fixed, config.threads.upload will decides how many
+     * connections can be run in parallel.
      * <br>You can modify that value manully.
+     *
+     * If config.length.upload != 0, no new transfer will be started after
+     * config.length.upload seconds and transfers in-flight will be aborted,
+     * with bytes already transfered counted.
      */
     auto upload(Config &config, const char *url) noexcept -> 
-        Ret_except<std::size_t, std::bad_alloc, curl::Exception, curl::libcurl_bug>;
+        Ret_except<Transfer_result, std::bad_alloc, curl::Exception, curl::libcurl_bug>;
+
+    /**
+     * @pre urls.size() != 0
+     * @param urls each must tbe the same format as Config::Candidate_servers::Server::url.
+     *
+     * Same as upload(config, url), except that connections are spread across
+     * servers in urls round-robin and speed of each server is also returned.
+     */
+    auto upload(Config &config, const std::vector<const char*> &urls) noexcept -> 
+        Ret_except<Transfer_result, std::bad_alloc, curl::Exception, curl::libcurl_bug>;
 };
 
 auto operator | (Speedtest::Verbose_level x, Speedtest::Verbose_level y) noexcept -> Speedtest::Verbose_level;
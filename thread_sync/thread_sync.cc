@@ -20,4 +20,11 @@ void Thread_sync::wait()
         return count == 0;
     });
 }
+bool Thread_sync::wait_for(std::chrono::steady_clock::duration timeout)
+{
+    std::unique_lock<std::mutex> lk(m);
+    return cv.wait_for(lk, timeout, [this]() noexcept {
+        return count == 0;
+    });
+}
 } /* namespace curl */
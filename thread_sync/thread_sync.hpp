@@ -3,6 +3,7 @@
 
 # include <mutex>
 # include <condition_variable>
+# include <chrono>
 # include <cstdint>
 
 namespace curl {
@@ -29,6 +30,12 @@ public:
      * Wait for the job to be done.
      */
     void wait();
+    /**
+     * Wait for the job to be done for at most timeout.
+     *
+     * @return true if the job is done.
+     */
+    bool wait_for(std::chrono::steady_clock::duration timeout);
 
     ~Thread_sync() = default;
 };
@@ -0,0 +1,200 @@
+#ifndef  __cpp_speedest_utils_Output_buffer_HPP__
+# define __cpp_speedest_utils_Output_buffer_HPP__
+
+# include <cmath>
+# include <cstddef>
+# include <cstdint>
+# include <cstdio>
+# include <cstring>
+
+# include <algorithm>
+# include <charconv>
+# include <string_view>
+
+namespace speedtest::utils {
+/**
+ * Append to a buffer provided by caller, counting bytes that do not fit
+ * instead of writing them.
+ */
+struct Output_buffer {
+    char *buffer;
+    std::size_t size;
+    std::size_t len = 0;
+
+    Output_buffer(char *buffer, std::size_t size) noexcept:
+        buffer{buffer},
+        size{size}
+    {}
+
+    void append(std::string_view str) noexcept
+    {
+        // str.data() of empty str can be nullptr.
+        if (len < size && !str.empty())
+            std::memcpy(buffer + len, str.data(), std::min(str.size(), size - len));
+        len += str.size();
+    }
+    void append(char c) noexcept
+    {
+        if (len < size)
+            buffer[len] = c;
+        ++len;
+    }
+
+    template <class Integer>
+    void append_int(Integer value) noexcept
+    {
+        char str[24];
+        auto *end = std::to_chars(str, str + sizeof(str), value).ptr;
+        append({str, static_cast<std::size_t>(end - str)});
+    }
+
+    /**
+     * Append value with exactly width digits, padded with '0'.
+     */
+    void append_digits(std::uint64_t value, unsigned width) noexcept
+    {
+        char str[20];
+        for (auto i = width; i != 0; --i) {
+            str[i - 1] = '0' + value % 10;
+            value /= 10;
+        }
+        append({str, width});
+    }
+
+    /**
+     * Append value / 10^scale in decimal, with trailing zeros after the
+     * decimal point removed but at least one digit kept, e.g. 1500 with scale 3 
+     * is appended as 1.5, 2000 as 2.0
+     *
+     * @param scale must be less than 20.
+     */
+    void append_fixed(std::uint64_t value, unsigned scale) noexcept
+    {
+        if (scale == 0) {
+            append_int(value);
+            return;
+        }
+
+        std::uint64_t divisor = 1;
+        for (auto i = scale; i != 0; --i)
+            divisor *= 10;
+
+        auto fraction = value % divisor;
+        for (; scale > 1 && fraction % 10 == 0; --scale)
+            fraction /= 10;
+
+        append_int(value / divisor);
+        append('.');
+        append_digits(fraction, scale);
+    }
+
+    /**
+     * Append value with 3 digits after the decimal point, or null if not finite.
+     */
+    void append_float(double value) noexcept
+    {
+        if (!std::isfinite(value)) {
+            append("null");
+            return;
+        }
+
+        // Fixed point is exact within this range, and avoids snprintf 
+        // which dominates formatting otherwise.
+        if (std::fabs(value) < 1e15) {
+            auto milli = std::llround(value * 1000);
+            if (milli < 0) {
+                append('-');
+                milli = -milli;
+            }
+            append_int(static_cast<std::uint64_t>(milli) / 1000);
+            append('.');
+            append_digits(static_cast<std::uint64_t>(milli) % 1000, 3);
+            return;
+        }
+
+        // Large enough for DBL_MAX in %f.
+        char str[320];
+        auto n = std::snprintf(str, sizeof(str), "%.3f", value);
+        append({str, std::min<std::size_t>(n, sizeof(str) - 1)});
+    }
+
+    /**
+     * Append timestamp_ms in ISO 8601, e.g. 2020-07-01T12:34:56.789Z
+     *
+     * Converted with the civil_from_days algorithm by Howard Hinnant instead
+     * of gmtime_r, which takes a global lock in glibc.
+     */
+    void append_timestamp(std::uint64_t timestamp_ms) noexcept
+    {
+        auto seconds = timestamp_ms / 1000;
+        auto days = static_cast<std::int64_t>(seconds / 86400);
+        auto secs_of_day = seconds % 86400;
+
+        // civil_from_days
+        days += 719468;
+        auto era = (days >= 0 ? days : days - 146096) / 146097;
+        auto doe = static_cast<std::uint64_t>(days - era * 146097);
+        auto yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        auto doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        auto mp = (5 * doy + 2) / 153;
+        auto day = doy - (153 * mp + 2) / 5 + 1;
+        auto month = mp < 10 ? mp + 3 : mp - 9;
+        auto year = static_cast<std::uint64_t>(static_cast<std::int64_t>(yoe) + era * 400) + (month <= 2);
+
+        append_digits(year, 4);
+        append('-');
+        append_digits(month, 2);
+        append('-');
+        append_digits(day, 2);
+        append('T');
+        append_digits(secs_of_day / 3600, 2);
+        append(':');
+        append_digits(secs_of_day / 60 % 60, 2);
+        append(':');
+        append_digits(secs_of_day % 60, 2);
+        append('.');
+        append_digits(timestamp_ms % 1000, 3);
+        append('Z');
+    }
+
+    void append_csv_field(std::string_view field, std::string_view delimiter) noexcept
+    {
+        bool need_quote = field.find_first_of("\"\r\n") != std::string_view::npos ||
+                          (!delimiter.empty() && field.find(delimiter) != std::string_view::npos);
+        if (!need_quote) {
+            append(field);
+            return;
+        }
+
+        append('"');
+        for (auto c: field) {
+            if (c == '"')
+                append('"');
+            append(c);
+        }
+        append('"');
+    }
+
+    void append_json_str(std::string_view str) noexcept
+    {
+        static constexpr const char hex[] = "0123456789abcdef";
+
+        append('"');
+        for (auto c: str) {
+            auto uc = static_cast<unsigned char>(c);
+
+            if (c == '"' || c == '\\') {
+                append('\\');
+                append(c);
+            } else if (uc < 0x20) {
+                char escaped[] = {'\\', 'u', '0', '0', hex[uc >> 4], hex[uc & 0xf]};
+                append({escaped, sizeof(escaped)});
+            } else
+                append(c);
+        }
+        append('"');
+    }
+};
+} /* namespace speedtest::utils */
+
+#endif
@@ -8,16 +8,20 @@ bool FakeShutdownEvent::has_event() const noexcept
     return false;
 }
 
-bool CtrlCShutdownEvent::is_triggered = false;
+std::atomic<bool> CtrlCShutdownEvent::is_triggered{false};
 CtrlCShutdownEvent::CtrlCShutdownEvent() noexcept
 {
-    sigaction(SIGINT, [](int signum) noexcept
+    auto handler = [](int signum) noexcept
     {
-        CtrlCShutdownEvent::is_triggered = true;
-    });
+        CtrlCShutdownEvent::is_triggered.store(true, std::memory_order_relaxed);
+    };
+
+    sigaction(SIGINT, handler);
+    // Sent by service managers to stop a daemon.
+    sigaction(SIGTERM, handler);
 }
 bool CtrlCShutdownEvent::has_event() const noexcept
 {
-    return is_triggered;
+    return is_triggered.load(std::memory_order_relaxed);
 }
 } /* namespace speedtest::utils */
@@ -2,6 +2,7 @@
 # define __cpp_speedest_utils_ctrlc_ShutdownEvent_HPP__
 
 # include <cstddef>
+# include <atomic>
 
 namespace speedtest::utils {
 class ShutdownEvent {
@@ -39,15 +40,20 @@ public:
 };
 
 class CtrlCShutdownEvent: public ShutdownEvent {
-    static bool is_triggered;
+    /**
+     * Written by the signal handler and read by any thread, so it has
+     * to be lock-free.
+     */
+    static std::atomic<bool> is_triggered;
+    static_assert(std::atomic<bool>::is_always_lock_free);
 
 public:
     /**
      * ctor would call utils::sigaction to register signal handler
-     * for SIGINT.
+     * for SIGINT and SIGTERM.
      *
      * User of this class must not set signal handler for SIGINT
-     * to something else.
+     * or SIGTERM to something else.
      */
     CtrlCShutdownEvent() noexcept;
 
@@ -67,7 +73,7 @@ public:
     /**
      * Destruct object of this class would make no difference.
      *
-     * It won't reset signal handler for SIGINT, thus
+     * It won't reset signal handler for SIGINT and SIGTERM, thus
      * other object of this class is still perfectly usable.
      */
     ~CtrlCShutdownEvent() = default;
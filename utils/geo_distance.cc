@@ -1,4 +1,5 @@
 #include "geo_distance.hpp"
+#include "geo_distance_kernel.hpp"
 #include <cmath>
 
 namespace speedtest::utils {
@@ -29,4 +30,16 @@ double geo_distance(float lat1, float lon1, float lat2, float lon2) noexcept
 
     return radius * c;
 }
+
+void geo_distance(float lat, float lon, const float *lats, const float *lons, std::size_t n, float *out) noexcept
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx512f"))
+        return geo_distance_avx512(lat, lon, lats, lons, n, out);
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return geo_distance_avx2(lat, lon, lats, lons, n, out);
+#endif
+
+    geo_distance_impl::geo_distance_kernel(lat, lon, lats, lons, n, out);
+}
 } /* namespace speedtest::utils */
@@ -1,8 +1,21 @@
 #ifndef  __cpp_speedest_utils_geo_distance_HPP__
 # define __cpp_speedest_utils_geo_distance_HPP__
 
+# include <cstddef>
+
 namespace speedtest::utils {
 double geo_distance(float lat1, float lon1, float lat2, float lon2) noexcept;
+
+/**
+ * Batch version of geo_distance: out[i] = geo_distance(lat, lon, lats[i], lons[i]).
+ *
+ * Computed in single precision with polynomial sin/cos/atan, vectorized with
+ * AVX-512 or AVX2 if the cpu supports them.
+ * <br>Absolute error is within a few meters.
+ *
+ * @param out must not overlap with lats or lons.
+ */
+void geo_distance(float lat, float lon, const float *lats, const float *lons, std::size_t n, float *out) noexcept;
 } /* namespace speedtest::utils */
 
 #endif
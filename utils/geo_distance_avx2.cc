@@ -0,0 +1,14 @@
+/**
+ * Compiled with -mavx2 -mfma -fno-math-errno -fno-trapping-math, only called if the cpu supports them.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+# include "geo_distance_kernel.hpp"
+
+namespace speedtest::utils {
+void geo_distance_avx2(float lat, float lon, const float *lats, const float *lons, std::size_t n, 
+                       float *out) noexcept
+{
+    geo_distance_impl::geo_distance_kernel(lat, lon, lats, lons, n, out);
+}
+} /* namespace speedtest::utils */
+#endif
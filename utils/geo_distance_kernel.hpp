@@ -0,0 +1,147 @@
+/**
+ * Internal header of geo_distance.cc, geo_distance_avx2.cc and geo_distance_avx512.cc.
+ *
+ * geo_distance_kernel is written as plain scalar code whose branches are all selects,
+ * so that each translation unit compiled with different -m flags get
+ * its own auto-vectorized copy.
+ */
+
+#ifndef  __cpp_speedest_utils_geo_distance_kernel_HPP__
+# define __cpp_speedest_utils_geo_distance_kernel_HPP__
+
+# include <cstddef>
+
+namespace speedtest::utils {
+namespace geo_distance_impl {
+static constexpr const float pi = 3.14159265358979323846f;
+static constexpr const float half_pi = pi / 2;
+static constexpr const float deg2rad = pi / 180;
+static constexpr const float radius = 6371.0f; // km
+
+/**
+ * @param x in [-pi/2, pi/2]
+ */
+static inline float sin_poly(float x) noexcept
+{
+    auto x2 = x * x;
+    return x * (1 + x2 * (-1.0f / 6 + x2 * (1.0f / 120 + x2 * (-1.0f / 5040 + 
+                x2 * (1.0f / 362880 + x2 * (-1.0f / 39916800))))));
+}
+
+/**
+ * @param x in [-pi/2, pi/2]
+ */
+static inline float cos_poly(float x) noexcept
+{
+    auto x2 = x * x;
+    return 1 + x2 * (-1.0f / 2 + x2 * (1.0f / 24 + x2 * (-1.0f / 720 + x2 * (1.0f / 40320 + 
+               x2 * (-1.0f / 3628800 + x2 * (1.0f / 479001600))))));
+}
+
+/**
+ * @param x in [-pi/2, pi/2]
+ * @param sin_x set to |sin(x)|
+ * @param cos_x set to cos(x)
+ *
+ * For |x| > pi/4, the polynomials are evaluated at pi/2 - |x| instead, since cos_poly
+ * loses relative precision when the result is close to 0.
+ */
+static inline void sincos_poly(float x, float &sin_x, float &cos_x) noexcept
+{
+    x = __builtin_fabsf(x);
+
+    bool big = x > pi / 4;
+    auto r = big ? half_pi - x : x;
+
+    auto sin_r = sin_poly(r);
+    auto cos_r = cos_poly(r);
+
+    sin_x = big ? cos_r : sin_r;
+    cos_x = big ? sin_r : cos_r;
+}
+
+/**
+ * @param y >= 0
+ * @param x >= 0, x and y must not both be 0.
+ * @return atan2(y, x) in [0, pi/2]
+ *
+ * Adapted from atanf of cephes.
+ */
+static inline float atan2_poly(float y, float x) noexcept
+{
+    bool swapped = y > x;
+
+    // t in [0, 1]
+    auto t = swapped ? x / y : y / x;
+
+    // Both branches are computed and selected, so that the loop can be if-converted
+    // without masked loads.
+    bool big = t > 0.4142135623730950f; // tan(pi/8)
+    auto offset = big ? pi / 4 : 0.0f;
+    t = big ? (t - 1) / (t + 1) : t;
+
+    auto z = t * t;
+    auto r = (((8.05374449538E-2f * z - 1.38776856032E-1f) * z + 1.99777106478E-1f) * z - 
+              3.33329491539E-1f) * z * t + t + offset;
+
+    return swapped ? half_pi - r : r;
+}
+
+/**
+ * Same as geo_distance(float lat, float lon, const float *lats, const float *lons, std::size_t n, float *out).
+ *
+ * With haversine a = sin^2(dlat/2) + sin^2(dlon/2) cos(lat1) cos(lat2), the distance is
+ * 2 * radius * atan2(sqrt(a), sqrt(1 - a)).
+ * <br>Since cos(lat1) cos(lat2) = cos^2(dlat/2) - sin^2((lat1 + lat2)/2),
+ *
+ *     a     = sin^2(dlat/2) cos^2(dlon/2) + sin^2(dlon/2) cos^2((lat1 + lat2)/2)
+ *     1 - a = cos^2(dlat/2) cos^2(dlon/2) + sin^2(dlon/2) sin^2((lat1 + lat2)/2)
+ *
+ * Both are sums of non-negative terms, so 1 - a does not lose precision
+ * near antipodes as it would if computed by subtraction in single precision.
+ */
+static inline void geo_distance_kernel(float lat, float lon, const float * __restrict lats, 
+                                       const float * __restrict lons, std::size_t n, 
+                                       float * __restrict out) noexcept
+{
+    auto lat1 = lat * deg2rad;
+    auto lon1 = lon * deg2rad;
+
+    for (std::size_t i = 0; i < n; ++i) {
+        auto lat2 = lats[i] * deg2rad;
+        auto lon2 = lons[i] * deg2rad;
+
+        // |dlat / 2| <= pi/2 and |(lat1 + lat2) / 2| <= pi/2
+        auto half_dlat = (lat2 - lat1) * 0.5f;
+        auto half_slat = (lat2 + lat1) * 0.5f;
+
+        // |dlon / 2| <= pi, and sin^2(x) == sin^2(pi - |x|), cos^2(x) == cos^2(pi - |x|)
+        auto half_dlon = __builtin_fabsf((lon2 - lon1) * 0.5f);
+        half_dlon = half_dlon > half_pi ? pi - half_dlon : half_dlon;
+
+        // Only squares are used below, so the signs dropped by sincos_poly do not matter.
+        float sin_dlat, cos_dlat, sin_slat, cos_slat, sin_dlon, cos_dlon;
+        sincos_poly(half_dlat, sin_dlat, cos_dlat);
+        sincos_poly(half_slat, sin_slat, cos_slat);
+        sincos_poly(half_dlon, sin_dlon, cos_dlon);
+
+        auto sin2_dlon = sin_dlon * sin_dlon;
+        auto cos2_dlon = cos_dlon * cos_dlon;
+
+        auto a = sin_dlat * sin_dlat * cos2_dlon + sin2_dlon * cos_slat * cos_slat;
+        auto b = cos_dlat * cos_dlat * cos2_dlon + sin2_dlon * sin_slat * sin_slat;
+
+        out[i] = 2 * radius * atan2_poly(__builtin_sqrtf(a), __builtin_sqrtf(b));
+    }
+}
+} /* namespace geo_distance_impl */
+
+# if defined(__x86_64__) || defined(__i386__)
+void geo_distance_avx2(float lat, float lon, const float *lats, const float *lons, std::size_t n, 
+                       float *out) noexcept;
+void geo_distance_avx512(float lat, float lon, const float *lats, const float *lons, std::size_t n, 
+                         float *out) noexcept;
+# endif
+} /* namespace speedtest::utils */
+
+#endif
@@ -0,0 +1,17 @@
+#include "get_cpu_ns.hpp"
+#include <sys/resource.h>
+
+namespace speedtest::utils {
+std::uint64_t get_cpu_ns() noexcept
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == -1)
+        return 0;
+
+    auto to_ns = [](const struct timeval &tv) noexcept -> std::uint64_t
+    {
+        return std::uint64_t(tv.tv_sec) * 1000 * 1000 * 1000 + std::uint64_t(tv.tv_usec) * 1000;
+    };
+    return to_ns(usage.ru_utime) + to_ns(usage.ru_stime);
+}
+} /* namespace speedtest::utils */
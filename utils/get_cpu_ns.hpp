@@ -0,0 +1,14 @@
+#ifndef  __cpp_speedest_utils_get_cpu_ns_HPP__
+# define __cpp_speedest_utils_get_cpu_ns_HPP__
+
+# include <cstdint>
+
+namespace speedtest::utils {
+/**
+ * @return CPU time (user + sys) consumed by all threads of the process in ns,
+ *         or 0 if getrusage failed.
+ */
+std::uint64_t get_cpu_ns() noexcept;
+} /* namespace speedtest::utils */
+
+#endif
@@ -0,0 +1,19 @@
+#include "set_thread_affinity.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+#include <cerrno>
+
+namespace speedtest::utils {
+int set_thread_affinity(int cpu) noexcept
+{
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+        return EINVAL;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+} /* namespace speedtest::utils */
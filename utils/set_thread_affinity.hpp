@@ -0,0 +1,13 @@
+#ifndef  __cpp_speedest_utils_set_thread_affinity_HPP__
+# define __cpp_speedest_utils_set_thread_affinity_HPP__
+
+namespace speedtest::utils {
+/**
+ * Pin the calling thread to cpu.
+ *
+ * @return 0 on success, errno otherwise.
+ */
+int set_thread_affinity(int cpu) noexcept;
+} /* namespace speedtest::utils */
+
+#endif
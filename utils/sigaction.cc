@@ -10,7 +10,7 @@ void sigaction(int signum, void (*handler)(int)) noexcept
     memset (&act, 0, sizeof (act));
 
     act.sa_handler = handler;
-    if (sigaction(SIGABRT, &act, nullptr) == -1)
+    if (sigaction(signum, &act, nullptr) == -1)
         err(1, "Attempt to register %d with void (*)(int) handler %p failed", signum, handler);
 }
 } /* namespace speedtest::utils */
@@ -23,8 +23,10 @@ auto split2long_set(void (*callback)(long integer, void *arg), void *arg,
             callback(val, arg);
 
             // If no more integers to be read in, break
-            if (endptr[0] == '\0')
+            if (endptr[0] == '\0') {
+                str = endptr;
                 break;
+            }
         }
     }
 
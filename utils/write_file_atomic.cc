@@ -0,0 +1,77 @@
+#include "write_file_atomic.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <string>
+
+namespace speedtest::utils {
+static bool write_all(int fd, const char *buffer, std::size_t len) noexcept
+{
+    while (len != 0) {
+        auto ret = ::write(fd, buffer, len);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        buffer += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+/**
+ * fsync the directory containing path, so that a rename into it is durable.
+ */
+static bool sync_parent_dir(const char *path) noexcept
+{
+    std::string dir{"."};
+    if (auto *slash = std::strrchr(path, '/'); slash)
+        dir.assign(path, slash == path ? 1 : slash - path);
+
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+
+    bool success = ::fsync(fd) == 0;
+    auto saved_errno = errno;
+    ::close(fd);
+    errno = saved_errno;
+
+    return success;
+}
+
+bool write_file_atomic(const char *path, const void *data, std::size_t len) noexcept
+{
+    // ".tmp." + pid, which is printed as a long with sign.
+    char suffix[5 + 1 + std::numeric_limits<long>::digits10 + 1 + 1];
+    std::snprintf(suffix, sizeof(suffix), ".tmp.%ld", static_cast<long>(getpid()));
+
+    std::string tmp_path{path};
+    tmp_path.append(suffix);
+
+    int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+        return false;
+
+    // Sync data before rename, so that path never refers to a file with data not written yet.
+    bool success = write_all(fd, static_cast<const char*>(data), len) && ::fsync(fd) == 0;
+    success = (::close(fd) == 0) && success;
+    success = success && std::rename(tmp_path.c_str(), path) == 0;
+
+    if (!success) {
+        auto saved_errno = errno;
+        ::unlink(tmp_path.c_str());
+        errno = saved_errno;
+        return false;
+    }
+
+    return sync_parent_dir(path);
+}
+} /* namespace speedtest::utils */
@@ -0,0 +1,19 @@
+#ifndef  __cpp_speedest_utils_write_file_atomic_HPP__
+# define __cpp_speedest_utils_write_file_atomic_HPP__
+
+# include <cstddef>
+
+namespace speedtest::utils {
+/**
+ * Write data to a temporary file in the same directory as path, then
+ * rename it to path, so that readers never see a partially written file.
+ * <br>The file is synced before rename and its directory after, so that
+ * it survives a crash too.
+ *
+ * @return false on any I/O error, errno is set.
+ *         <br>If syncing the directory fails, path is already replaced.
+ */
+bool write_file_atomic(const char *path, const void *data, std::size_t len) noexcept;
+} /* namespace speedtest::utils */
+
+#endif